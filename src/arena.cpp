@@ -0,0 +1,161 @@
+#include "arena.hpp"
+#include "globals.hpp"
+
+#include <atomic>
+#include <malloc.h>
+#include <set>
+
+static atomic<long> arena_takes(0);
+static atomic<long> arena_reused(0);
+static atomic<long> arena_allocated(0);
+static atomic<long> arena_released(0);
+static atomic<long> arena_dropped(0);
+static atomic<long> arena_copies(0);
+// shared by every thread's arena, so a pool with many threads does not keep ARENA_MAX_CTXTS ciphertexts each
+static atomic<size_t> arena_pooled_bytes(0);
+static thread_local long thread_copies = 0;
+
+// both parts of a relinearized ciphertext, phi(m) words per prime
+static size_t ctxt_bytes(const helib::Ctxt& ctxt){
+    return 2 * ctxt.getPrimeSet().card() * ctxt.getContext().getPhiM() * sizeof(long);
+}
+
+static void count_copy(){
+    arena_copies++;
+    thread_copies++;
+}
+
+// every thread's arena; constructed before the first arena, so destroyed after the last one
+static mutex& arenas_mutex(){
+    static mutex lock;
+    return lock;
+}
+
+static set<CtxtArena*>& arenas(){
+    static set<CtxtArena*> all;
+    return all;
+}
+
+CtxtArena& CtxtArena::Local(){
+    thread_local CtxtArena arena;
+    return arena;
+}
+
+CtxtArena::CtxtArena(){
+    lock_guard<mutex> guard(arenas_mutex());
+    arenas().insert(this);
+}
+
+void CtxtArena::Forget(const helib::PubKey* key){
+    lock_guard<mutex> guard(arenas_mutex());
+    for (CtxtArena* arena : arenas()){
+        lock_guard<mutex> pool_guard(arena->pool_mutex);
+        auto free_list = arena->pool.find(key);
+        if (free_list != arena->pool.end()){
+            arena->DropLocked(free_list->second);
+            arena->pool.erase(free_list);
+        }
+    }
+}
+
+void CtxtArena::DropLocked(vector<PooledCtxt>& free_list){
+    for (auto& pooled : free_list){
+        arena_pooled_bytes -= pooled.bytes;
+    }
+    free_list.clear();
+}
+
+ArenaStats CtxtArena::GlobalStats(){
+    return ArenaStats{arena_takes.load(), arena_reused.load(), arena_allocated.load(), arena_released.load(), arena_dropped.load(), arena_copies.load(), arena_pooled_bytes.load()};
+}
+
+CtxtArena::~CtxtArena(){
+    {
+        lock_guard<mutex> guard(arenas_mutex());
+        arenas().erase(this);
+    }
+    for (auto& free_list : pool){
+        for (auto& pooled : free_list.second){
+            arena_pooled_bytes -= pooled.bytes;
+        }
+    }
+}
+
+void CtxtArena::TuneAllocator(){
+    // DoubleCRT rows are phi(m) words per prime, above glibc's default mmap threshold
+    mallopt(M_MMAP_THRESHOLD, constants::ARENA_MMAP_THRESHOLD);
+    mallopt(M_TRIM_THRESHOLD, 2 * constants::ARENA_MMAP_THRESHOLD);
+}
+
+long CtxtArena::ThreadCopies(){
+    return thread_copies;
+}
+
+helib::Ctxt CtxtArena::Copy(const helib::Ctxt& src){
+    count_copy();
+    return src;
+}
+
+helib::Ctxt CtxtArena::Take(const helib::Ctxt& src){
+    arena_takes++;
+    count_copy();
+
+    unique_lock<mutex> guard(pool_mutex);
+    auto free_list = pool.find(&src.getPubKey());
+    if (free_list == pool.end() || free_list->second.empty()){
+        guard.unlock();
+        arena_allocated++;
+        return src;
+    }
+
+    arena_reused++;
+    helib::Ctxt ctxt = move(free_list->second.back().ctxt);
+    arena_pooled_bytes -= free_list->second.back().bytes;
+    free_list->second.pop_back();
+    guard.unlock();
+    // copy-assignment reuses the existing part buffers when their sizes match
+    ctxt = src;
+    return ctxt;
+}
+
+void CtxtArena::Release(helib::Ctxt&& ctxt){
+    arena_released++;
+
+    lock_guard<mutex> guard(pool_mutex);
+    vector<PooledCtxt>& free_list = pool[&ctxt.getPubKey()];
+    if ((int)free_list.size() >= constants::ARENA_MAX_CTXTS){
+        arena_dropped++;
+        return;
+    }
+    // reserved before the check, so threads releasing at once cannot overshoot the budget together
+    size_t bytes = ctxt_bytes(ctxt);
+    if (arena_pooled_bytes.fetch_add(bytes) + bytes > constants::ARENA_MAX_BYTES){
+        arena_pooled_bytes -= bytes;
+        arena_dropped++;
+        return;
+    }
+    free_list.push_back(PooledCtxt{move(ctxt), bytes});
+}
+
+void CtxtArena::Release(vector<helib::Ctxt>& ctxts){
+    for (auto& ctxt : ctxts){
+        Release(move(ctxt));
+    }
+    ctxts.clear();
+}
+
+void CtxtArena::Release(vector<vector<helib::Ctxt>>& ctxts){
+    for (auto& row : ctxts){
+        Release(row);
+    }
+    ctxts.clear();
+}
+
+size_t CtxtArena::Pooled() const{
+    lock_guard<mutex> guard(pool_mutex);
+    size_t pooled = 0;
+    for (auto& free_list : pool){
+        pooled += free_list.second.size();
+    }
+    return pooled;
+}
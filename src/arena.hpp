@@ -0,0 +1,73 @@
+/*
+Per-thread pool of ciphertexts for query temporaries: a released ciphertext keeps its DoubleCRT buffers and the
+next temporary is copied into them, so queries stop allocating and freeing several MB per intermediate result
+*/
+
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <set>
+#include <vector>
+#include <helib/helib.h>
+
+using namespace std;
+
+struct ArenaStats{
+    // temporaries handed out, and how many of them reused a pooled ciphertext
+    long takes;
+    long reused;
+    // temporaries that needed a new allocation
+    long allocated;
+    long released;
+    // released ciphertexts dropped because the pool was full
+    long dropped;
+    // ciphertext copies made through Take or Copy
+    long copies;
+    // bytes pooled by all threads' arenas, at most ARENA_MAX_BYTES
+    size_t pooled_bytes;
+};
+
+class CtxtArena{
+public:
+    // the calling thread's arena
+    static CtxtArena& Local();
+    // counters summed over all threads
+    static ArenaStats GlobalStats();
+    // keeps large buffers in the heap instead of mapping and unmapping them on every allocation
+    static void TuneAllocator();
+    // copies made on the calling thread; queries copy ciphertexts only through Take or Copy
+    static long ThreadCopies();
+    // counted copy, for results that leave the query and so do not come from the arena
+    static helib::Ctxt Copy(const helib::Ctxt& src);
+    // drops the ciphertexts pooled under key from every thread's arena; called before the key is destroyed, so
+    // a key allocated later at the same address is not handed ciphertexts of the old one
+    static void Forget(const helib::PubKey* key);
+
+    // a copy of src, built in the storage of a ciphertext released earlier on this thread when there is one
+    helib::Ctxt Take(const helib::Ctxt& src);
+    void Release(helib::Ctxt&& ctxt);
+    // releases every element and clears the vector
+    void Release(vector<helib::Ctxt>& ctxts);
+    void Release(vector<vector<helib::Ctxt>>& ctxts);
+
+    size_t Pooled() const;
+
+private:
+    // registers the arena for Forget
+    CtxtArena();
+    // hands the pooled bytes back to the global budget when the thread exits
+    ~CtxtArena();
+
+    struct PooledCtxt{
+        helib::Ctxt ctxt;
+        // recorded on release: at thread exit the ciphertext's context may already be gone
+        size_t bytes;
+    };
+    void DropLocked(vector<PooledCtxt>& free_list);
+
+    // ciphertexts can only be assigned to each other under the same public key
+    map<const helib::PubKey*, vector<PooledCtxt>> pool;
+    // the owning thread against Forget from other threads
+    mutable mutex pool_mutex;
+};
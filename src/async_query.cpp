@@ -0,0 +1,67 @@
+#include "async_query.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+int QueryExecutor::DefaultConcurrency(Server& server){
+    int window = max(1, constants::QUERY_BLOCK_WINDOW);
+    return (server.QueryThreads() + window - 1) / window + 1;
+}
+
+QueryExecutor::QueryExecutor(Server& _server, int concurrency, size_t max_queued)
+    : server(_server), pool(concurrency > 0 ? concurrency : DefaultConcurrency(_server), max(max_queued, (size_t)1)){
+}
+
+QueryExecutor::~QueryExecutor(){
+    // the pool waits for its queue before joining; a callback's exception has nowhere to go here
+    try{
+        pool.Wait();
+    }
+    catch (const exception&){
+    }
+}
+
+future<helib::Ctxt> QueryExecutor::CountingQuery(bool conjunctive, vector<pair<int, int>> query){
+    return Submit([conjunctive, query = move(query)](Server& server) mutable {
+        return server.CountingQuery(conjunctive, query);
+    });
+}
+
+future<pair<helib::Ctxt, helib::Ctxt>> QueryExecutor::MAFQuery(int snp, bool conjunctive, vector<pair<int, int>> query){
+    return Submit([snp, conjunctive, query = move(query)](Server& server) mutable {
+        return server.MAFQuery(snp, conjunctive, query);
+    });
+}
+
+future<vector<helib::Ctxt>> QueryExecutor::DistrubtionQuery(vector<pair<int, int>> prs_params){
+    return Submit([prs_params = move(prs_params)](Server& server) mutable {
+        return server.DistrubtionQuery(prs_params);
+    });
+}
+
+future<pair<helib::Ctxt, helib::Ctxt>> QueryExecutor::SimilarityQuery(int target_column, vector<helib::Ctxt> d, int threshold){
+    return Submit([target_column, d = move(d), threshold](Server& server) mutable {
+        return server.SimilarityQuery(target_column, d, threshold);
+    });
+}
+
+void QueryExecutor::Enqueue(function<void()> task){
+    // every executor thread blocked on a full queue from a callback would leave nothing to drain it
+    if (!pool.OnPoolThread()){
+        pool.Submit(move(task));
+    }
+    else if (!pool.TrySubmit(move(task))){
+        throw runtime_error("ERROR: the executor's queue is full; a query submitted from a callback cannot wait for room");
+    }
+}
+
+void QueryExecutor::Wait(){
+    if (pool.OnPoolThread()){
+        throw logic_error("ERROR: Wait called from a callback, which would wait for itself");
+    }
+    pool.Wait();
+}
+
+size_t QueryExecutor::Pending(){
+    return pool.Pending();
+}
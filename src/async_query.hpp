@@ -0,0 +1,97 @@
+/*
+Asynchronous queries on a Server. A QueryExecutor runs submitted queries on threads of its own, a few at a time,
+while their blocks share the server's query pool; results come back as futures or through a callback. Its queue
+is bounded, so a caller submitting hundreds of queries is held back instead of piling up their inputs. Callbacks
+run on the executor's threads, so they must not wait on it: Submit from a callback throws instead of blocking on a
+full queue, and Wait (or get() on a query that has not started) would wait for the callback itself
+*/
+
+#pragma once
+
+#include <functional>
+#include <future>
+#include <memory>
+#include <utility>
+#include <vector>
+#include <helib/helib.h>
+#include "globals.hpp"
+#include "server.hpp"
+#include "worker_pool.hpp"
+
+using namespace std;
+
+class QueryExecutor{
+public:
+    // concurrency: queries running at a time (0 = one more than it takes to fill the server's query pool with
+    // QUERY_BLOCK_WINDOW blocks each, so a query's serial tail overlaps the next one's blocks); max_queued:
+    // submitted queries waiting behind them. The server must outlive the executor
+    QueryExecutor(Server& server, int concurrency = constants::ASYNC_QUERY_CONCURRENCY,
+                  size_t max_queued = constants::ASYNC_QUEUE_DEPTH);
+    // waits for every submitted query
+    ~QueryExecutor();
+
+    QueryExecutor(const QueryExecutor&) = delete;
+    QueryExecutor& operator=(const QueryExecutor&) = delete;
+
+    // the Server queries; each blocks while the queue is full (throws runtime_error instead on an executor thread),
+    // and the future rethrows what the query threw
+    future<helib::Ctxt> CountingQuery(bool conjunctive, vector<pair<int, int>> query);
+    future<pair<helib::Ctxt, helib::Ctxt>> MAFQuery(int snp, bool conjunctive, vector<pair<int, int>> query);
+    future<vector<helib::Ctxt>> DistrubtionQuery(vector<pair<int, int>> prs_params);
+    future<pair<helib::Ctxt, helib::Ctxt>> SimilarityQuery(int target_column, vector<helib::Ctxt> d, int threshold);
+
+    // any call on the server, query(Server&), as above
+    template<typename Query>
+    auto Submit(Query query) -> future<decltype(query(declval<Server&>()))>;
+    // done(future) runs on the executor's thread once the query finished, with get() returning the result or
+    // rethrowing; an exception done throws itself is rethrown by Wait
+    template<typename Query, typename Done>
+    void Submit(Query query, Done done);
+    // returns an invalid future instead of blocking when the queue is full
+    template<typename Query>
+    auto TrySubmit(Query query) -> future<decltype(query(declval<Server&>()))>;
+
+    // blocks until every submitted query (and callback) has finished; throws logic_error on an executor thread
+    void Wait();
+    // queries queued or running
+    size_t Pending();
+    int Concurrency() const { return pool.Size(); }
+
+private:
+    static int DefaultConcurrency(Server& server);
+    // pool.Submit, failing fast where blocking would deadlock
+    void Enqueue(function<void()> task);
+
+    Server& server;
+    WorkerPool pool;
+};
+
+template<typename Query>
+auto QueryExecutor::Submit(Query query) -> future<decltype(query(declval<Server&>()))>{
+    using Result = decltype(query(declval<Server&>()));
+    auto task = make_shared<packaged_task<Result()>>([this, query = move(query)]() mutable { return query(server); });
+    future<Result> result = task->get_future();
+    Enqueue([task](){ (*task)(); });
+    return result;
+}
+
+template<typename Query, typename Done>
+void QueryExecutor::Submit(Query query, Done done){
+    using Result = decltype(query(declval<Server&>()));
+    auto task = make_shared<packaged_task<Result()>>([this, query = move(query)]() mutable { return query(server); });
+    Enqueue([task, done = move(done)]() mutable {
+        (*task)();
+        done(task->get_future());
+    });
+}
+
+template<typename Query>
+auto QueryExecutor::TrySubmit(Query query) -> future<decltype(query(declval<Server&>()))>{
+    using Result = decltype(query(declval<Server&>()));
+    auto task = make_shared<packaged_task<Result()>>([this, query = move(query)]() mutable { return query(server); });
+    future<Result> result = task->get_future();
+    if (!pool.TrySubmit([task](){ (*task)(); })){
+        return future<Result>();
+    }
+    return result;
+}
@@ -0,0 +1,670 @@
+/*
+pir_bench: times DB setup, every query type, the SquashCtxt variants and the comparator on a synthetic cohort,
+checks the decrypted query results against the plaintext engine (on a cohort of a few rows, then on the full
+one), times the plaintext queries for the HE overhead factor and writes the results as JSON
+
+usage: pir_bench [--rows N] [--cols N] [--predicates N] [--threads N] [--runs N] [--seed N]
+                 [--maf-min F] [--maf-max F] [--ld-block N] [--ld-strength F] [--causal N]
+                 [--heritability F] [--prevalence F] [--skip-similarity] [--async N] [--remote]
+                 [--transport socket|shm] [--output FILE] [--trace FILE]
+
+--cols is the number of SNPs; the phenotype is stored as one more column. SetData is only timed on cohorts of
+up to SETDATA_MAX_CELLS cells, as it needs the whole matrix in memory.
+--async N also submits batches of N queries at once to a QueryExecutor, which pipelines them on the query pool
+--remote also runs the queries from a Client through a Unix-domain socket (or shared memory with --transport shm),
+against a Server that holds only the client's public key, and breaks their latency down into compute,
+serialization and transport. It also compares the throughput of both transports on frames of ciphertexts
+--trace writes the query spans of all runs as Chrome trace-event JSON
+*/
+
+#include <chrono>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+#include <helib/helib.h>
+#include "arena.hpp"
+#include "async_query.hpp"
+#include "client.hpp"
+#include "cohort.hpp"
+#include "comparator.hpp"
+#include "cost.hpp"
+#include "globals.hpp"
+#include "memory.hpp"
+#include "ops.hpp"
+#include "plain.hpp"
+#include "protocol.hpp"
+#include "server.hpp"
+#include "shared_memory.hpp"
+#include "trace.hpp"
+#include "transport.hpp"
+
+using namespace std;
+
+struct BenchOptions{
+    int rows = 10000;
+    int cols = 16;
+    int predicates = 2;
+    int threads = 0;
+    int runs = 3;
+    unsigned long seed = 1;
+    CohortParams cohort;
+    bool skip_similarity = false;
+    bool remote = false;
+    // queries per batch of the async benchmark, 0 to skip it
+    int async = 0;
+    string transport = "socket";
+    string output = "";
+    string trace = "";
+};
+
+struct BenchResult{
+    string name;
+    vector<double> seconds;
+    size_t peak_rss;
+    // homomorphic operations per run
+    OpCounts ops;
+};
+
+// round trips of one frame of ciphertexts, parsed and sent back by the other end
+struct TransportResult{
+    string transport;
+    size_t ciphertexts;
+    size_t frame_bytes;
+    vector<double> seconds;
+    // on the client end, per round trip
+    double wait_s;
+};
+
+// a decrypted query result next to the plaintext answer (mod p)
+struct CheckResult{
+    string name;
+    long expected;
+    long decrypted;
+};
+
+static const long SETDATA_MAX_CELLS = 10000000;
+// rows of the cohort checked before the full one: few enough that a query squashing too few slots still passes,
+// so a check failing only at full size points at the squash window rather than at the circuits
+static const long SMALL_CHECK_ROWS = 10;
+
+static BenchOptions parse_options(int argc, char* argv[]){
+    BenchOptions options;
+    for (int i = 1; i < argc; i++){
+        string arg = argv[i];
+        auto value = [&](){
+            if (i + 1 >= argc){
+                throw invalid_argument("ERROR: missing value for " + arg);
+            }
+            return string(argv[++i]);
+        };
+
+        if (arg == "--rows") options.rows = stoi(value());
+        else if (arg == "--cols") options.cols = stoi(value());
+        else if (arg == "--predicates") options.predicates = stoi(value());
+        else if (arg == "--threads") options.threads = stoi(value());
+        else if (arg == "--runs") options.runs = stoi(value());
+        else if (arg == "--seed") options.seed = stoul(value());
+        else if (arg == "--maf-min") options.cohort.min_maf = stod(value());
+        else if (arg == "--maf-max") options.cohort.max_maf = stod(value());
+        else if (arg == "--ld-block") options.cohort.ld_block_size = stoi(value());
+        else if (arg == "--ld-strength") options.cohort.ld_strength = stod(value());
+        else if (arg == "--causal") options.cohort.causal_snps = stoi(value());
+        else if (arg == "--heritability") options.cohort.heritability = stod(value());
+        else if (arg == "--prevalence") options.cohort.prevalence = stod(value());
+        else if (arg == "--skip-similarity") options.skip_similarity = true;
+        else if (arg == "--remote") options.remote = true;
+        else if (arg == "--async") options.async = stoi(value());
+        else if (arg == "--transport") options.transport = value();
+        else if (arg == "--output") options.output = value();
+        else if (arg == "--trace") options.trace = value();
+        else throw invalid_argument("ERROR: unknown option " + arg);
+    }
+    if (options.rows <= 0 || options.cols <= 0 || options.runs <= 0){
+        throw invalid_argument("ERROR: rows, cols and runs must be positive");
+    }
+    if (options.predicates <= 0 || options.predicates > options.cols){
+        throw invalid_argument("ERROR: predicates must be between 1 and cols");
+    }
+    if (options.async < 0){
+        throw invalid_argument("ERROR: async must not be negative");
+    }
+    if (options.transport != "socket" && options.transport != "shm"){
+        throw invalid_argument("ERROR: transport must be socket or shm");
+    }
+    options.cohort.rows = options.rows;
+    options.cohort.snps = options.cols;
+    options.cohort.seed = options.seed;
+    options.cohort.causal_snps = min(options.cohort.causal_snps, options.cols);
+    return options;
+}
+
+// runs body `runs` times, after `setup` each time (not timed)
+static BenchResult measure(const string& name, int runs, function<void()> body, function<void()> setup = nullptr){
+    BenchResult result;
+    result.name = name;
+    ResetPeakRSS();
+    OpCounts ops_before = GlobalOpCounts();
+    for (int run = 0; run < runs; run++){
+        if (setup){
+            setup();
+        }
+        auto start = chrono::steady_clock::now();
+        body();
+        auto end = chrono::steady_clock::now();
+        result.seconds.push_back(chrono::duration<double>(end - start).count());
+    }
+    result.peak_rss = PeakRSS();
+    OpCounts ops_after = GlobalOpCounts();
+    for (int op = 0; op < HE_OP_COUNT; op++){
+        result.ops.counts[op] = (ops_after.counts[op] - ops_before.counts[op]) / runs;
+    }
+    cerr << name << ": " << result.seconds.back() << " s" << endl;
+    return result;
+}
+
+// both ends of a connection within this process: (server end, client end)
+static pair<unique_ptr<Connection>, unique_ptr<Connection>> connect_pair(const string& transport){
+    if (transport == "shm"){
+        string name = "/pir_bench." + to_string(getpid());
+        unique_ptr<Connection> server_end = SharedMemoryConnection::Create(name);
+        unique_ptr<Connection> client_end = SharedMemoryConnection::Open(name);
+        return pair(move(server_end), move(client_end));
+    }
+    // the connection is queued before it is accepted, and outlives the listener
+    UnixSocketListener listener("/tmp/pir_bench." + to_string(getpid()) + ".sock");
+    unique_ptr<Connection> client_end = UnixSocketConnection::Connect(listener.Path());
+    unique_ptr<Connection> server_end = listener.Accept();
+    return pair(move(server_end), move(client_end));
+}
+
+// sends the ciphertexts as a request and reads them back as a response; the other end decodes and re-encodes them
+// the way a QueryService does, so both sides serialize straight into the transport
+static TransportResult measure_transport(const string& transport, const helib::PubKey& public_key,
+                                         const vector<helib::Ctxt>& ctxts, int runs){
+    pair<unique_ptr<Connection>, unique_ptr<Connection>> ends = connect_pair(transport);
+    Connection& server_end = *ends.first;
+    Connection& client_end = *ends.second;
+    exception_ptr echo_error;
+    thread echo([&](){
+        try{
+            uint32_t type;
+            istream* in;
+            while ((in = server_end.NextFrame(type)) != nullptr && type != MSG_CLOSE){
+                QueryResponse response;
+                response.results = ReadRequest(*in, type, public_key, ctxts.size()).ciphertexts;
+                server_end.ReleaseFrame();
+                SendResponse(server_end, response);
+            }
+        }
+        catch (...){
+            echo_error = current_exception();
+        }
+    });
+
+    TransportResult result;
+    result.transport = transport;
+    result.ciphertexts = ctxts.size();
+    QueryRequest request;
+    request.type = MSG_SIMILARITY_QUERY;
+    request.ciphertexts = ctxts;
+    try{
+        for (int run = 0; run < runs; run++){
+            auto start = chrono::steady_clock::now();
+            SendRequest(client_end, request);
+            uint32_t type;
+            istream* in = client_end.NextFrame(type);
+            if (!in){
+                throw runtime_error("ERROR: the echo end closed the connection");
+            }
+            ReadResponse(*in, type, public_key);
+            client_end.ReleaseFrame();
+            result.seconds.push_back(chrono::duration<double>(chrono::steady_clock::now() - start).count());
+        }
+        client_end.Send(Frame{MSG_CLOSE, ""});
+    }
+    catch (...){
+        // unblocks the echo thread
+        ends.second.reset();
+        echo.join();
+        throw;
+    }
+    echo.join();
+    if (echo_error){
+        rethrow_exception(echo_error);
+    }
+    const TransportStats& stats = client_end.Stats();
+    result.frame_bytes = stats.bytes_sent / stats.frames_sent;
+    result.wait_s = (stats.send_s + stats.receive_s) / runs;
+    cerr << "Transport/" << transport << ": " << result.seconds.back() << " s" << endl;
+    return result;
+}
+
+static string json_string(const string& value){
+    string escaped = "\"";
+    for (char c : value){
+        if (c == '"' || c == '\\'){
+            escaped += '\\';
+        }
+        escaped += c;
+    }
+    return escaped + "\"";
+}
+
+static void write_json(ostream& out, const BenchOptions& options, const helib::Context& context, const vector<BenchResult>& results,
+                       const vector<QueryOps>& query_ops, const vector<QueryNoise>& query_noise, const PrimitiveCosts& costs,
+                       const vector<QueryEstimate>& estimates, const vector<CheckResult>& checks,
+                       const vector<QueryLatency>& remote_latency, const vector<TransportResult>& transports){
+    ArenaStats arena = CtxtArena::GlobalStats();
+
+    out << "{" << endl;
+    out << "  \"config\": {\"rows\": " << options.rows << ", \"cols\": " << options.cols
+        << ", \"predicates\": " << options.predicates << ", \"threads\": " << options.threads
+        << ", \"runs\": " << options.runs << ", \"seed\": " << options.seed << ", \"async\": " << options.async
+        << ", \"transport\": " << json_string(options.transport)
+        << ", \"m\": " << constants::M << ", \"p\": " << constants::P << ", \"bits\": " << constants::BITS
+        << ", \"slots\": " << context.getEA().size() << "}," << endl;
+    const CohortParams& cohort = options.cohort;
+    out << "  \"cohort\": {\"min_maf\": " << cohort.min_maf << ", \"max_maf\": " << cohort.max_maf
+        << ", \"ld_block_size\": " << cohort.ld_block_size << ", \"ld_strength\": " << cohort.ld_strength
+        << ", \"causal_snps\": " << cohort.causal_snps << ", \"heritability\": " << cohort.heritability
+        << ", \"prevalence\": " << cohort.prevalence << "}," << endl;
+    out << "  \"checks\": [" << endl;
+    for (size_t i = 0; i < checks.size(); i++){
+        out << "    {\"name\": " << json_string(checks[i].name) << ", \"expected\": " << checks[i].expected
+            << ", \"decrypted\": " << checks[i].decrypted << ", \"ok\": " << (checks[i].expected == checks[i].decrypted ? "true" : "false")
+            << "}" << (i + 1 < checks.size() ? "," : "") << endl;
+    }
+    out << "  ]," << endl;
+    out << "  \"arena\": {\"takes\": " << arena.takes << ", \"reused\": " << arena.reused
+        << ", \"allocated\": " << arena.allocated << ", \"copies\": " << arena.copies
+        << ", \"dropped\": " << arena.dropped << ", \"pooled_bytes\": " << arena.pooled_bytes << "}," << endl;
+    // the cost model's predictions, made before the queries ran, to compare with the results
+    out << "  \"costs\": ";
+    costs.WriteJSON(out);
+    out << "," << endl;
+    out << "  \"estimates\": [" << endl;
+    for (size_t i = 0; i < estimates.size(); i++){
+        out << "    ";
+        estimates[i].WriteJSON(out);
+        out << (i + 1 < estimates.size() ? "," : "") << endl;
+    }
+    out << "  ]," << endl;
+    out << "  \"results\": [" << endl;
+    for (size_t i = 0; i < results.size(); i++){
+        const BenchResult& r = results[i];
+        double total = 0, min_s = r.seconds[0], max_s = r.seconds[0];
+        for (double s : r.seconds){
+            total += s;
+            min_s = min(min_s, s);
+            max_s = max(max_s, s);
+        }
+        out << "    {\"name\": " << json_string(r.name) << ", \"runs\": " << r.seconds.size()
+            << ", \"mean_s\": " << total / r.seconds.size() << ", \"min_s\": " << min_s << ", \"max_s\": " << max_s
+            << ", \"peak_rss_bytes\": " << r.peak_rss << ", \"ops\": ";
+        r.ops.WriteJSON(out);
+        out << "}" << (i + 1 < results.size() ? "," : "") << endl;
+    }
+    out << "  ]," << endl;
+    // encrypted over plaintext latency of every query that ran both ways
+    map<string, double> means;
+    for (const BenchResult& r : results){
+        double total = 0;
+        for (double s : r.seconds){
+            total += s;
+        }
+        means[r.name] = total / r.seconds.size();
+    }
+    const string plain_prefix = "Plain/";
+    vector<string> overhead;
+    for (const auto& mean : means){
+        if (mean.first.compare(0, plain_prefix.size(), plain_prefix) != 0){
+            continue;
+        }
+        string query = mean.first.substr(plain_prefix.size());
+        if (means.count(query) && mean.second > 0){
+            ostringstream entry;
+            entry << "{\"query\": " << json_string(query) << ", \"encrypted_s\": " << means[query] << ", \"plain_s\": "
+                  << mean.second << ", \"factor\": " << means[query] / mean.second << "}";
+            overhead.push_back(entry.str());
+        }
+    }
+    out << "  \"overhead\": [" << endl;
+    for (size_t i = 0; i < overhead.size(); i++){
+        out << "    " << overhead[i] << (i + 1 < overhead.size() ? "," : "") << endl;
+    }
+    out << "  ]," << endl;
+    // by stage, for the last run of each query
+    map<string, QueryOps> last_run;
+    for (const QueryOps& ops : query_ops){
+        last_run[ops.query] = ops;
+    }
+    out << "  \"query_ops\": [" << endl;
+    size_t written = 0;
+    for (const auto& query : last_run){
+        out << "    ";
+        query.second.WriteJSON(out);
+        out << (++written < last_run.size() ? "," : "") << endl;
+    }
+    out << "  ]," << endl;
+    map<string, QueryNoise> last_noise;
+    for (const QueryNoise& noise : query_noise){
+        last_noise[noise.query] = noise;
+    }
+    out << "  \"remote_latency\": [" << endl;
+    for (size_t i = 0; i < remote_latency.size(); i++){
+        out << "    ";
+        remote_latency[i].WriteJSON(out);
+        out << (i + 1 < remote_latency.size() ? "," : "") << endl;
+    }
+    out << "  ]," << endl;
+    // MB/s counts the bytes of both directions
+    out << "  \"transport\": [" << endl;
+    for (size_t i = 0; i < transports.size(); i++){
+        const TransportResult& t = transports[i];
+        double total = 0;
+        for (double s : t.seconds){
+            total += s;
+        }
+        double mean_s = total / t.seconds.size();
+        out << "    {\"transport\": " << json_string(t.transport) << ", \"ciphertexts\": " << t.ciphertexts
+            << ", \"frame_bytes\": " << t.frame_bytes << ", \"round_trips\": " << t.seconds.size()
+            << ", \"mean_s\": " << mean_s << ", \"wait_s\": " << t.wait_s
+            << ", \"throughput_mb_s\": " << 2 * t.frame_bytes / mean_s / 1e6 << "}" << (i + 1 < transports.size() ? "," : "") << endl;
+    }
+    out << "  ]," << endl;
+    out << "  \"query_noise\": [" << endl;
+    written = 0;
+    for (const auto& query : last_noise){
+        out << "    ";
+        query.second.WriteJSON(out);
+        out << (++written < last_noise.size() ? "," : "") << endl;
+    }
+    out << "  ]" << endl;
+    out << "}" << endl;
+}
+
+int main(int argc, char* argv[]){
+    BenchOptions options;
+    try{
+        options = parse_options(argc, argv);
+    }
+    catch (const exception& e){
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    CtxtArena::TuneAllocator();
+    Tracer::Global().Enable(!options.trace.empty());
+
+    helib::Context context = helib::ContextBuilder<helib::BGV>()
+                               .m(constants::M)
+                               .p(constants::P)
+                               .r(constants::R)
+                               .bits(constants::BITS)
+                               .c(constants::C)
+                               .build();
+
+    Server server(context, options.threads);
+
+    auto generate_start = chrono::steady_clock::now();
+    SyntheticCohort cohort(options.cohort, options.threads);
+    cerr << "cohort: " << chrono::duration<double>(chrono::steady_clock::now() - generate_start).count() << " s" << endl;
+    int num_cols = cohort.Columns();
+
+    mt19937 eng(options.seed);
+    uniform_int_distribution<unsigned long> genotype(0, 2);
+
+    vector<pair<int, int>> query;
+    for (int i = 0; i < options.predicates; i++){
+        query.push_back(pair(i, (int)genotype(eng)));
+    }
+    vector<pair<int, int>> prs_params;
+    for (int i = 0; i < options.cols; i++){
+        prs_params.push_back(pair(i, 1 + i % 5));
+    }
+    vector<unsigned long> d_values;
+    for (int i = 0; i < options.predicates; i++){
+        d_values.push_back(genotype(eng));
+    }
+
+    int maf_snp = options.predicates % options.cols;
+    vector<helib::Ctxt> d;
+    for (unsigned long value : d_values){
+        d.push_back(server.Encrypt(value));
+    }
+
+    // every query once, against the plaintext engine (which is exact, the encrypted results are mod p)
+    vector<CheckResult> checks;
+    auto check = [&](const string& name, long expected, long decrypted){
+        checks.push_back({name, expected, decrypted});
+        if (expected != decrypted){
+            cerr << "check " << name << " failed: expected " << expected << ", decrypted " << decrypted << endl;
+        }
+    };
+    auto mod_p = [](long value){ return value % (long)constants::P; };
+    // the loaded DB must be checked's
+    auto check_queries = [&](const SyntheticCohort& checked, const string& prefix){
+        PlainEngine plain = checked.Reference();
+        check(prefix + "CountingQuery/conjunctive", mod_p(plain.CountingQuery(true, query)), server.Decrypt(server.CountingQuery(true, query))[0]);
+        check(prefix + "CountingQuery/disjunctive", mod_p(plain.CountingQuery(false, query)), server.Decrypt(server.CountingQuery(false, query))[0]);
+        pair<long, long> alleles = plain.MAFQuery(maf_snp, true, query);
+        pair<helib::Ctxt, helib::Ctxt> maf_result = server.MAFQuery(maf_snp, true, query);
+        check(prefix + "MAFQuery/alleles", mod_p(alleles.first), server.Decrypt(maf_result.first)[0]);
+        check(prefix + "MAFQuery/chromosomes", mod_p(alleles.second), server.Decrypt(maf_result.second)[0]);
+        // rows whose decrypted score is right
+        vector<long> plain_scores = plain.DistrubtionQuery(prs_params);
+        vector<helib::Ctxt> scores = server.DistrubtionQuery(prs_params);
+        long right_scores = 0;
+        for (size_t j = 0; j < scores.size(); j++){
+            vector<long> decrypted = server.Decrypt(scores[j]);
+            for (long k = 0; k < server.GetSlotSize() && j * server.GetSlotSize() + k < plain_scores.size(); k++){
+                right_scores += decrypted[k] == mod_p(plain_scores[j * server.GetSlotSize() + k]);
+            }
+        }
+        check(prefix + "DistrubtionQuery/rows", plain.Rows(), right_scores);
+        if (!options.skip_similarity){
+            pair<long, long> similar = plain.SimilarityQuery(checked.PhenotypeColumn(), d_values, options.predicates);
+            pair<helib::Ctxt, helib::Ctxt> similar_result = server.SimilarityQuery(checked.PhenotypeColumn(), d, options.predicates);
+            check(prefix + "SimilarityQuery/with", mod_p(similar.first), server.Decrypt(similar_result.first)[0]);
+            check(prefix + "SimilarityQuery/without", mod_p(similar.second), server.Decrypt(similar_result.second)[0]);
+        }
+    };
+
+    CohortParams small_params = options.cohort;
+    small_params.rows = min((long)options.rows, SMALL_CHECK_ROWS);
+    SyntheticCohort small_cohort(small_params, options.threads);
+    server.LoadBlocks(small_params.rows, num_cols, [&](int col, int block, helib::Ptxt<helib::BGV>& ptxt){
+        small_cohort.Fill(col, block, ptxt);
+    }, options.threads);
+    check_queries(small_cohort, "Small/");
+
+    vector<BenchResult> results;
+
+    if ((long)options.rows * num_cols <= SETDATA_MAX_CELLS){
+        vector<vector<unsigned long>> db;
+        for (int col = 0; col < num_cols; col++){
+            db.push_back(cohort.Column(col));
+        }
+        results.push_back(measure("SetData", options.runs, [&](){ server.SetData(db); }));
+    }
+    results.push_back(measure("LoadBlocks", options.runs, [&](){
+        server.LoadBlocks(options.rows, num_cols, [&](int col, int block, helib::Ptxt<helib::BGV>& ptxt){
+            cohort.Fill(col, block, ptxt);
+        }, options.threads);
+    }));
+
+    // the full cohort, as the timed loads left it
+    PlainEngine plain = cohort.Reference();
+    check_queries(cohort, "");
+
+    PrimitiveCosts costs = server.CalibrateCosts();
+    vector<QueryEstimate> estimates = {server.EstimateCountingQuery(true, query.size()), server.EstimateCountingQuery(false, query.size()),
+                                       server.EstimateMAFQuery(true, query.size())};
+    if (!options.skip_similarity){
+        estimates.push_back(server.EstimateSimilarityQuery(options.predicates));
+    }
+
+    results.push_back(measure("CountingQuery/conjunctive", options.runs, [&](){ server.CountingQuery(true, query); }));
+    results.push_back(measure("CountingQuery/disjunctive", options.runs, [&](){ server.CountingQuery(false, query); }));
+    results.push_back(measure("MAFQuery", options.runs, [&](){ server.MAFQuery(maf_snp, true, query); }));
+    results.push_back(measure("DistrubtionQuery", options.runs, [&](){ server.DistrubtionQuery(prs_params); }));
+    if (!options.skip_similarity){
+        // the target is the phenotype
+        results.push_back(measure("SimilarityQuery", options.runs, [&](){ server.SimilarityQuery(cohort.PhenotypeColumn(), d, options.predicates); }));
+    }
+
+    // a batch of queries submitted at once, to compare with as many of the blocking calls above
+    if (options.async > 0){
+        QueryExecutor executor(server);
+        string batch = "/x" + to_string(options.async);
+        results.push_back(measure("Async/CountingQuery/conjunctive" + batch, options.runs, [&](){
+            vector<future<helib::Ctxt>> pending;
+            for (int i = 0; i < options.async; i++){
+                pending.push_back(executor.CountingQuery(true, query));
+            }
+            for (future<helib::Ctxt>& result : pending){
+                result.get();
+            }
+        }));
+        results.push_back(measure("Async/MAFQuery" + batch, options.runs, [&](){
+            vector<future<pair<helib::Ctxt, helib::Ctxt>>> pending;
+            for (int i = 0; i < options.async; i++){
+                pending.push_back(executor.MAFQuery(maf_snp, true, query));
+            }
+            for (future<pair<helib::Ctxt, helib::Ctxt>>& result : pending){
+                result.get();
+            }
+        }));
+        check("Async/CountingQuery/conjunctive", mod_p(plain.CountingQuery(true, query)), server.Decrypt(executor.CountingQuery(true, query).get())[0]);
+    }
+
+    // the same queries in plaintext, the baseline of the overhead factors
+    results.push_back(measure("Plain/CountingQuery/conjunctive", options.runs, [&](){ plain.CountingQuery(true, query); }));
+    results.push_back(measure("Plain/CountingQuery/disjunctive", options.runs, [&](){ plain.CountingQuery(false, query); }));
+    results.push_back(measure("Plain/MAFQuery", options.runs, [&](){ plain.MAFQuery(maf_snp, true, query); }));
+    results.push_back(measure("Plain/DistrubtionQuery", options.runs, [&](){ plain.DistrubtionQuery(prs_params); }));
+    if (!options.skip_similarity){
+        results.push_back(measure("Plain/SimilarityQuery", options.runs, [&](){ plain.SimilarityQuery(cohort.PhenotypeColumn(), d_values, options.predicates); }));
+    }
+
+    // the same queries through the client/server split: the server gets the client's public key over the
+    // connection, encrypts the cohort under it and answers; the client decrypts
+    vector<QueryLatency> remote_latency;
+    vector<TransportResult> transports;
+    if (options.remote){
+        pair<unique_ptr<Connection>, unique_ptr<Connection>> ends = connect_pair(options.transport);
+        unique_ptr<Connection> server_end = move(ends.first);
+        promise<void> loaded;
+        exception_ptr service_error;
+        thread service([&](){
+            try{
+                helib::PubKey client_key = QueryService::ReceivePublicKey(*server_end, context);
+                Server remote_server(client_key, options.threads);
+                remote_server.LoadBlocks(options.rows, num_cols, [&](int col, int block, helib::Ptxt<helib::BGV>& ptxt){
+                    cohort.Fill(col, block, ptxt);
+                }, options.threads);
+                loaded.set_value();
+                QueryService(remote_server).Serve(*server_end);
+            }
+            catch (...){
+                service_error = current_exception();
+                try{
+                    loaded.set_value();
+                }
+                catch (const future_error&){
+                }
+            }
+        });
+
+        Client client(context);
+        client.Connect(move(ends.second));
+        loaded.get_future().wait();
+        if (!service_error){
+            auto remote = [&](const string& name, function<void()> query){
+                results.push_back(measure(name, options.runs, [&](){
+                    query();
+                    remote_latency.push_back(client.LastLatency());
+                }));
+            };
+            remote("Remote/CountingQuery/conjunctive", [&](){ client.CountingQuery(true, query); });
+            remote("Remote/MAFQuery", [&](){ client.MAFQuery(maf_snp, true, query); });
+            remote("Remote/DistrubtionQuery", [&](){ client.DistrubtionQuery(prs_params); });
+            if (!options.skip_similarity){
+                remote("Remote/SimilarityQuery", [&](){ client.SimilarityQuery(cohort.PhenotypeColumn(), d_values, options.predicates); });
+            }
+            check("Remote/CountingQuery/disjunctive", mod_p(plain.CountingQuery(false, query)), client.CountingQuery(false, query));
+            remote_latency.push_back(client.LastLatency());
+        }
+        if (!service_error){
+            client.Close();
+        }
+        service.join();
+        if (service_error){
+            rethrow_exception(service_error);
+        }
+
+        // a DistrubtionQuery answer's worth of fresh ciphertexts (one per block) through each transport
+        int blocks = (options.rows + server.GetSlotSize() - 1) / server.GetSlotSize();
+        vector<helib::Ctxt> frame(blocks, client.Encrypt(1UL));
+        for (const char* transport : {"socket", "shm"}){
+            transports.push_back(measure_transport(transport, client.PublicKey(), frame, options.runs));
+        }
+    }
+
+    helib::Ctxt sample = server.Encrypt(1UL);
+    helib::Ctxt squash_input = sample;
+    auto reset_input = [&](){ squash_input = sample; };
+    results.push_back(measure("SquashCtxt/10", options.runs, [&](){ server.SquashCtxt(squash_input, 10); }, reset_input));
+    results.push_back(measure("SquashCtxt/rows", options.runs, [&](){ server.SquashCtxt(squash_input, min(options.rows, server.GetSlotSize())); }, reset_input));
+    results.push_back(measure("SquashCtxtLogTime", options.runs, [&](){ server.SquashCtxtLogTime(squash_input); }, reset_input));
+
+    // the comparator on its own, under a key of its own
+    helib::SecKey secret_key(context);
+    secret_key.GenSecKey();
+    helib::addSome1DMatrices(secret_key);
+    unique_ptr<he_cmp::Comparator> comparator;
+    results.push_back(measure("Comparator/setup", 1, [&](){
+        comparator = unique_ptr<he_cmp::Comparator>(new he_cmp::Comparator(context, he_cmp::UNI, 1, 1, secret_key, false, constants::COMPARATOR_CACHE_DIR));
+    }));
+    helib::Ptxt<helib::BGV> ptxt_x(context), ptxt_y(context);
+    for (long k = 0; k < ptxt_x.size(); k++){
+        ptxt_x[k] = genotype(eng);
+        ptxt_y[k] = genotype(eng);
+    }
+    helib::Ctxt ctxt_x(secret_key), ctxt_y(secret_key), ctxt_res(secret_key);
+    secret_key.Encrypt(ctxt_x, ptxt_x);
+    secret_key.Encrypt(ctxt_y, ptxt_y);
+    results.push_back(measure("Comparator/compare", options.runs, [&](){ comparator->compare(ctxt_res, ctxt_x, ctxt_y); }));
+
+    if (!options.trace.empty()){
+        Tracer::Global().WriteChromeTrace(options.trace);
+    }
+
+    if (options.output.empty()){
+        write_json(cout, options, context, results, server.QueryOpsLog(), server.QueryNoiseLog(), costs, estimates, checks, remote_latency, transports);
+    }
+    else{
+        ofstream out(options.output);
+        if (!out){
+            cerr << "ERROR: cannot write " << options.output << endl;
+            return 1;
+        }
+        write_json(out, options, context, results, server.QueryOpsLog(), server.QueryNoiseLog(), costs, estimates, checks, remote_latency, transports);
+    }
+    for (const CheckResult& c : checks){
+        if (c.expected != c.decrypted){
+            return 2;
+        }
+    }
+    return 0;
+}
@@ -1,5 +1,177 @@
 #include "client.hpp"
 
-Client::Client(const helib::Context &context){
+#include <chrono>
+#include <stdexcept>
+
+static double seconds_since(chrono::steady_clock::time_point start){
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+Client::Client(const helib::Context &context): secret_key(context){
     this->context = &context;
-}
\ No newline at end of file
+    // same as GenSecKey, but the key polynomial is kept for seeded encryption (as in the Server)
+    helib::DoubleCRT key_poly(context, context.allPrimes());
+    double key_bound = key_poly.sampleSmallBounded();
+    secret_key.ImportSecKey(key_poly, key_bound);
+    helib::addSome1DMatrices(secret_key);
+    seeded_encryptor = SeededEncryptor::Create(secret_key, key_poly);
+}
+
+Client::~Client(){
+    try{
+        Close();
+    }
+    catch (const exception&){
+        // the server may already be gone
+    }
+}
+
+helib::Ctxt Client::Encrypt(unsigned long a) const{
+    helib::Ptxt<helib::BGV> ptxt(*context);
+    for (long i = 0; i < ptxt.size(); i++){
+        ptxt[i] = a;
+    }
+    helib::Ctxt ctxt(secret_key);
+    secret_key.Encrypt(ctxt, ptxt);
+    return ctxt;
+}
+
+SeededCtxt Client::EncryptSeeded(unsigned long a) const{
+    if (!seeded_encryptor){
+        throw runtime_error("ERROR: seeded ciphertexts are not supported by this HElib serialization format");
+    }
+    helib::Ptxt<helib::BGV> ptxt(*context);
+    for (long i = 0; i < ptxt.size(); i++){
+        ptxt[i] = a;
+    }
+    return seeded_encryptor->Encrypt(ptxt);
+}
+
+vector<long> Client::Decrypt(const helib::Ctxt& ctxt) const{
+    helib::Ptxt<helib::BGV> ptxt(*context);
+    secret_key.Decrypt(ptxt, ctxt);
+
+    vector<helib::PolyMod> slots = ptxt.getSlotRepr();
+    vector<long> result(slots.size());
+    for (size_t i = 0; i < slots.size(); i++){
+        result[i] = (long)slots[i];
+    }
+    return result;
+}
+
+void Client::Connect(unique_ptr<Connection> _connection){
+    Close();
+    // the public key part only, with the key-switching matrices
+    static_cast<const helib::PubKey&>(secret_key).writeTo(_connection->BeginFrame(MSG_PUBLIC_KEY));
+    _connection->EndFrame();
+    connection = move(_connection);
+}
+
+void Client::Close(){
+    if (!connection){
+        return;
+    }
+    Frame frame;
+    frame.type = MSG_CLOSE;
+    unique_ptr<Connection> closing = move(connection);
+    closing->Send(frame);
+}
+
+const Connection& Client::Transport() const{
+    if (!connection){
+        throw invalid_argument("ERROR: the client is not connected");
+    }
+    return *connection;
+}
+
+vector<vector<long>> Client::Run(const string& name, const QueryRequest& request, double encrypt_s){
+    if (!connection){
+        throw invalid_argument("ERROR: the client is not connected");
+    }
+    auto start = chrono::steady_clock::now();
+    TransportStats before = connection->Stats();
+
+    // serialization is timed without the transport's own time, which with shared memory overlaps it
+    auto encode_start = chrono::steady_clock::now();
+    SendRequest(*connection, request);
+    double client_serialize_s = seconds_since(encode_start) - (connection->Stats().send_s - before.send_s);
+
+    uint32_t type;
+    istream* in = connection->NextFrame(type);
+    if (!in){
+        connection.reset();
+        throw runtime_error("ERROR: the server closed the connection");
+    }
+    double waited_s = connection->Stats().receive_s;
+    auto decode_start = chrono::steady_clock::now();
+    QueryResponse response = ReadResponse(*in, type, secret_key);
+    connection->ReleaseFrame();
+    client_serialize_s += seconds_since(decode_start) - (connection->Stats().receive_s - waited_s);
+
+    auto decrypt_start = chrono::steady_clock::now();
+    vector<vector<long>> results;
+    for (const helib::Ctxt& ctxt : response.results){
+        results.push_back(Decrypt(ctxt));
+    }
+    double decrypt_s = seconds_since(decrypt_start);
+
+    // encryption happened before the call, so it is added to the total as well
+    QueryLatency latency;
+    latency.query = name;
+    latency.client_crypto_s = encrypt_s + decrypt_s;
+    latency.serialize_s = client_serialize_s + response.serialize_s;
+    latency.compute_s = response.compute_s;
+    latency.total_s = seconds_since(start) + encrypt_s;
+    latency.transport_s = max(0.0, latency.total_s - latency.client_crypto_s - latency.serialize_s - latency.compute_s);
+    latency.request_bytes = connection->Stats().bytes_sent - before.bytes_sent;
+    latency.response_bytes = connection->Stats().bytes_received - before.bytes_received;
+    last_latency = latency;
+    return results;
+}
+
+long Client::CountingQuery(bool conjunctive, const vector<pair<int, int>>& query){
+    QueryRequest request;
+    request.type = MSG_COUNTING_QUERY;
+    request.conjunctive = conjunctive;
+    request.predicates = query;
+    return Run("CountingQuery", request, 0)[0][0];
+}
+
+pair<long, long> Client::MAFQuery(int snp, bool conjunctive, const vector<pair<int, int>>& query){
+    QueryRequest request;
+    request.type = MSG_MAF_QUERY;
+    request.conjunctive = conjunctive;
+    request.column = snp;
+    request.predicates = query;
+    vector<vector<long>> results = Run("MAFQuery", request, 0);
+    return pair(results[0][0], results[1][0]);
+}
+
+vector<long> Client::DistrubtionQuery(const vector<pair<int, int>>& prs_params){
+    QueryRequest request;
+    request.type = MSG_DISTRIBUTION_QUERY;
+    request.predicates = prs_params;
+    vector<long> scores;
+    for (const vector<long>& block : Run("DistrubtionQuery", request, 0)){
+        scores.insert(scores.end(), block.begin(), block.end());
+    }
+    return scores;
+}
+
+pair<long, long> Client::SimilarityQuery(int target_column, const vector<unsigned long>& d, int threshold){
+    QueryRequest request;
+    request.type = MSG_SIMILARITY_QUERY;
+    request.column = target_column;
+    request.threshold = threshold;
+    auto encrypt_start = chrono::steady_clock::now();
+    for (unsigned long value : d){
+        if (seeded_encryptor){
+            request.seeded.push_back(EncryptSeeded(value));
+        }
+        else{
+            request.ciphertexts.push_back(Encrypt(value));
+        }
+    }
+    vector<vector<long>> results = Run("SimilarityQuery", request, seconds_since(encrypt_start));
+    return pair(results[0][0], results[1][0]);
+}
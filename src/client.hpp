@@ -1,11 +1,60 @@
+/*
+Client: owns the secret key, encrypts the query inputs and decrypts the results. The server only ever sees the
+public key (sent at the start of a session) and ciphertexts
+*/
+
 #pragma once
 
 #include <iostream>
+#include <memory>
+#include <utility>
+#include <vector>
 #include <helib/helib.h>
+#include "protocol.hpp"
+#include "seeded.hpp"
+#include "transport.hpp"
+
+using namespace std;
 
 class Client{
 public:
+    // generates the secret key and the key-switching matrices the server's rotations need
     Client(const helib::Context &context);
+
+    const helib::PubKey& PublicKey() const { return secret_key; }
+    // the same value in every slot
+    helib::Ctxt Encrypt(unsigned long a) const;
+    // the same, in seeded (half-size) form; throws if this HElib's serialization does not support it
+    SeededCtxt EncryptSeeded(unsigned long a) const;
+    bool SupportsSeeded() const { return seeded_encryptor != nullptr; }
+    vector<long> Decrypt(const helib::Ctxt& ctxt) const;
+
+    // starts a session on the connection by sending the public key
+    void Connect(unique_ptr<Connection> connection);
+    // ends the session; the server then waits for its next connection
+    void Close();
+    ~Client();
+
+    // remote queries, as the Server ones, decrypted (values are mod p)
+    long CountingQuery(bool conjunctive, const vector<pair<int, int>>& query);
+    // alleles of the SNP over the matching rows, and twice the number of matching rows
+    pair<long, long> MAFQuery(int snp, bool conjunctive, const vector<pair<int, int>>& query);
+    // one score per slot of every block, so rows past the last one read 0
+    vector<long> DistrubtionQuery(const vector<pair<int, int>>& prs_params);
+    // d is encrypted here, one ciphertext per genotype, sent in seeded form when supported
+    pair<long, long> SimilarityQuery(int target_column, const vector<unsigned long>& d, int threshold);
+
+    // breakdown of the most recent remote query
+    const QueryLatency& LastLatency() const { return last_latency; }
+    const Connection& Transport() const;
+
 private:
+    // sends the request, waits for the answer and decrypts it; the request's ciphertexts count as client crypto
+    vector<vector<long>> Run(const string& name, const QueryRequest& request, double encrypt_s);
+
     const helib::Context* context;
-};
\ No newline at end of file
+    helib::SecKey secret_key;
+    unique_ptr<SeededEncryptor> seeded_encryptor;
+    unique_ptr<Connection> connection;
+    QueryLatency last_latency;
+};
@@ -0,0 +1,155 @@
+#include "cohort.hpp"
+#include "worker_pool.hpp"
+
+#include <cmath>
+#include <stdexcept>
+
+// independent random streams of a cohort
+enum CohortStream{MAF_STREAM = 1, CAUSAL_STREAM, HAPLOTYPE_STREAM, FOLLOW_STREAM, ALLELE_STREAM, ENVIRONMENT_STREAM};
+
+static uint64_t splitmix64(uint64_t x){
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// T with P(N(0, 1) > T) = tail
+static double normal_upper_quantile(double tail){
+    double low = -10, high = 10;
+    for (int i = 0; i < 100; i++){
+        double mid = (low + high) / 2;
+        if (0.5 * erfc(mid / sqrt(2.0)) > tail){
+            low = mid;
+        }
+        else{
+            high = mid;
+        }
+    }
+    return (low + high) / 2;
+}
+
+SyntheticCohort::SyntheticCohort(const CohortParams& _params, int num_threads) : params(_params){
+    if (params.rows <= 0 || params.snps <= 0){
+        throw invalid_argument("ERROR: a cohort needs rows and SNPs");
+    }
+    if (params.min_maf <= 0 || params.min_maf > params.max_maf || params.max_maf > 0.5){
+        throw invalid_argument("ERROR: allele frequencies must satisfy 0 < min_maf <= max_maf <= 0.5");
+    }
+    if (params.ld_block_size <= 0 || params.ld_strength < 0 || params.ld_strength > 1){
+        throw invalid_argument("ERROR: LD blocks need a positive size and a strength in [0, 1]");
+    }
+    if (params.phenotype && (params.causal_snps < 0 || params.causal_snps > params.snps || params.heritability < 0
+                             || params.heritability > 1 || params.prevalence <= 0 || params.prevalence >= 1)){
+        throw invalid_argument("ERROR: the phenotype needs at most snps causal SNPs, heritability in [0, 1] and prevalence in (0, 1)");
+    }
+
+    for (int snp = 0; snp < params.snps; snp++){
+        maf.push_back(params.min_maf + (params.max_maf - params.min_maf) * Uniform(MAF_STREAM, snp, 0));
+    }
+    // spread over the SNPs, so that (with enough SNPs) no two causal SNPs share an LD block
+    if (params.phenotype){
+        for (int i = 0; i < params.causal_snps; i++){
+            causal.push_back((int)((long)i * params.snps / params.causal_snps));
+        }
+    }
+    threshold = normal_upper_quantile(params.prevalence);
+
+    if (params.keep_shadow){
+        long words = (params.rows + 63) / 64;
+        auto packed = make_shared<vector<PackedColumn>>(Columns());
+
+        WorkerPool pool(num_threads);
+        for (int col = 0; col < Columns(); col++){
+            pool.Submit([this, &packed, col, words](){
+                PackedColumn& column = (*packed)[col];
+                column.low = vector<uint64_t>(words, 0);
+                column.high = vector<uint64_t>(words, 0);
+                for (long row = 0; row < params.rows; row++){
+                    unsigned long genotype = Generate(col, row);
+                    column.low[row / 64] |= (uint64_t)(genotype & 1) << (row % 64);
+                    column.high[row / 64] |= (uint64_t)(genotype >> 1) << (row % 64);
+                }
+            });
+        }
+        pool.Wait();
+        shadow = packed;
+    }
+}
+
+double SyntheticCohort::Uniform(uint64_t stream, uint64_t a, uint64_t b) const{
+    uint64_t x = splitmix64(params.seed ^ splitmix64(stream));
+    x = splitmix64(x ^ a);
+    x = splitmix64(x ^ b);
+    return (x >> 11) * 0x1.0p-53;
+}
+
+unsigned long SyntheticCohort::Allele(int snp, long row, int haplotype) const{
+    uint64_t chromosome = (uint64_t)row * 2 + haplotype;
+    // every SNP of a block thresholds the same haplotype draw when it follows the block, which keeps its
+    // frequency and makes the minor alleles of the block co-occur
+    double u = Uniform(FOLLOW_STREAM, snp, chromosome) < params.ld_strength
+               ? Uniform(HAPLOTYPE_STREAM, snp / params.ld_block_size, chromosome)
+               : Uniform(ALLELE_STREAM, snp, chromosome);
+    return u < maf[snp] ? 1 : 0;
+}
+
+unsigned long SyntheticCohort::Phenotype(long row) const{
+    // liability = standardized causal genotypes weighted to explain `heritability` of the variance, plus noise
+    double genetic = 0;
+    for (int snp : causal){
+        double f = maf[snp];
+        double z = ((double)(Allele(snp, row, 0) + Allele(snp, row, 1)) - 2 * f) / sqrt(2 * f * (1 - f));
+        genetic += Uniform(CAUSAL_STREAM, snp, 0) < 0.5 ? -z : z;
+    }
+    if (!causal.empty()){
+        genetic *= sqrt(params.heritability / causal.size());
+    }
+    double u1 = 1 - Uniform(ENVIRONMENT_STREAM, row, 0);
+    double u2 = Uniform(ENVIRONMENT_STREAM, row, 1);
+    double environment = sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+    double liability = genetic + environment * sqrt(1 - (causal.empty() ? 0 : params.heritability));
+    return liability > threshold ? 1 : 0;
+}
+
+unsigned long SyntheticCohort::Generate(int col, long row) const{
+    if (col < params.snps){
+        return Allele(col, row, 0) + Allele(col, row, 1);
+    }
+    return Phenotype(row);
+}
+
+unsigned long SyntheticCohort::Genotype(int col, long row) const{
+    if (col < 0 || col >= Columns() || row < 0 || row >= params.rows){
+        throw invalid_argument("ERROR: cohort cell out of range");
+    }
+    if (HasShadow()){
+        const PackedColumn& column = (*shadow)[col];
+        uint64_t bit = (uint64_t)1 << (row % 64);
+        return ((column.low[row / 64] & bit) ? 1 : 0) | ((column.high[row / 64] & bit) ? 2 : 0);
+    }
+    return Generate(col, row);
+}
+
+void SyntheticCohort::Fill(int col, int block, helib::Ptxt<helib::BGV>& ptxt) const{
+    long num_slots = ptxt.size();
+    long first = block * num_slots;
+    for (long k = 0; k < num_slots && first + k < params.rows; k++){
+        ptxt[k] = Genotype(col, first + k);
+    }
+}
+
+vector<unsigned long> SyntheticCohort::Column(int col) const{
+    vector<unsigned long> values(params.rows);
+    for (long row = 0; row < params.rows; row++){
+        values[row] = Genotype(col, row);
+    }
+    return values;
+}
+
+PlainEngine SyntheticCohort::Reference() const{
+    if (!HasShadow()){
+        throw invalid_argument("ERROR: the cohort was generated without its plaintext shadow");
+    }
+    return PlainEngine(params.rows, shadow);
+}
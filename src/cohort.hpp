@@ -0,0 +1,75 @@
+/*
+Synthetic cohorts for benchmarking: genotype matrices with per-SNP allele frequencies, linkage-disequilibrium
+blocks and a binary phenotype correlated with a few causal SNPs. Genotypes are a pure function of (seed, SNP,
+row), so blocks can be generated in any order and on any thread; a 2-bit plaintext shadow keeps the matrix for
+checking decrypted results with a PlainEngine
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include <helib/helib.h>
+#include "plain.hpp"
+
+using namespace std;
+
+struct CohortParams{
+    long rows = 10000;
+    int snps = 100;
+    unsigned long seed = 1;
+    // minor allele frequencies are drawn uniformly from [min_maf, max_maf]
+    double min_maf = 0.05;
+    double max_maf = 0.5;
+    // consecutive SNPs that share a haplotype block, and the probability that a SNP's allele follows the
+    // block's haplotype instead of being drawn on its own (0 = no LD)
+    int ld_block_size = 20;
+    double ld_strength = 0.8;
+    // binary trait under a liability-threshold model, stored as the column after the SNPs
+    bool phenotype = true;
+    int causal_snps = 10;
+    double heritability = 0.5;
+    double prevalence = 0.2;
+    // 2-bit plaintext copy of the genotypes (rows * columns / 4 bytes)
+    bool keep_shadow = true;
+};
+
+class SyntheticCohort{
+public:
+    // builds the shadow (if kept) on num_threads threads (0 = all hardware threads)
+    SyntheticCohort(const CohortParams& params, int num_threads = 0);
+
+    const CohortParams& Params() const { return params; }
+    long Rows() const { return params.rows; }
+    // the SNPs, then the phenotype if there is one
+    int Columns() const { return params.snps + (params.phenotype ? 1 : 0); }
+    int PhenotypeColumn() const { return params.phenotype ? params.snps : -1; }
+    double MAF(int snp) const { return maf[snp]; }
+    const vector<int>& CausalSNPs() const { return causal; }
+
+    unsigned long Genotype(int col, long row) const;
+    // slots of block `block` of column col; slots past the last row stay 0
+    void Fill(int col, int block, helib::Ptxt<helib::BGV>& ptxt) const;
+    vector<unsigned long> Column(int col) const;
+
+    bool HasShadow() const { return shadow != nullptr; }
+    // plaintext queries over the shadow, which it shares
+    PlainEngine Reference() const;
+
+private:
+    unsigned long Generate(int col, long row) const;
+    unsigned long Allele(int snp, long row, int haplotype) const;
+    unsigned long Phenotype(long row) const;
+
+    // uniform in [0, 1) from the seed and three counters
+    double Uniform(uint64_t stream, uint64_t a, uint64_t b) const;
+
+    CohortParams params;
+    vector<double> maf;
+    vector<int> causal;
+    // liability threshold for the prevalence
+    double threshold;
+
+    shared_ptr<vector<PackedColumn>> shadow;
+};
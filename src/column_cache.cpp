@@ -0,0 +1,102 @@
+#include "column_cache.hpp"
+
+ColumnCache::ColumnCache(size_t budget_bytes, function<vector<helib::Ctxt>(int, size_t&)> load):
+    budget_bytes(budget_bytes), load(load), resident_bytes(0), hits(0), misses(0), evictions(0), prefetches(0),
+    prefetch_pool(1, 64){
+}
+
+ColumnRef ColumnCache::Get(int col){
+    return Fetch(col, false);
+}
+
+void ColumnCache::Prefetch(const vector<int>& cols){
+    for (int col : cols){
+        // a full queue means the prefetcher is far behind; the query will load the column itself
+        prefetch_pool.TrySubmit([this, col](){
+            try{
+                Fetch(col, true);
+            }
+            catch (...){
+                // reported to whoever reads the column next
+            }
+        });
+    }
+}
+
+ColumnCacheStats ColumnCache::Stats(){
+    lock_guard<mutex> guard(lock);
+    return ColumnCacheStats{hits, misses, evictions, prefetches, resident_bytes, budget_bytes};
+}
+
+ColumnRef ColumnCache::Fetch(int col, bool prefetch){
+    unique_lock<mutex> guard(lock);
+
+    auto entry = resident.find(col);
+    if (entry != resident.end()){
+        if (!prefetch){
+            hits++;
+            lru.splice(lru.begin(), lru, entry->second.lru_position);
+        }
+        return entry->second.column;
+    }
+
+    auto pending = loading.find(col);
+    if (pending != loading.end()){
+        if (prefetch){
+            return nullptr;
+        }
+        // being prefetched: counts as a hit, the wait is shorter than a load
+        hits++;
+        shared_future<ColumnRef> column = pending->second;
+        guard.unlock();
+        return column.get();
+    }
+
+    if (prefetch){
+        prefetches++;
+    }
+    else{
+        misses++;
+    }
+    promise<ColumnRef> loaded;
+    loading[col] = loaded.get_future().share();
+    guard.unlock();
+
+    return FinishLoad(col, loaded);
+}
+
+ColumnRef ColumnCache::FinishLoad(int col, promise<ColumnRef>& loaded){
+    ColumnRef column;
+    size_t bytes = 0;
+    try{
+        column = make_shared<const vector<helib::Ctxt>>(load(col, bytes));
+    }
+    catch (...){
+        lock_guard<mutex> guard(lock);
+        loading.erase(col);
+        loaded.set_exception(current_exception());
+        throw;
+    }
+
+    lock_guard<mutex> guard(lock);
+    lru.push_front(col);
+    resident[col] = Entry{column, bytes, lru.begin()};
+    resident_bytes += bytes;
+    loading.erase(col);
+    Evict();
+
+    loaded.set_value(column);
+    return column;
+}
+
+void ColumnCache::Evict(){
+    while (resident_bytes > budget_bytes && lru.size() > 1){
+        int victim = lru.back();
+        lru.pop_back();
+
+        auto entry = resident.find(victim);
+        resident_bytes -= entry->second.bytes;
+        resident.erase(entry);
+        evictions++;
+    }
+}
@@ -0,0 +1,76 @@
+/*
+Memory-budgeted LRU cache of DB columns for databases that do not fit in memory: columns are paged in from
+the backing store on demand (or ahead of time by Prefetch) and the least recently used ones are dropped
+*/
+
+#pragma once
+
+#include <functional>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <helib/helib.h>
+#include "worker_pool.hpp"
+
+using namespace std;
+
+// a pinned column: it stays alive while referenced, even if the cache evicts it meanwhile
+typedef shared_ptr<const vector<helib::Ctxt>> ColumnRef;
+
+struct ColumnCacheStats{
+    long hits;
+    long misses;
+    long evictions;
+    long prefetches;
+    size_t resident_bytes;
+    size_t budget_bytes;
+};
+
+class ColumnCache{
+public:
+    // load(col, bytes) reads a column from the backing store and sets bytes to its in-memory size
+    ColumnCache(size_t budget_bytes, function<vector<helib::Ctxt>(int, size_t&)> load);
+
+    ColumnCache(const ColumnCache&) = delete;
+    ColumnCache& operator=(const ColumnCache&) = delete;
+
+    ColumnRef Get(int col);
+    // starts loading the columns that are not resident; never blocks the caller
+    void Prefetch(const vector<int>& cols);
+
+    ColumnCacheStats Stats();
+
+private:
+    struct Entry{
+        ColumnRef column;
+        size_t bytes;
+        list<int>::iterator lru_position;
+    };
+
+    // a prefetch only loads columns that are neither resident nor being loaded, and is not counted as a hit or miss
+    ColumnRef Fetch(int col, bool prefetch);
+    ColumnRef FinishLoad(int col, promise<ColumnRef>& loaded);
+    // drops least recently used columns until the budget is met (the most recent one always stays)
+    void Evict();
+
+    size_t budget_bytes;
+    function<vector<helib::Ctxt>(int, size_t&)> load;
+
+    map<int, Entry> resident;
+    // most recently used first
+    list<int> lru;
+    map<int, shared_future<ColumnRef>> loading;
+    size_t resident_bytes;
+
+    long hits;
+    long misses;
+    long evictions;
+    long prefetches;
+
+    mutex lock;
+    // declared last so that it is destroyed (and its pending loads finish) first
+    WorkerPool prefetch_pool;
+};
@@ -1,5 +1,8 @@
 #include "comparator.hpp"
 #include "tools.hpp"
+#include "io.hpp"
+#include "ops.hpp"
+#include "trace.hpp"
 #include <helib/debugging.h>
 #include <helib/polyEval.h>
 #include <random>
@@ -7,9 +10,59 @@
 #include <NTL/ZZ_pE.h>
 #include <NTL/mat_ZZ_pE.h>
 #include <helib/Ptxt.h>
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
 
 using namespace he_cmp;
 
+// HElib's named timers are unsynchronized function-local statics, and queries run comparisons on several threads
+// at once. The circuits only time themselves while a (single-threaded) test function holds a TimerScope
+static atomic<bool> timers_enabled(false);
+
+class TimerScope{
+public:
+  TimerScope() { setTimersOn(); timers_enabled = true; }
+  ~TimerScope() { timers_enabled = false; }
+};
+
+class CircuitTimer{
+public:
+  // like HElib's auto_timer, a timer already running (a recursive call) is left to its owner
+  CircuitTimer(const char* name, const char* loc): timer(timers_enabled ? Get(name, loc) : nullptr)
+  {
+    if (timer && timer->isOn) timer = nullptr;
+    if (timer) timer->start();
+  }
+  ~CircuitTimer() { stop(); }
+
+  void stop()
+  {
+    if (timer) timer->stop();
+    timer = nullptr;
+  }
+
+private:
+  // created on first use and never freed, HElib's timer registry keeps pointers to them
+  static FHEtimer* Get(const char* name, const char* loc)
+  {
+    static mutex timers_mutex;
+    static map<string, FHEtimer*> timers;
+    lock_guard<mutex> guard(timers_mutex);
+    FHEtimer*& timer = timers[name];
+    if (!timer) timer = new FHEtimer(name, loc);
+    return timer;
+  }
+
+  FHEtimer* timer;
+};
+
+#define CIRCUIT_TIMER_START(label) CircuitTimer _circuit_timer_##label(#label, HELIB_AT)
+#define CIRCUIT_TIMER_STOP(label) _circuit_timer_##label.stop()
+
 // polynomial coefficients of bivariate polynomial decomposition as in Theorem 2 for different plaintext moduli
 map<unsigned long, vector<vector<long>>> fcoefs {
   {11,
@@ -617,7 +670,8 @@ void Comparator::extraction_init()
 
 void Comparator::extract_mod_p(vector<Ctxt>& mod_p_coefs, const Ctxt& ctxt_x) const
 {
-	HELIB_NTIMER_START(Extraction);
+	CIRCUIT_TIMER_START(Extraction);
+	TRACE_SPAN("Extraction");
 	mod_p_coefs.clear();
 
 	if (m_slotDeg == 1)
@@ -636,7 +690,7 @@ void Comparator::extract_mod_p(vector<Ctxt>& mod_p_coefs, const Ctxt& ctxt_x) co
 	vector<Ctxt> ctxt_frob(d-1, ctxt_x);
 	for(long iFrob = 1; iFrob < d; iFrob++)
 	{
-		ctxt_frob[iFrob-1].frobeniusAutomorph(iFrob);
+		counted::Frobenius(ctxt_frob[iFrob-1], iFrob);
 	} 
 
 	for(long iCoef = 0; iCoef < m_slotDeg; iCoef++)
@@ -644,32 +698,267 @@ void Comparator::extract_mod_p(vector<Ctxt>& mod_p_coefs, const Ctxt& ctxt_x) co
 		//cout << "Extract coefficient " << iCoef << endl;
 		Ctxt mod_p_ctxt = ctxt_x;
 
-		mod_p_ctxt.multByConstant(m_extraction_const[iCoef][0], m_extraction_const_size[iCoef][0]);
+		counted::MultByConstant(mod_p_ctxt, m_extraction_const[iCoef][0], m_extraction_const_size[iCoef][0]);
 
 		for(long iFrob = 1; iFrob < d; iFrob++)
 		{
 			Ctxt tmp = ctxt_frob[iFrob-1];
-			tmp.multByConstant(m_extraction_const[iCoef][iFrob], m_extraction_const_size[iCoef][iFrob]);
-			mod_p_ctxt += tmp; 
+			counted::MultByConstant(tmp, m_extraction_const[iCoef][iFrob], m_extraction_const_size[iCoef][iFrob]);
+			counted::Add(mod_p_ctxt, tmp);
 		}
 		mod_p_coefs.push_back(mod_p_ctxt);
 	}
-	HELIB_NTIMER_STOP(Extraction);
+	CIRCUIT_TIMER_STOP(Extraction);
+}
+
+// magic bytes and format version of the precomputation table file
+static const char TABLE_MAGIC[8] = {'H', 'E', 'C', 'M', 'P', 'T', 'B', '1'};
+
+// NTL objects (ZZ, ZZX, mat_ZZ) are stored in their text form
+template<typename T>
+static string ntl_to_string(const T& x)
+{
+	ostringstream str;
+	str << x;
+	return str.str();
+}
+
+template<typename T>
+static void ntl_from_string(T& x, const string& s)
+{
+	istringstream str(s);
+	str >> x;
+	if (str.fail())
+		throw runtime_error("Malformed NTL object in comparator table");
+}
+
+// the tables depend on the full prime chain: DoubleCRT constants are only valid for the same primes
+static vector<uint64_t> table_key(const Context& context, CircuitType type, unsigned long d, unsigned long expansion_len)
+{
+	vector<uint64_t> key {static_cast<uint64_t>(context.getM()), static_cast<uint64_t>(context.getP()), static_cast<uint64_t>(context.getR()), static_cast<uint64_t>(type), d, expansion_len};
+
+	const IndexSet& primes = context.allPrimes();
+	key.push_back(primes.card());
+	for (long i = primes.first(); i <= primes.last(); i = primes.next(i))
+	{
+		key.push_back(static_cast<uint64_t>(context.ithPrime(i)));
+	}
+	return key;
+}
+
+string Comparator::table_file_name(const string& cache_dir) const
+{
+	vector<uint64_t> key = table_key(m_context, m_type, m_slotDeg, m_expansionLen);
+
+	// FNV-1a hash of the key separates contexts with equal m and p but different modulus chains
+	uint64_t hash = 14695981039346656037ULL;
+	for (uint64_t k : key)
+	{
+		hash ^= k;
+		hash *= 1099511628211ULL;
+	}
+
+	ostringstream name;
+	name << cache_dir << "/comparator_m" << m_context.getM() << "_p" << m_context.getP() << "_t" << m_type << "_d" << m_slotDeg << "_l" << m_expansionLen << "_" << hex << setw(16) << setfill('0') << hash << ".bin";
+	return name.str();
+}
+
+void Comparator::save_tables(const string& path) const
+{
+	ostringstream str(ios::binary);
+	str.write(TABLE_MAGIC, sizeof(TABLE_MAGIC));
+
+	vector<uint64_t> key = table_key(m_context, m_type, m_slotDeg, m_expansionLen);
+	write_u64(str, key.size());
+	for (uint64_t k : key)
+		write_u64(str, k);
+
+	// shift masks
+	write_u64(str, m_mulMasks.size());
+	for (size_t i = 0; i < m_mulMasks.size(); i++)
+	{
+		write_double(str, m_mulMasksSize[i]);
+		m_mulMasks[i].write(str);
+	}
+
+	// comparison polynomials and Patterson-Stockmeyer parameters
+	write_string(str, ntl_to_string(m_univar_less_poly));
+	write_string(str, ntl_to_string(m_univar_min_max_poly));
+	write_string(str, ntl_to_string(m_bivar_less_coefs));
+
+	for (long param : {m_bs_num_comp, m_bs_num_min, m_gs_num_comp, m_gs_num_min, m_baby_index, m_giant_index})
+		write_u64(str, static_cast<uint64_t>(param));
+
+	write_string(str, ntl_to_string(m_top_coef_comp));
+	write_string(str, ntl_to_string(m_top_coef_min));
+	write_string(str, ntl_to_string(m_extra_coef_comp));
+	write_string(str, ntl_to_string(m_extra_coef_min));
+
+	// extraction constants
+	write_u64(str, m_extraction_const.size());
+	for (size_t iCoef = 0; iCoef < m_extraction_const.size(); iCoef++)
+	{
+		write_u64(str, m_extraction_const[iCoef].size());
+		for (size_t iFrob = 0; iFrob < m_extraction_const[iCoef].size(); iFrob++)
+		{
+			write_double(str, m_extraction_const_size[iCoef][iFrob]);
+			m_extraction_const[iCoef][iFrob].write(str);
+		}
+	}
+
+	if (!write_file_atomic(path, str.str()))
+		cout << "Could not write comparator tables to " << path << endl;
+}
+
+bool Comparator::load_tables(const string& path)
+{
+	if (!std::filesystem::exists(path))
+		return false;
+
+	try
+	{
+		MappedFile file(path);
+		MemoryBuffer buffer(file.data(), file.size());
+		istream str(&buffer);
+		str.exceptions(ios::failbit | ios::badbit);
+
+		char magic[sizeof(TABLE_MAGIC)];
+		str.read(magic, sizeof(magic));
+		if (!equal(magic, magic + sizeof(magic), TABLE_MAGIC))
+			return false;
+
+		vector<uint64_t> key = table_key(m_context, m_type, m_slotDeg, m_expansionLen);
+		if (read_u64(str) != key.size())
+			return false;
+		for (uint64_t k : key)
+		{
+			if (read_u64(str) != k)
+				return false;
+		}
+
+		// parse into temporaries so that a truncated file leaves the object untouched
+		vector<DoubleCRT> masks;
+		vector<double> masks_size;
+		uint64_t num_masks = read_u64(str);
+		for (uint64_t i = 0; i < num_masks; i++)
+		{
+			masks_size.push_back(read_double(str));
+			DoubleCRT mask(m_context, m_context.allPrimes());
+			mask.read(str);
+			masks.push_back(mask);
+		}
+
+		ZZX less_poly, min_max_poly;
+		mat_ZZ bivar_coefs;
+		ntl_from_string(less_poly, read_string(str));
+		ntl_from_string(min_max_poly, read_string(str));
+		ntl_from_string(bivar_coefs, read_string(str));
+
+		long params[6];
+		for (long& param : params)
+			param = static_cast<long>(read_u64(str));
+
+		ZZ top_coef_comp, top_coef_min, extra_coef_comp, extra_coef_min;
+		ntl_from_string(top_coef_comp, read_string(str));
+		ntl_from_string(top_coef_min, read_string(str));
+		ntl_from_string(extra_coef_comp, read_string(str));
+		ntl_from_string(extra_coef_min, read_string(str));
+
+		vector<vector<DoubleCRT>> extraction_const;
+		vector<vector<double>> extraction_const_size;
+		uint64_t num_coefs = read_u64(str);
+		for (uint64_t iCoef = 0; iCoef < num_coefs; iCoef++)
+		{
+			vector<DoubleCRT> tmp_crt_vec;
+			vector<double> size_vec;
+			uint64_t num_frob = read_u64(str);
+			for (uint64_t iFrob = 0; iFrob < num_frob; iFrob++)
+			{
+				size_vec.push_back(read_double(str));
+				DoubleCRT tmp_crt(m_context, m_context.allPrimes());
+				tmp_crt.read(str);
+				tmp_crt_vec.push_back(tmp_crt);
+			}
+			extraction_const.push_back(tmp_crt_vec);
+			extraction_const_size.push_back(size_vec);
+		}
+
+		m_mulMasks = masks;
+		m_mulMasksSize = masks_size;
+		m_univar_less_poly = less_poly;
+		m_univar_min_max_poly = min_max_poly;
+		m_bivar_less_coefs = bivar_coefs;
+		m_bs_num_comp = params[0];
+		m_bs_num_min = params[1];
+		m_gs_num_comp = params[2];
+		m_gs_num_min = params[3];
+		m_baby_index = params[4];
+		m_giant_index = params[5];
+		m_top_coef_comp = top_coef_comp;
+		m_top_coef_min = top_coef_min;
+		m_extra_coef_comp = extra_coef_comp;
+		m_extra_coef_min = extra_coef_min;
+		m_extraction_const = extraction_const;
+		m_extraction_const_size = extraction_const_size;
+		return true;
+	}
+	catch (const exception& e)
+	{
+		cout << "Ignoring comparator tables in " << path << ": " << e.what() << endl;
+		return false;
+	}
+}
+
+Comparator::Comparator(const Context& context, CircuitType type, unsigned long d, unsigned long expansion_len, const SecKey& sk, bool verbose, const string& cache_dir): m_context(context), m_type(type), m_slotDeg(d), m_expansionLen(expansion_len), m_sk(sk), m_has_sk(true), m_pk(sk), m_verbose(verbose)
+{
+	init(cache_dir);
+}
+
+Comparator::Comparator(const Context& context, CircuitType type, unsigned long d, unsigned long expansion_len, const PubKey& pk, bool verbose, const string& cache_dir): m_context(context), m_type(type), m_slotDeg(d), m_expansionLen(expansion_len), m_sk(context), m_has_sk(false), m_pk(pk), m_verbose(verbose)
+{
+	init(cache_dir);
 }
 
-Comparator::Comparator(const Context& context, CircuitType type, unsigned long d, unsigned long expansion_len, const SecKey& sk, bool verbose): m_context(context), m_type(type), m_slotDeg(d), m_expansionLen(expansion_len), m_sk(sk), m_pk(sk), m_verbose(verbose)
+void Comparator::require_secret_key(const string& operation) const
+{
+	if (!m_has_sk)
+	{
+		throw invalid_argument("ERROR: " + operation + " needs a comparator built with the secret key");
+	}
+}
+
+void Comparator::init(const string& cache_dir)
 {
 	//determine the order of p in (Z/mZ)*
-	unsigned long ord_p = context.getOrdP();
+	unsigned long ord_p = m_context.getOrdP();
 	//check that the extension degree divides the order of p
-	if (ord_p < d != 0)
+	if (ord_p < m_slotDeg != 0)
 	{
 		throw invalid_argument("Field extension must be larger than the order of the plaintext modulus\n");
 	}
 
+	string table_path;
+	if (!cache_dir.empty())
+	{
+		table_path = table_file_name(cache_dir);
+		if (load_tables(table_path))
+		{
+			if (m_verbose)
+				cout << "Comparator tables loaded from " << table_path << endl;
+			return;
+		}
+	}
+
 	create_all_shift_masks();
 	create_poly();
 	extraction_init();
+
+	if (!table_path.empty())
+	{
+		std::error_code ec;
+		std::filesystem::create_directories(cache_dir, ec);
+		save_tables(table_path);
+	}
 }
 
 const DoubleCRT& Comparator::get_mask(double& size, long index) const
@@ -678,6 +967,21 @@ const DoubleCRT& Comparator::get_mask(double& size, long index) const
 	return m_mulMasks[index];
 }
 
+long Comparator::memory_usage() const
+{
+	// each DoubleCRT keeps phi(m) residues per prime
+	long dcrt_elems = 0;
+	for (const DoubleCRT& mask : m_mulMasks)
+		dcrt_elems += mask.getIndexSet().card();
+	for (const vector<DoubleCRT>& consts : m_extraction_const)
+		for (const DoubleCRT& c : consts)
+			dcrt_elems += c.getIndexSet().card();
+
+	long bytes = dcrt_elems * m_context.getPhiM() * sizeof(long);
+	bytes += serialized_size(m_sk) + serialized_size(m_pk);
+	return bytes;
+}
+
 const ZZX& Comparator::get_less_than_poly() const
 {
 	return m_univar_less_poly;
@@ -696,6 +1000,12 @@ void Comparator::print_decrypted(const Ctxt& ctxt) const
 	// get order of p
 	unsigned long ord_p = m_context.getOrdP();
 
+    if (!m_has_sk)
+    {
+      cout << "(no secret key to decrypt with)" << endl;
+      return;
+    }
+
     long nSlots = ea.size();
     vector<ZZX> decrypted(nSlots);
     ea.decrypt(ctxt, m_sk, decrypted);
@@ -709,7 +1019,8 @@ void Comparator::print_decrypted(const Ctxt& ctxt) const
 
 void Comparator::batch_shift(Ctxt& ctxt, long start, long shift) const
 {
-	HELIB_NTIMER_START(BatchShift);
+	CIRCUIT_TIMER_START(BatchShift);
+	TRACE_SPAN("BatchShift");
 	// get EncryptedArray
 	const EncryptedArray& ea = m_context.getEA();
 	
@@ -718,20 +1029,21 @@ void Comparator::batch_shift(Ctxt& ctxt, long start, long shift) const
 		return;
 
 	// left cyclic rotation
-	ea.rotate(ctxt, shift);
+	counted::Rotate(ea, ctxt, shift);
 
 	// masking elements shifted out of batch
 	long index = static_cast<long>(intlog(2, -shift));
 	//cout << "Mask index: " << index << endl;
 	double size;
 	DoubleCRT mask = get_mask(size, index);
-	ctxt.multByConstant(mask, size);
-	HELIB_NTIMER_STOP(BatchShift);
+	counted::MultByConstant(ctxt, mask, size);
+	CIRCUIT_TIMER_STOP(BatchShift);
 }
 
 void Comparator::batch_shift_for_mul(Ctxt& ctxt, long start, long shift) const
 {
-	HELIB_NTIMER_START(BatchShiftForMul);
+	CIRCUIT_TIMER_START(BatchShiftForMul);
+	TRACE_SPAN("BatchShiftForMul");
 	// get EncryptedArray
 	const EncryptedArray& ea = m_context.getEA();
 	
@@ -739,25 +1051,26 @@ void Comparator::batch_shift_for_mul(Ctxt& ctxt, long start, long shift) const
 	if(shift == 0)
 		return;
 	// left cyclic rotation
-	ea.rotate(ctxt, shift);
+	counted::Rotate(ea, ctxt, shift);
 	
 	long index = static_cast<long>(intlog(2, -shift));
 	//cout << "Mask index: " << index << endl;
 	double mask_size;
 	DoubleCRT mask = get_mask(mask_size, index);
-	ctxt.multByConstant(mask, mask_size);
+	counted::MultByConstant(ctxt, mask, mask_size);
 
 	// add 1 to masked slots
-	ctxt.addConstant(ZZ(1));
+	counted::AddConstant(ctxt, ZZ(1));
 	mask.Negate();
-	ctxt.addConstant(mask, mask_size);
+	counted::AddConstant(ctxt, mask, mask_size);
 
-	HELIB_NTIMER_STOP(BatchShiftForMul);
+	CIRCUIT_TIMER_STOP(BatchShiftForMul);
 }
 
 void Comparator::shift_and_add(Ctxt& x, long start, long shift_direction) const
 {
-  HELIB_NTIMER_START(ShiftAdd);
+  CIRCUIT_TIMER_START(ShiftAdd);
+  TRACE_SPAN("ShiftAdd");
   long shift_sign = -1;
   if(shift_direction)
     shift_sign = 1;
@@ -768,15 +1081,16 @@ void Comparator::shift_and_add(Ctxt& x, long start, long shift_direction) const
   while (e < m_expansionLen){
     Ctxt tmp = x;
     batch_shift(tmp, start, e * shift_sign);
-    x += tmp;
+    counted::Add(x, tmp);
     e <<=1;
   }
-  HELIB_NTIMER_STOP(ShiftAdd);
+  CIRCUIT_TIMER_STOP(ShiftAdd);
 }
 
 void Comparator::shift_and_mul(Ctxt& x, long start, long shift_direction) const
 {
-  HELIB_NTIMER_START(ShiftMul);
+  CIRCUIT_TIMER_START(ShiftMul);
+  TRACE_SPAN("ShiftMul");
   long shift_sign = -1;
   if(shift_direction)
     shift_sign = 1;
@@ -787,15 +1101,16 @@ void Comparator::shift_and_mul(Ctxt& x, long start, long shift_direction) const
   while (e < m_expansionLen){
     Ctxt tmp = x;
     batch_shift_for_mul(tmp, start, e * shift_sign);
-    x.multiplyBy(tmp);
+    counted::Multiply(x, tmp);
     e <<=1;
   }
-  HELIB_NTIMER_STOP(ShiftMul);
+  CIRCUIT_TIMER_STOP(ShiftMul);
 }
 
 void Comparator::mapTo01_subfield(Ctxt& ctxt, long pow) const
 {
-  HELIB_NTIMER_START(MapTo01);	
+  CIRCUIT_TIMER_START(MapTo01);
+  TRACE_SPAN("MapTo01");	
   // get EncryptedArray
   const EncryptedArray& ea = m_context.getEA();
 
@@ -808,9 +1123,9 @@ void Comparator::mapTo01_subfield(Ctxt& ctxt, long pow) const
   	throw helib::LogicError("Exponent must divide p");
 
   if (p > 2)
-    ctxt.power((p - 1) / pow); // set y = x^{p-1}
+    counted::Power(ctxt, (p - 1) / pow); // set y = x^{p-1}
 
-  HELIB_NTIMER_STOP(MapTo01);
+  CIRCUIT_TIMER_STOP(MapTo01);
 }
 
 void Comparator::less_than_mod_2(Ctxt& ctxt_res, const Ctxt& ctxt_x, const Ctxt& ctxt_y) const
@@ -820,11 +1135,11 @@ void Comparator::less_than_mod_2(Ctxt& ctxt_res, const Ctxt& ctxt_x, const Ctxt&
 
 	// x + 1
 	Ctxt x_plus_1 = ctxt_x;
-	x_plus_1.addConstant(ZZ(1));
+	counted::AddConstant(x_plus_1, ZZ(1));
 
 	// y(x+1)
 	ctxt_res = ctxt_y;
-	ctxt_res.multiplyBy(x_plus_1);
+	counted::Multiply(ctxt_res, x_plus_1);
 
 	if(m_verbose)
 	  {
@@ -840,15 +1155,15 @@ void Comparator::less_than_mod_3(Ctxt& ctxt_res, const Ctxt& ctxt_x, const Ctxt&
 
 	// x + 1
 	Ctxt x_plus_1 = ctxt_x;
-	x_plus_1.addConstant(ZZ(1));
+	counted::AddConstant(x_plus_1, ZZ(1));
 
 	// y(x - y)
 	ctxt_res = ctxt_x;
-	ctxt_res -= ctxt_y;
-	ctxt_res.multiplyBy(ctxt_y);
+	counted::Subtract(ctxt_res, ctxt_y);
+	counted::Multiply(ctxt_res, ctxt_y);
 
 	// -y(x-y)(x+1)
-	ctxt_res.multiplyBy(x_plus_1);
+	counted::Multiply(ctxt_res, x_plus_1);
 	ctxt_res.negate();
 
 	if(m_verbose)
@@ -865,25 +1180,25 @@ void Comparator::less_than_mod_5(Ctxt& ctxt_res, const Ctxt& ctxt_x, const Ctxt&
 
 	// y(x - y)
 	Ctxt y_x_min_y = ctxt_x;
-	y_x_min_y -= ctxt_y;
-	y_x_min_y.multiplyBy(ctxt_y);
+	counted::Subtract(y_x_min_y, ctxt_y);
+	counted::Multiply(y_x_min_y, ctxt_y);
 
 	// x + 1
 	Ctxt x_plus_1 = ctxt_x;
-	x_plus_1.addConstant(ZZ(1));
+	counted::AddConstant(x_plus_1, ZZ(1));
 
 	// x * (x+1)
 	ctxt_res = ctxt_x;
-	ctxt_res.multiplyBy(x_plus_1);
+	counted::Multiply(ctxt_res, x_plus_1);
 
 	// x * (x+1) - y * (x-y)
-	ctxt_res -= y_x_min_y;
+	counted::Subtract(ctxt_res, y_x_min_y);
 
 	// y * (x-y) * (x * (x+1) - y * (x-y))
-	ctxt_res.multiplyBy(y_x_min_y);
+	counted::Multiply(ctxt_res, y_x_min_y);
 
 	// -(x+1) * y * (x-y) * (x * (x+1) - y * (x-y))
-	ctxt_res.multiplyBy(x_plus_1);
+	counted::Multiply(ctxt_res, x_plus_1);
 	ctxt_res.negate();
 
 	if(m_verbose)
@@ -901,41 +1216,41 @@ void Comparator::less_than_mod_7(Ctxt& ctxt_res, const Ctxt& ctxt_x, const Ctxt&
 	// x
 	Ctxt y_x_min_y = ctxt_x;
 	// x - y
-	y_x_min_y -= ctxt_y;
+	counted::Subtract(y_x_min_y, ctxt_y);
 	// y(x-y)
-	y_x_min_y.multiplyBy(ctxt_y);
+	counted::Multiply(y_x_min_y, ctxt_y);
 
 	// x + 1
 	Ctxt x_plus_1 = ctxt_x;
-	x_plus_1.addConstant(ZZ(1));
+	counted::AddConstant(x_plus_1, ZZ(1));
 
 	// x(x+1)
 	Ctxt x_x_plus_1 = x_plus_1;
-	x_x_plus_1.multiplyBy(ctxt_x);
+	counted::Multiply(x_x_plus_1, ctxt_x);
 
 	// x(x+1)(x(x+1)+3)
 	Ctxt tmp = x_x_plus_1;
-	tmp.addConstant(ZZ(3));
-	tmp.multiplyBy(x_x_plus_1);
+	counted::AddConstant(tmp, ZZ(3));
+	counted::Multiply(tmp, x_x_plus_1);
 	ctxt_res = tmp;
 
 	// x(x+1) + 2x + 3y(x-y)
 	tmp = y_x_min_y;
-	tmp.multByConstant(ZZ(3));
-	tmp += x_x_plus_1;
-	tmp += ctxt_x;
-	tmp += ctxt_x;
+	counted::MultByConstant(tmp, ZZ(3));
+	counted::Add(tmp, x_x_plus_1);
+	counted::Add(tmp, ctxt_x);
+	counted::Add(tmp, ctxt_x);
 
 	// 5y(x-y)(x(x+1) + 2x + 3y(x-y))
-	tmp.multiplyBy(y_x_min_y);
-	tmp.multByConstant(ZZ(5));
+	counted::Multiply(tmp, y_x_min_y);
+	counted::MultByConstant(tmp, ZZ(5));
 
 	// (x^2+x)(x^2+x+3) + 5y(x-y)(x^2+x+2x+3y(x-y))
-	ctxt_res += tmp;
+	counted::Add(ctxt_res, tmp);
 
 	// -y(x-y)(x+1)((x^2+x)(x^2+x+3) + 5y(x-y)(x^2+x+2x+3y(x-y)))
-	ctxt_res.multiplyBy(y_x_min_y);
-	ctxt_res.multiplyBy(x_plus_1);
+	counted::Multiply(ctxt_res, y_x_min_y);
+	counted::Multiply(ctxt_res, x_plus_1);
 	ctxt_res.negate();
 
 	if(m_verbose)
@@ -951,13 +1266,13 @@ void Comparator::less_than_mod_any(Ctxt& ctxt_res, const Ctxt& ctxt_x, const Ctx
 	
 	Ctxt Y = ctxt_x;
 	// x - y
-	Y -= ctxt_y;
+	counted::Subtract(Y, ctxt_y);
 	// Y = y(x-y)
-	Y.multiplyBy(ctxt_y);
+	counted::Multiply(Y, ctxt_y);
 
 	Ctxt x_plus_1 = ctxt_x;
 	// x+1
-	x_plus_1.addConstant(ZZ(1));
+	counted::AddConstant(x_plus_1, ZZ(1));
 
 	unsigned long p = m_context.getP();
 
@@ -984,21 +1299,21 @@ void Comparator::less_than_mod_any(Ctxt& ctxt_res, const Ctxt& ctxt_x, const Ctx
 		else
 		{
 			simplePolyEval(fx, fpolys[iPoly], x_powers);
-			Ypow = Y_powers.getPower(iPoly);
-			fx.multiplyBy(Ypow);
-			ctxt_res += fx;
+			Ypow = counted::GetPower(Y_powers, iPoly);
+			counted::Multiply(fx, Ypow);
+			counted::Add(ctxt_res, fx);
 		}
 	}
 
 	// c*Y^y_powers
-	fx = Y_powers.getPower(y_powers);
-	fx.multByConstant(ZZ(fcoefs[p][y_powers][0]));
-	ctxt_res += fx;
+	fx = counted::GetPower(Y_powers, y_powers);
+	counted::MultByConstant(fx, ZZ(fcoefs[p][y_powers][0]));
+	counted::Add(ctxt_res, fx);
 	
 	// (x+1)*f(x)
-	ctxt_res.multiplyBy(x_plus_1);
+	counted::Multiply(ctxt_res, x_plus_1);
 	// Y*(x+1)*f(x)
-	ctxt_res.multiplyBy(Y);
+	counted::Multiply(ctxt_res, Y);
 	
 	if(m_verbose)
 	{
@@ -1009,7 +1324,8 @@ void Comparator::less_than_mod_any(Ctxt& ctxt_res, const Ctxt& ctxt_x, const Ctx
 
 void Comparator::evaluate_univar_less_poly(Ctxt& ret, Ctxt& ctxt_p_1, const Ctxt& x) const
 {
-	HELIB_NTIMER_START(ComparisonCircuitUnivar);
+	CIRCUIT_TIMER_START(ComparisonCircuitUnivar);
+	TRACE_SPAN("ComparisonCircuitUnivar");
 	// get p
 	ZZ p = ZZ(m_context.getP());
 
@@ -1017,10 +1333,10 @@ void Comparator::evaluate_univar_less_poly(Ctxt& ret, Ctxt& ctxt_p_1, const Ctxt
 	{
 	  // z^2
 	  	Ctxt x2 = x;
-	  	x2.square();
+	  	counted::Square(x2);
 
 		DynamicCtxtPowers babyStep(x2, m_bs_num_comp);
-		const Ctxt& x2k = babyStep.getPower(m_bs_num_comp);
+		const Ctxt& x2k = counted::GetPower(babyStep, m_bs_num_comp);
 
 		DynamicCtxtPowers giantStep(x2k, m_gs_num_comp);
 
@@ -1036,27 +1352,27 @@ void Comparator::evaluate_univar_less_poly(Ctxt& ret, Ctxt& ctxt_p_1, const Ctxt
 
 		  	if (!IsOne(m_top_coef_comp)) 
 		  	{
-		    	ret.multByConstant(m_top_coef_comp);
+		    	counted::MultByConstant(ret, m_top_coef_comp);
 			}
 
 			if (!IsZero(m_extra_coef_comp)) 
 			{ // if we added a term, now is the time to subtract back
-		    	Ctxt topTerm = giantStep.getPower(m_gs_num_comp);
-		    	topTerm.multByConstant(m_extra_coef_comp);
-		    	ret -= topTerm;
+		    	Ctxt topTerm = counted::GetPower(giantStep, m_gs_num_comp);
+		    	counted::MultByConstant(topTerm, m_extra_coef_comp);
+		    	counted::Subtract(ret, topTerm);
 			}
 		}
-		ret.multiplyBy(x);
+		counted::Multiply(ret, x);
 
 		// TODO: depth here is not optimal
-		Ctxt top_term = babyStep.getPower(m_baby_index);
-		top_term.multiplyBy(giantStep.getPower(m_giant_index));
+		Ctxt top_term = counted::GetPower(babyStep, m_baby_index);
+		counted::Multiply(top_term, counted::GetPower(giantStep, m_giant_index));
 
 		ctxt_p_1 = top_term; 
 
-		top_term.multByConstant(ZZ((p+1)>> 1));
+		counted::MultByConstant(top_term, ZZ((p+1)>> 1));
 
-		ret += top_term;
+		counted::Add(ret, top_term);
 
 		/*
 		cout << "Computed baby steps" << endl;
@@ -1077,26 +1393,27 @@ void Comparator::evaluate_univar_less_poly(Ctxt& ret, Ctxt& ctxt_p_1, const Ctxt
 		ret = x;
 
 		ctxt_p_1 = x;
-		ctxt_p_1.square();
+		counted::Square(ctxt_p_1);
 
 		Ctxt top_term = ctxt_p_1;
-		top_term.multByConstant(ZZ(2));
+		counted::MultByConstant(top_term, ZZ(2));
 
-		ret += top_term;
+		counted::Add(ret, top_term);
 	}
-	HELIB_NTIMER_STOP(ComparisonCircuitUnivar);
+	CIRCUIT_TIMER_STOP(ComparisonCircuitUnivar);
 }
 
 void Comparator::evaluate_min_max_poly(Ctxt& ctxt_min, Ctxt& ctxt_max, const Ctxt& ctxt_x, const Ctxt& ctxt_y) const
 {
-	HELIB_NTIMER_START(MinMaxCircuitUnivar);
+	CIRCUIT_TIMER_START(MinMaxCircuitUnivar);
+	TRACE_SPAN("MinMaxCircuitUnivar");
 	// get p
 	ZZ p = ZZ(m_context.getP());
 
 	// Subtraction z = x - y
 	cout << "Subtraction" << endl;
 	Ctxt ctxt_z = ctxt_x;
-	ctxt_z -= ctxt_y;
+	counted::Subtract(ctxt_z, ctxt_y);
 
 	if(m_verbose)
 	{
@@ -1106,12 +1423,12 @@ void Comparator::evaluate_min_max_poly(Ctxt& ctxt_min, Ctxt& ctxt_max, const Ctx
   	
   	// z^2
   	Ctxt ctxt_z2 = ctxt_z;
-  	ctxt_z2.square(); 
+  	counted::Square(ctxt_z2); 
 
 	if (p > ZZ(3)) //if p > 3, use the generic Paterson-Stockmeyer strategy
 	{
 		DynamicCtxtPowers babyStep(ctxt_z2, m_bs_num_min);
-		const Ctxt& ctxt_z2k = babyStep.getPower(m_bs_num_min);
+		const Ctxt& ctxt_z2k = counted::GetPower(babyStep, m_bs_num_min);
 
 		DynamicCtxtPowers giantStep(ctxt_z2k, m_gs_num_min);
 
@@ -1129,26 +1446,26 @@ void Comparator::evaluate_min_max_poly(Ctxt& ctxt_min, Ctxt& ctxt_max, const Ctx
 
 		  	if (!IsOne(m_top_coef_min)) 
 		  	{
-		    	g_z2.multByConstant(m_top_coef_min);
+		    	counted::MultByConstant(g_z2, m_top_coef_min);
 			}
 
 			if (!IsZero(m_extra_coef_min)) 
 			{ // if we added a term, now is the time to subtract back
-		    	Ctxt topTerm = giantStep.getPower(m_gs_num_min);
-		    	topTerm.multByConstant(m_extra_coef_min);
-		    	g_z2 -= topTerm;
+		    	Ctxt topTerm = counted::GetPower(giantStep, m_gs_num_min);
+		    	counted::MultByConstant(topTerm, m_extra_coef_min);
+		    	counted::Subtract(g_z2, topTerm);
 			}
 		}
 
 		// last term: ((p+1)/2) * (x + y) 
 		Ctxt last_term = ctxt_x;
-		last_term += ctxt_y; 
-		last_term.multByConstant(ZZ((p+1)>> 1));
+		counted::Add(last_term, ctxt_y);
+		counted::MultByConstant(last_term, ZZ((p+1)>> 1));
 
 		ctxt_min = last_term;
-		ctxt_min += g_z2;
+		counted::Add(ctxt_min, g_z2);
 		ctxt_max = last_term;
-		ctxt_max -= g_z2;
+		counted::Subtract(ctxt_max, g_z2);
 
 		/*
 		cout << "Computed baby steps" << endl;
@@ -1168,20 +1485,21 @@ void Comparator::evaluate_min_max_poly(Ctxt& ctxt_min, Ctxt& ctxt_max, const Ctx
 	{
 		// last term: ((p+1)/2) * (x + y) 
 		Ctxt last_term = ctxt_x;
-		last_term += ctxt_y; 
-		last_term.multByConstant(ZZ((p+1)>> 1));
+		counted::Add(last_term, ctxt_y);
+		counted::MultByConstant(last_term, ZZ((p+1)>> 1));
 
 		ctxt_min = last_term;
-		ctxt_min += ctxt_z2;
+		counted::Add(ctxt_min, ctxt_z2);
 		ctxt_max = last_term;
-		ctxt_max -= ctxt_z2;
+		counted::Subtract(ctxt_max, ctxt_z2);
 	}
-	HELIB_NTIMER_STOP(MinMaxCircuitUnivar);
+	CIRCUIT_TIMER_STOP(MinMaxCircuitUnivar);
 }
 
 void Comparator::less_than_bivar(Ctxt& ctxt_res, const Ctxt& ctxt_x, const Ctxt& ctxt_y) const
 {
-  HELIB_NTIMER_START(ComparisonCircuitBivar);
+  CIRCUIT_TIMER_START(ComparisonCircuitBivar);
+  TRACE_SPAN("ComparisonCircuitBivar");
 
   //compare with the circuit of Tan et al.
   if (m_type == TAN)
@@ -1228,7 +1546,7 @@ void Comparator::less_than_bivar(Ctxt& ctxt_res, const Ctxt& ctxt_x, const Ctxt&
     cout << endl;
   }
 
-  HELIB_NTIMER_STOP(ComparisonCircuitBivar);
+  CIRCUIT_TIMER_STOP(ComparisonCircuitBivar);
 }
 
 void Comparator::less_than_bivar_tan(Ctxt& ctxt_res, const Ctxt& ctxt_x, const Ctxt& ctxt_y) const
@@ -1240,7 +1558,7 @@ void Comparator::less_than_bivar_tan(Ctxt& ctxt_res, const Ctxt& ctxt_x, const C
 	DynamicCtxtPowers x_powers(ctxt_x, p-1);
 	DynamicCtxtPowers y_powers(ctxt_y, p-1);
 
-	ctxt_res = y_powers.getPower(p-1);
+	ctxt_res = counted::GetPower(y_powers, p-1);
 
 	for (long i = 1; i < p; i++)
 	{
@@ -1250,18 +1568,19 @@ void Comparator::less_than_bivar_tan(Ctxt& ctxt_res, const Ctxt& ctxt_x, const C
 		{
 			if (m_bivar_less_coefs[i][j] == ZZ(0))
 				continue;
-			Ctxt tmp = y_powers.getPower(j);
-			tmp.multByConstant(m_bivar_less_coefs[i][j]);
-			sum += tmp;
+			Ctxt tmp = counted::GetPower(y_powers, j);
+			counted::MultByConstant(tmp, m_bivar_less_coefs[i][j]);
+			counted::Add(sum, tmp);
 		}
-		sum.multiplyBy(x_powers.getPower(i));
-		ctxt_res += sum;
+		counted::Multiply(sum, counted::GetPower(x_powers, i));
+		counted::Add(ctxt_res, sum);
 	}
 }
 
 void Comparator::is_zero(Ctxt& ctxt_res, const Ctxt& ctxt_z, long pow) const
 {
-  HELIB_NTIMER_START(EqualityCircuit);
+  CIRCUIT_TIMER_START(EqualityCircuit);
+  TRACE_SPAN("EqualityCircuit");
 
   ctxt_res = ctxt_z;
 
@@ -1278,7 +1597,7 @@ void Comparator::is_zero(Ctxt& ctxt_res, const Ctxt& ctxt_z, long pow) const
   //cout << "Computing NOT" << endl;
   //compute 1 - mapTo01(z_i)
   ctxt_res.negate();
-  ctxt_res.addConstant(ZZ(1));
+  counted::AddConstant(ctxt_res, ZZ(1));
 
   if(m_verbose)
   {
@@ -1286,12 +1605,13 @@ void Comparator::is_zero(Ctxt& ctxt_res, const Ctxt& ctxt_z, long pow) const
     cout << endl;
   }
 
-  HELIB_NTIMER_STOP(EqualityCircuit);
+  CIRCUIT_TIMER_STOP(EqualityCircuit);
 }
 
 void Comparator::compare(Ctxt& ctxt_res, const Ctxt& ctxt_x, const Ctxt& ctxt_y) const
 {
-	HELIB_NTIMER_START(Comparison);
+	CIRCUIT_TIMER_START(Comparison);
+	TRACE_SPAN("Comparison");
 
 	vector<Ctxt> ctxt_less_p;
 	vector<Ctxt> ctxt_eq_p;
@@ -1341,7 +1661,7 @@ void Comparator::compare(Ctxt& ctxt_res, const Ctxt& ctxt_x, const Ctxt& ctxt_y)
 			// Subtraction z = x - y
 			//cout << "Subtraction" << endl;
 			Ctxt ctxt_z = ctxt_x_p[iCoef];
-			ctxt_z -= ctxt_y_p[iCoef];
+			counted::Subtract(ctxt_z, ctxt_y_p[iCoef]);
 			Ctxt ctxt_tmp = Ctxt(ctxt_z.getPubKey());
 			is_zero(ctxt_tmp, ctxt_z);
 			ctxt_eq_p.push_back(ctxt_tmp);
@@ -1352,7 +1672,7 @@ void Comparator::compare(Ctxt& ctxt_res, const Ctxt& ctxt_x, const Ctxt& ctxt_y)
 		// Subtraction z = x - y
 		//cout << "Subtraction" << endl;
 		Ctxt ctxt_z = ctxt_x;
-		ctxt_z -= ctxt_y;
+		counted::Subtract(ctxt_z, ctxt_y);
 
 		if(m_verbose)
 		{
@@ -1397,7 +1717,7 @@ void Comparator::compare(Ctxt& ctxt_res, const Ctxt& ctxt_x, const Ctxt& ctxt_y)
 			//cout << "Computing NOT" << endl;
 			//compute 1 - mapTo01(r_i*(x_i - y_i))
 			ctxt_tmp_eq.negate();
-			ctxt_tmp_eq.addConstant(ZZ(1));
+			counted::AddConstant(ctxt_tmp_eq, ZZ(1));
 
 			if(m_verbose)
 			{
@@ -1417,10 +1737,10 @@ void Comparator::compare(Ctxt& ctxt_res, const Ctxt& ctxt_x, const Ctxt& ctxt_y)
 	for (long iCoef = m_slotDeg-2; iCoef >= 0; iCoef--)
 	{
 		Ctxt tmp = ctxt_eq;
-		tmp.multiplyBy(ctxt_less_p[iCoef]);
-		ctxt_less += tmp;
+		counted::Multiply(tmp, ctxt_less_p[iCoef]);
+		counted::Add(ctxt_less, tmp);
 
-		ctxt_eq.multiplyBy(ctxt_eq_p[iCoef]);
+		counted::Multiply(ctxt_eq, ctxt_eq_p[iCoef]);
 	}
 
 	if(m_verbose)
@@ -1464,7 +1784,7 @@ void Comparator::compare(Ctxt& ctxt_res, const Ctxt& ctxt_x, const Ctxt& ctxt_y)
 	//cout << "Final result" << endl;
 
 	ctxt_res = ctxt_eq;
-	ctxt_res.multiplyBy(ctxt_less);
+	counted::Multiply(ctxt_res, ctxt_less);
 	shift_and_add(ctxt_res, 0);
 
 	if(m_verbose)
@@ -1483,12 +1803,13 @@ void Comparator::compare(Ctxt& ctxt_res, const Ctxt& ctxt_x, const Ctxt& ctxt_y)
       cout << endl;
     }	
 
-    HELIB_NTIMER_STOP(Comparison);
+    CIRCUIT_TIMER_STOP(Comparison);
 }
 
 void Comparator::min_max_digit(Ctxt& ctxt_min, Ctxt& ctxt_max, const Ctxt& ctxt_x, const Ctxt& ctxt_y) const
 {
-	HELIB_NTIMER_START(MinMaxDigit);
+	CIRCUIT_TIMER_START(MinMaxDigit);
+	TRACE_SPAN("MinMaxDigit");
 	if(m_type != UNI)
 		throw helib::LogicError("Min/Max is not implemented with the bivariate circuit");
 
@@ -1570,21 +1891,22 @@ void Comparator::min_max_digit(Ctxt& ctxt_min, Ctxt& ctxt_max, const Ctxt& ctxt_
 
 		// agregate minimum values
 		Ctxt tmp = ctxt_min_p[iCoef];
-		tmp.multByConstant(x_power_ptxt);
-		ctxt_min += tmp;
+		counted::MultByConstant(tmp, x_power_ptxt);
+		counted::Add(ctxt_min, tmp);
 
 		// agregate maximum values
 		tmp = ctxt_max_p[iCoef];
-		tmp.multByConstant(x_power_ptxt);
-		ctxt_max += tmp;
+		counted::MultByConstant(tmp, x_power_ptxt);
+		counted::Add(ctxt_max, tmp);
 	}
 
-	HELIB_NTIMER_STOP(MinMaxDigit);
+	CIRCUIT_TIMER_STOP(MinMaxDigit);
 }
 
 void Comparator::min_max(Ctxt& ctxt_min, Ctxt& ctxt_max, const Ctxt& ctxt_x, const Ctxt& ctxt_y) const
 {
-	HELIB_NTIMER_START(MinMax);
+	CIRCUIT_TIMER_START(MinMax);
+	TRACE_SPAN("MinMax");
 	if(m_type == UNI && m_expansionLen == 1 && m_slotDeg == 1)
 	{
 		min_max_digit(ctxt_min, ctxt_max, ctxt_x, ctxt_y);
@@ -1592,17 +1914,17 @@ void Comparator::min_max(Ctxt& ctxt_min, Ctxt& ctxt_max, const Ctxt& ctxt_x, con
 	}
 
 	Ctxt ctxt_z = ctxt_x;
-	ctxt_z -= ctxt_y;
+	counted::Subtract(ctxt_z, ctxt_y);
 
 	Ctxt ctxt_tmp = Ctxt(ctxt_z.getPubKey());
 	compare(ctxt_tmp, ctxt_x, ctxt_y);
-	ctxt_tmp.multiplyBy(ctxt_z);
+	counted::Multiply(ctxt_tmp, ctxt_z);
 
 	ctxt_min = ctxt_y;
-	ctxt_min += ctxt_tmp;
+	counted::Add(ctxt_min, ctxt_tmp);
 
 	ctxt_max = ctxt_x;
-	ctxt_max -= ctxt_tmp;
+	counted::Subtract(ctxt_max, ctxt_tmp);
 
 	if(m_verbose)
 	{
@@ -1627,12 +1949,13 @@ void Comparator::min_max(Ctxt& ctxt_min, Ctxt& ctxt_max, const Ctxt& ctxt_x, con
       print_decrypted(ctxt_y);
       cout << endl;
     }
-	HELIB_NTIMER_STOP(MinMax);
+	CIRCUIT_TIMER_STOP(MinMax);
 }
 
 void Comparator::array_min(Ctxt& ctxt_res, const vector<Ctxt>& ctxt_in, long depth) const
 {
-	HELIB_NTIMER_START(ArrayMin);
+	CIRCUIT_TIMER_START(ArrayMin);
+	TRACE_SPAN("ArrayMin");
 
 	if (depth < 0)
 		throw helib::LogicError("depth parameter must be non-negative");
@@ -1692,17 +2015,17 @@ void Comparator::array_min(Ctxt& ctxt_res, const vector<Ctxt>& ctxt_in, long dep
 			{
 				//compare the Hamming weight of the jth row with i
 				Ctxt tmp_prod = ham_weights[i];
-				tmp_prod.addConstant(ZZX(-(cur_len-1)));
+				counted::AddConstant(tmp_prod, ZZX(-(cur_len-1)));
 				mapTo01_subfield(tmp_prod, 1);
 				tmp_prod.negate();
-				tmp_prod.addConstant(ZZX(1));
+				counted::AddConstant(tmp_prod, ZZX(1));
 
 				//multiply by the jth input ciphertext
-				tmp_prod.multiplyBy(ctxt_res_vec[i]);
+				counted::Multiply(tmp_prod, ctxt_res_vec[i]);
 				if(i == 0)
 					ctxt_res = tmp_prod;
 				else
-					ctxt_res += tmp_prod;
+					counted::Add(ctxt_res, tmp_prod);
 			}
 		}
 		else 
@@ -1744,10 +2067,10 @@ void Comparator::array_min(Ctxt& ctxt_res, const vector<Ctxt>& ctxt_in, long dep
 						}
 						else
 						{
-							ctxt_products[i][len_i - 1].multiplyBy(comp_col);
+							counted::Multiply(ctxt_products[i][len_i - 1], comp_col);
 							for (int k = len_i - 2; k >= (wt-1); k--)
 							{
-								ctxt_products[i][k].multiplyBy(ctxt_products[i][k+1]);
+								counted::Multiply(ctxt_products[i][k], ctxt_products[i][k+1]);
 								ctxt_products[i].pop_back();	
 							}
 						}
@@ -1756,7 +2079,7 @@ void Comparator::array_min(Ctxt& ctxt_res, const vector<Ctxt>& ctxt_in, long dep
 					// compute lower diagonal entries of the comparison table by transposition and logical negation of upper diagonal entries
 					//NOT the result to multiply to the jth row
 					comp_col.negate();
-					comp_col.addConstant(ZZ(1));
+					counted::AddConstant(comp_col, ZZ(1));
 
 					if (ctxt_products[j].empty())
 					{
@@ -1772,10 +2095,10 @@ void Comparator::array_min(Ctxt& ctxt_res, const vector<Ctxt>& ctxt_in, long dep
 						}
 						else
 						{
-							ctxt_products[j][len_j - 1].multiplyBy(comp_col);
+							counted::Multiply(ctxt_products[j][len_j - 1], comp_col);
 							for (int k = len_j - 2; k >= (wt-1); k--)
 							{
-								ctxt_products[j][k].multiplyBy(ctxt_products[j][k+1]);
+								counted::Multiply(ctxt_products[j][k], ctxt_products[j][k+1]);
 								ctxt_products[j].pop_back();	
 							}
 						}
@@ -1790,16 +2113,16 @@ void Comparator::array_min(Ctxt& ctxt_res, const vector<Ctxt>& ctxt_in, long dep
 				int len_i = ctxt_products[i].size();
 				for (int k = len_i - 2; k >= 0; k--)
 				{
-					ctxt_products[i][k].multiplyBy(ctxt_products[i][k+1]);
+					counted::Multiply(ctxt_products[i][k], ctxt_products[i][k+1]);
 					ctxt_products[i].pop_back();	
 				}
 				Ctxt tmp_prod = ctxt_products[i][0];
 
 				//multiply by the ith input ciphertext
-				tmp_prod.multiplyBy(ctxt_res_vec[i]);
+				counted::Multiply(tmp_prod, ctxt_res_vec[i]);
 
 				//add to the result
-				ctxt_res += tmp_prod;
+				counted::Add(ctxt_res, tmp_prod);
 			}
 		}
 	}
@@ -1808,7 +2131,7 @@ void Comparator::array_min(Ctxt& ctxt_res, const vector<Ctxt>& ctxt_in, long dep
 		ctxt_res = ctxt_res_vec[0];
 	}
 
-	HELIB_NTIMER_STOP(ArrayMin);
+	CIRCUIT_TIMER_STOP(ArrayMin);
 }
 
 void Comparator::int_to_slot(ZZX& poly, unsigned long input, unsigned long enc_base) const
@@ -1855,22 +2178,23 @@ void Comparator::get_sorting_index(vector<Ctxt>& ctxt_out, const vector<Ctxt>& c
 			// compute upper diagonal entries of the comparison table and sum them
 			Ctxt comp_col_j = Ctxt(ctxt_in[0].getPubKey());
 			compare(comp_col_j, ctxt_in[i], ctxt_in[j]);
-			ctxt_out[i] += comp_col_j;
+			counted::Add(ctxt_out[i], comp_col_j);
 
 			// compute lower diagonal entries of the comparison table by transposition and logical negation of upper diagonal entries
 			//NOT the result to add to the jth row
 			comp_col_j.negate();
-			comp_col_j.addConstant(ZZ(1));
+			counted::AddConstant(comp_col_j, ZZ(1));
 
 			// add lower diagonal entries to Hamming weight accumulators of related rows
-			ctxt_out[j] += comp_col_j;
+			counted::Add(ctxt_out[j], comp_col_j);
 		}
 	}
 }
 
 void Comparator::sort(vector<Ctxt>& ctxt_out, const vector<Ctxt>& ctxt_in) const
 {
-	HELIB_NTIMER_START(Sorting);
+	CIRCUIT_TIMER_START(Sorting);
+	TRACE_SPAN("Sorting");
 
 	ctxt_out.clear();
 
@@ -1909,15 +2233,15 @@ void Comparator::sort(vector<Ctxt>& ctxt_out, const vector<Ctxt>& ctxt_in) const
 			// compute upper diagonal entries of the comparison table and sum them
 			Ctxt comp_col_j = Ctxt(ctxt_in[0].getPubKey());
 			compare(comp_col_j, ctxt_in[i], ctxt_in[j]);
-			ham_weights[i] += comp_col_j;
+			counted::Add(ham_weights[i], comp_col_j);
 
 			// compute lower diagonal entries of the comparison table by transposition and logical negation of upper diagonal entries
 			//NOT the result to add to the jth row
 			comp_col_j.negate();
-			comp_col_j.addConstant(ZZ(1));
+			counted::AddConstant(comp_col_j, ZZ(1));
 
 			// add lower diagonal entries to Hamming weight accumulators of related rows
-			ham_weights[j] += comp_col_j;
+			counted::Add(ham_weights[j], comp_col_j);
 		}
 	}
 	*/
@@ -1943,14 +2267,14 @@ void Comparator::sort(vector<Ctxt>& ctxt_out, const vector<Ctxt>& ctxt_in) const
 			{
 				//compare the Hamming weight of the jth row with i
 				Ctxt tmp_prod = ham_weights[j];
-				tmp_prod.addConstant(ZZX(-i));
+				counted::AddConstant(tmp_prod, ZZX(-i));
 				mapTo01_subfield(tmp_prod, 1);
 				tmp_prod.negate();
-				tmp_prod.addConstant(ZZX(1));
+				counted::AddConstant(tmp_prod, ZZX(1));
 
 				//multiply by the jth input ciphertext
-				tmp_prod.multiplyBy(ctxt_in[j]);
-				tmp_sum += tmp_prod;
+				counted::Multiply(tmp_prod, ctxt_in[j]);
+				counted::Add(tmp_sum, tmp_prod);
 			}
 			ctxt_out.push_back(tmp_sum);
 		}
@@ -1976,15 +2300,15 @@ void Comparator::sort(vector<Ctxt>& ctxt_out, const vector<Ctxt>& ctxt_in) const
 			
 			// eq_sums[0] = 1 - hw_i^(p-1)
 			eq_sums[0].clear();
-			eq_sums[0] = hw_powers.getPower(p-1);
+			eq_sums[0] = counted::GetPower(hw_powers, p-1);
 			eq_sums[0].negate();
-			eq_sums[0].addConstant(ZZX(1));
+			counted::AddConstant(eq_sums[0], ZZX(1));
 
 			// eq_sums[0] * ctxt_in[i]
-			eq_sums[0].multiplyBy(ctxt_in[i]);
+			counted::Multiply(eq_sums[0], ctxt_in[i]);
 
 			// sum_i eq_sums[0] * ctxt_in[i]
-			ctxt_out[0] += eq_sums[0];	
+			counted::Add(ctxt_out[0], eq_sums[0]);
 
 			for (size_t k = 1; k < input_len; k++)
 			{
@@ -2004,24 +2328,24 @@ void Comparator::sort(vector<Ctxt>& ctxt_out, const vector<Ctxt>& ctxt_in) const
 					// k^(p-1-j) mod p
 					k_power = power(k_zzp, p - 1 - j);
 					// hw_i^j
-					Ctxt tmp = hw_powers.getPower(j);
+					Ctxt tmp = counted::GetPower(hw_powers, j);
 					// hw_i^j * k^(p-1-j)
-					tmp.multByConstant(rep(k_power));
+					counted::MultByConstant(tmp, rep(k_power));
 					// sum hw_i^j * k^(p-1-j)
-					eq_sums[k] += tmp;
+					counted::Add(eq_sums[k], tmp);
 				}
 				// add k^(p-1) to eq_sums
-				eq_sums[k].addConstant(rep(power(k_zzp, p-1)));
+				counted::AddConstant(eq_sums[k], rep(power(k_zzp, p-1)));
 
 				// 1 - sum_(j=0)^(p-1) hw_i^j * k^(p-1-j)
 				eq_sums[k].negate();
-				eq_sums[k].addConstant(ZZX(1));
+				counted::AddConstant(eq_sums[k], ZZX(1));
 
 				// eq_sums[k] * ctxt_in[i]
-				eq_sums[k].multiplyBy(ctxt_in[i]);
+				counted::Multiply(eq_sums[k], ctxt_in[i]);
 
 				// sum_i eq_sums[k] * ctxt_in[i]
-				ctxt_out[k] += eq_sums[k];
+				counted::Add(ctxt_out[k], eq_sums[k]);
 			}
 		}
 	}
@@ -2036,13 +2360,15 @@ void Comparator::sort(vector<Ctxt>& ctxt_out, const vector<Ctxt>& ctxt_in) const
       	cout << endl;
 	}
 	*/
-	HELIB_NTIMER_STOP(Sorting);
+	CIRCUIT_TIMER_STOP(Sorting);
 }
 
 void Comparator::test_sorting(int num_to_sort, long runs) const
 {
+	require_secret_key("test_sorting");
+
 	//reset timers
-  setTimersOn();
+  TimerScope timers;
   
   // initialize the random generator
   random_device rd;
@@ -2253,8 +2579,10 @@ void Comparator::test_sorting(int num_to_sort, long runs) const
 
 void Comparator::test_compare(long runs) const
 {
+	require_secret_key("test_compare");
+
   //reset timers
-  setTimersOn();
+  TimerScope timers;
   
   // initialize the random generator
   random_device rd;
@@ -2448,8 +2776,10 @@ void Comparator::test_compare(long runs) const
 
 void Comparator::test_min_max(long runs) const
 {
+	require_secret_key("test_min_max");
+
 	//reset timers
-  setTimersOn();
+  TimerScope timers;
   
   // initialize the random generator
   random_device rd;
@@ -2657,8 +2987,10 @@ void Comparator::test_min_max(long runs) const
 
 void Comparator::test_array_min(int input_len, long depth, long runs) const
 {
+	require_secret_key("test_array_min");
+
 	//reset timers
-  setTimersOn();
+  TimerScope timers;
   
   // initialize the random generator
   random_device rd;
@@ -8,6 +8,7 @@ Comparator class: creates all auxiliary information necessary to compare integer
 #include <helib/Ptxt.h>
 #include <helib/norms.h>
 #include <NTL/mat_ZZ.h>
+#include <string>
 
 using namespace std;
 using namespace NTL;
@@ -64,8 +65,9 @@ class Comparator{
     // slot generator
     ZZX m_slot_gen;
 
-    // secret key
+    // secret key (empty when built from the public key alone)
     SecKey m_sk;
+    bool m_has_sk;
 
     // public key
     PubKey m_pk;
@@ -151,14 +153,33 @@ class Comparator{
     // find the primitive root of a SIMD slot
     void find_prim_root(ZZ_pE& root) const; 
 
+    // name of the precomputation table file for this context and circuit parameters
+    string table_file_name(const string& cache_dir) const;
+
+    // store/restore masks, polynomials and extraction constants; load returns false if the file is missing or stale
+    void save_tables(const string& path) const;
+    bool load_tables(const string& path);
+
+    // tables of both constructors
+    void init(const string& cache_dir);
+
+    // the decrypting helpers and tests need the secret key
+    void require_secret_key(const string& operation) const;
+
 public:
   // constructor
-	Comparator(const Context& context, CircuitType type, unsigned long d, unsigned long expansion_len, const SecKey& sk, bool verbose);
+  // if cache_dir is not empty, precomputed tables are loaded from (or saved to) a file in it
+	Comparator(const Context& context, CircuitType type, unsigned long d, unsigned long expansion_len, const SecKey& sk, bool verbose, const string& cache_dir = "");
+  // evaluation only (e.g. a server that holds no secret key): comparisons work, decrypting helpers and tests do not
+	Comparator(const Context& context, CircuitType type, unsigned long d, unsigned long expansion_len, const PubKey& pk, bool verbose, const string& cache_dir = "");
 
 	const DoubleCRT& get_mask(double& size, long index) const;
   const ZZX& get_less_than_poly() const;
   const ZZX& get_min_max_poly() const;
 
+  // bytes held by the comparator: masks, extraction constants and its copies of the keys
+  long memory_usage() const;
+
   // decrypt and print ciphertext
   void print_decrypted(const Ctxt& ctxt) const;
 
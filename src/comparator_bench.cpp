@@ -0,0 +1,199 @@
+/*
+comparator_bench: runs one of the Comparator self-tests with the given circuit parameters and reports the HElib
+stage timers and the throughput in comparisons per second
+
+usage: comparator_bench [--test compare|min_max|sort|array_min] [--type UNI|BI|TAN] [--d N] [--len N]
+                        [--inputs N] [--depth N] [--runs N] [--m N] [--p N] [--bits N] [--output FILE]
+
+--inputs is the number of ciphertexts sorted or reduced by sort / array_min; --d must not exceed the order of
+p modulo m
+*/
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <helib/helib.h>
+#include "comparator.hpp"
+#include "globals.hpp"
+#include "ops.hpp"
+
+using namespace std;
+
+struct ComparatorBenchOptions{
+    string test = "compare";
+    he_cmp::CircuitType type = he_cmp::UNI;
+    unsigned long d = 1;
+    unsigned long len = 1;
+    int inputs = 4;
+    long depth = 0;
+    long runs = 3;
+    unsigned long m = constants::M;
+    unsigned long p = constants::P;
+    unsigned long bits = constants::BITS;
+    string output = "";
+};
+
+// stages timed inside the comparator (HELIB_NTIMER_START/STOP)
+static const vector<string> STAGES = {
+    "Extraction", "BatchShift", "BatchShiftForMul", "ShiftAdd", "ShiftMul", "MapTo01",
+    "ComparisonCircuitUnivar", "ComparisonCircuitBivar", "MinMaxCircuitUnivar", "EqualityCircuit",
+    "Comparison", "MinMaxDigit", "MinMax", "ArrayMin", "Sorting"
+};
+
+static he_cmp::CircuitType parse_type(const string& name){
+    if (name == "UNI") return he_cmp::UNI;
+    if (name == "BI") return he_cmp::BI;
+    if (name == "TAN") return he_cmp::TAN;
+    throw invalid_argument("ERROR: circuit type must be UNI, BI or TAN");
+}
+
+static string type_name(he_cmp::CircuitType type){
+    return type == he_cmp::UNI ? "UNI" : (type == he_cmp::BI ? "BI" : "TAN");
+}
+
+static ComparatorBenchOptions parse_options(int argc, char* argv[]){
+    ComparatorBenchOptions options;
+    for (int i = 1; i < argc; i++){
+        string arg = argv[i];
+        auto value = [&](){
+            if (i + 1 >= argc){
+                throw invalid_argument("ERROR: missing value for " + arg);
+            }
+            return string(argv[++i]);
+        };
+
+        if (arg == "--test") options.test = value();
+        else if (arg == "--type") options.type = parse_type(value());
+        else if (arg == "--d") options.d = stoul(value());
+        else if (arg == "--len") options.len = stoul(value());
+        else if (arg == "--inputs") options.inputs = stoi(value());
+        else if (arg == "--depth") options.depth = stol(value());
+        else if (arg == "--runs") options.runs = stol(value());
+        else if (arg == "--m") options.m = stoul(value());
+        else if (arg == "--p") options.p = stoul(value());
+        else if (arg == "--bits") options.bits = stoul(value());
+        else if (arg == "--output") options.output = value();
+        else throw invalid_argument("ERROR: unknown option " + arg);
+    }
+    if (options.test != "compare" && options.test != "min_max" && options.test != "sort" && options.test != "array_min"){
+        throw invalid_argument("ERROR: test must be compare, min_max, sort or array_min");
+    }
+    if (options.d == 0 || options.len == 0 || options.runs <= 0 || options.inputs < 2){
+        throw invalid_argument("ERROR: d, len and runs must be positive and inputs at least 2");
+    }
+    return options;
+}
+
+int main(int argc, char* argv[]){
+    ComparatorBenchOptions options;
+    try{
+        options = parse_options(argc, argv);
+    }
+    catch (const exception& e){
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    helib::Context context = helib::ContextBuilder<helib::BGV>()
+                               .m(options.m)
+                               .p(options.p)
+                               .r(constants::R)
+                               .bits(options.bits)
+                               .c(constants::C)
+                               .build();
+    if ((unsigned long)context.getOrdP() < options.d){
+        cerr << "ERROR: d = " << options.d << " exceeds the order of p (" << context.getOrdP() << ")" << endl;
+        return 1;
+    }
+
+    helib::SecKey secret_key(context);
+    secret_key.GenSecKey();
+    helib::addSome1DMatrices(secret_key);
+    if (options.d > 1){
+        helib::addFrbMatrices(secret_key);
+    }
+
+    auto setup_start = chrono::steady_clock::now();
+    he_cmp::Comparator comparator(context, options.type, options.d, options.len, secret_key, false, constants::COMPARATOR_CACHE_DIR);
+    double setup_seconds = chrono::duration<double>(chrono::steady_clock::now() - setup_start).count();
+
+    // values per ciphertext, and comparisons of such values per run
+    long numbers_size = context.getEA().size() / options.len;
+    long comparisons_per_run = numbers_size;
+    string total_timer = "Comparison";
+
+    auto start = chrono::steady_clock::now();
+    if (options.test == "compare"){
+        comparator.test_compare(options.runs);
+    }
+    else if (options.test == "min_max"){
+        comparator.test_min_max(options.runs);
+        total_timer = "MinMax";
+    }
+    else if (options.test == "sort"){
+        comparator.test_sorting(options.inputs, options.runs);
+        comparisons_per_run *= (long)options.inputs * (options.inputs - 1) / 2;
+        total_timer = "Sorting";
+    }
+    else{
+        comparator.test_array_min(options.inputs, options.depth, options.runs);
+        comparisons_per_run *= options.inputs - 1;
+        total_timer = "ArrayMin";
+    }
+    double wall_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    // throughput over the homomorphic evaluation only; wall time also covers encryption and checking
+    const helib::FHEtimer* total = helib::getTimerByName(total_timer.c_str());
+    double eval_seconds = (total != nullptr && total->getTime() > 0) ? total->getTime() : wall_seconds;
+    double throughput = comparisons_per_run * options.runs / eval_seconds;
+
+    cout << endl << "Summary" << endl;
+    cout << "-----------------------------------------------------" << endl;
+    cout << "test " << options.test << ", type " << type_name(options.type) << ", d " << options.d << ", len " << options.len
+         << ", runs " << options.runs << endl;
+    cout << "setup: " << setup_seconds << " s, wall: " << wall_seconds << " s, evaluation: " << eval_seconds << " s" << endl;
+    for (const string& stage : STAGES){
+        const helib::FHEtimer* timer = helib::getTimerByName(stage.c_str());
+        if (timer != nullptr && timer->getNumCalls() > 0){
+            cout << stage << ": " << timer->getTime() << " s over " << timer->getNumCalls() << " calls" << endl;
+        }
+    }
+    OpCounts ops = GlobalOpCounts();
+    cout << "Operations: ";
+    ops.Print(cout);
+    cout << endl;
+    cout << "Comparisons/sec: " << throughput << " (" << comparisons_per_run << " per run)" << endl;
+
+    if (!options.output.empty()){
+        ofstream out(options.output);
+        if (!out){
+            cerr << "ERROR: cannot write " << options.output << endl;
+            return 1;
+        }
+        out << "{" << endl;
+        out << "  \"config\": {\"test\": \"" << options.test << "\", \"type\": \"" << type_name(options.type)
+            << "\", \"d\": " << options.d << ", \"len\": " << options.len << ", \"inputs\": " << options.inputs
+            << ", \"depth\": " << options.depth << ", \"runs\": " << options.runs << ", \"m\": " << options.m
+            << ", \"p\": " << options.p << ", \"bits\": " << options.bits << "}," << endl;
+        out << "  \"setup_s\": " << setup_seconds << ", \"wall_s\": " << wall_seconds << ", \"eval_s\": " << eval_seconds
+            << ", \"comparisons_per_s\": " << throughput << "," << endl;
+        out << "  \"ops\": ";
+        ops.WriteJSON(out);
+        out << "," << endl;
+        out << "  \"stages\": {";
+        bool first = true;
+        for (const string& stage : STAGES){
+            const helib::FHEtimer* timer = helib::getTimerByName(stage.c_str());
+            if (timer != nullptr && timer->getNumCalls() > 0){
+                out << (first ? "" : ", ") << "\"" << stage << "\": {\"s\": " << timer->getTime() << ", \"calls\": " << timer->getNumCalls() << "}";
+                first = false;
+            }
+        }
+        out << "}" << endl;
+        out << "}" << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,90 @@
+#include "cost.hpp"
+#include "memory.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+// fastest of `runs` timings of body, less the fastest timing of setup (which body also runs)
+static double fastest(int runs, function<void()> body, double setup_s = 0){
+    double best = 0;
+    for (int run = 0; run < runs; run++){
+        auto start = chrono::steady_clock::now();
+        body();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (run == 0 || seconds < best){
+            best = seconds;
+        }
+    }
+    return max(best - setup_s, 0.0);
+}
+
+double PrimitiveCosts::Seconds(const OpCounts& ops) const{
+    return ops[HE_CTXT_MULT] * mult_low_s + ops[HE_RELINEARIZE] * relinearize_s + ops[HE_ROTATE] * rotate_s
+           + ops[HE_PTXT_MULT] * ptxt_mult_s + ops[HE_ADD] * add_s;
+}
+
+void PrimitiveCosts::Print(ostream& out) const{
+    const double ms = 1e3;
+    out << "multiply " << mult_low_s * ms << " ms + relinearize " << relinearize_s * ms << " ms, rotate "
+        << rotate_s * ms << " ms, plaintext multiply " << ptxt_mult_s * ms << " ms, add " << add_s * ms
+        << " ms, encrypt " << encrypt_s * ms << " ms, ciphertext " << ctxt_bytes << " bytes" << endl;
+}
+
+void PrimitiveCosts::WriteJSON(ostream& out) const{
+    out << "{\"mult_low_s\": " << mult_low_s << ", \"relinearize_s\": " << relinearize_s << ", \"rotate_s\": " << rotate_s
+        << ", \"ptxt_mult_s\": " << ptxt_mult_s << ", \"add_s\": " << add_s << ", \"encrypt_s\": " << encrypt_s
+        << ", \"ctxt_bytes\": " << ctxt_bytes << "}";
+}
+
+PrimitiveCosts CalibratePrimitives(const helib::PubKey& public_key, int runs){
+    const helib::Context& context = public_key.getContext();
+    const helib::EncryptedArray& ea = context.getEA();
+    PrimitiveCosts costs;
+
+    helib::Ptxt<helib::BGV> ptxt(context);
+    for (long i = 0; i < ptxt.size(); i++){
+        ptxt[i] = i % context.getP();
+    }
+    helib::Ctxt a(public_key), b(public_key);
+    costs.encrypt_s = fastest(runs, [&](){ public_key.Encrypt(a, ptxt); });
+    public_key.Encrypt(b, ptxt);
+    costs.ctxt_bytes = measured_bytes(a);
+
+    // every operation works on a copy of a, so the copy is timed on its own and taken out
+    double copy_s = fastest(runs, [&](){ helib::Ctxt c = a; });
+    costs.mult_low_s = fastest(runs, [&](){ helib::Ctxt c = a; c.multLowLvl(b); }, copy_s);
+    helib::Ctxt product = a;
+    product.multLowLvl(b);
+    costs.relinearize_s = fastest(runs, [&](){ helib::Ctxt c = product; c.reLinearize(); }, copy_s);
+    costs.rotate_s = fastest(runs, [&](){ helib::Ctxt c = a; ea.rotate(c, 1); }, copy_s);
+    costs.ptxt_mult_s = fastest(runs, [&](){ helib::Ctxt c = a; c.multByConstant(NTL::ZZX(2)); }, copy_s);
+    costs.add_s = fastest(runs, [&](){ helib::Ctxt c = a; c += b; }, copy_s);
+    return costs;
+}
+
+void QueryEstimate::Print(ostream& out) const{
+    out << query << ": " << seconds << " s, " << bytes / (1024.0 * 1024.0) << " MB, depth " << depth << " over "
+        << blocks << " blocks (";
+    ops.Print(out);
+    out << ")" << endl;
+}
+
+void QueryEstimate::WriteJSON(ostream& out) const{
+    out << "{\"query\": \"" << query << "\", \"blocks\": " << blocks << ", \"seconds\": " << seconds << ", \"bytes\": "
+        << bytes << ", \"depth\": " << depth << ", \"ops\": ";
+    ops.WriteJSON(out);
+    out << "}";
+}
+
+AdmissionPolicy MaxCostPolicy(double max_seconds, size_t max_bytes){
+    return [max_seconds, max_bytes](const QueryEstimate& estimate, int running){
+        if ((max_seconds > 0 && estimate.seconds > max_seconds) || (max_bytes > 0 && estimate.bytes > max_bytes)){
+            return REJECT;
+        }
+        // the running queries are assumed to be as large as this one
+        if (max_bytes > 0 && estimate.bytes * (running + 1) > max_bytes){
+            return DEFER;
+        }
+        return ADMIT;
+    };
+}
@@ -0,0 +1,61 @@
+/*
+Query cost model: the latency of the HElib primitives, measured on the running context, turned into latency,
+memory and depth predictions for a query's operation mix; and the admission-control policies that use them
+*/
+
+#pragma once
+
+#include <functional>
+#include <iostream>
+#include <string>
+#include <helib/helib.h>
+#include "ops.hpp"
+
+using namespace std;
+
+// seconds per operation on a fresh ciphertext of the current context
+struct PrimitiveCosts{
+    // multiplication without and with the relinearization it is followed by
+    double mult_low_s = 0;
+    double relinearize_s = 0;
+    double rotate_s = 0;
+    double ptxt_mult_s = 0;
+    double add_s = 0;
+    double encrypt_s = 0;
+    // heap bytes of one fresh ciphertext
+    size_t ctxt_bytes = 0;
+
+    bool Calibrated() const { return ctxt_bytes > 0; }
+    // sequential latency of the given operations
+    double Seconds(const OpCounts& ops) const;
+    void Print(ostream& out) const;
+    void WriteJSON(ostream& out) const;
+};
+
+// times each primitive `runs` times and keeps the fastest run
+PrimitiveCosts CalibratePrimitives(const helib::PubKey& public_key, int runs);
+
+struct QueryEstimate{
+    string query;
+    long blocks = 0;
+    // homomorphic operations of the whole query, as OpCounts would count them
+    OpCounts ops;
+    // multiplicative depth of the result
+    int depth = 0;
+    double seconds = 0;
+    // peak bytes of query temporaries (and of the pinned columns of an out-of-core DB)
+    size_t bytes = 0;
+
+    void Print(ostream& out) const;
+    void WriteJSON(ostream& out) const;
+};
+
+enum Admission{ ADMIT, DEFER, REJECT };
+
+// decides whether a query may start, given its estimate and the number of admitted queries still running.
+// DEFER waits for a running query to finish and asks again (with nothing running it admits)
+typedef function<Admission(const QueryEstimate&, int)> AdmissionPolicy;
+
+// rejects queries estimated above max_seconds or max_bytes (0 = no limit) and defers a query while the ones
+// running and it together would exceed max_bytes
+AdmissionPolicy MaxCostPolicy(double max_seconds, size_t max_bytes);
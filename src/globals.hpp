@@ -18,5 +18,54 @@ namespace constants
     const unsigned long BITS = 431;
     // Number of columns of Key-Switching matrix (default = 2 or 3)
     const unsigned long C = 3;
+    // Bits of capacity a query must have left at the end for the storage level chosen for it
+    const double STORAGE_CAPACITY_MARGIN = 20;
+
+    // COMPARATOR PARAMETERS
+
+    // Directory of cached comparator precomputation tables (empty string disables the cache)
+    const char* const COMPARATOR_CACHE_DIR = "cache";
+
+    // MEMORY PARAMETERS
+
+    // Query temporaries kept for reuse per thread (each one is a full ciphertext), and their bytes over all threads
+    const int ARENA_MAX_CTXTS = 64;
+    const size_t ARENA_MAX_BYTES = 1UL << 30;
+    // Allocations above this size are mapped separately by malloc (CtxtArena::TuneAllocator)
+    const int ARENA_MMAP_THRESHOLD = 32 * 1024 * 1024;
+
+    // QUERY PARAMETERS
+
+    // Threads shared by all queries (0 = all hardware threads)
+    const int QUERY_THREADS = 0;
+    // Blocks one query processes at a time; its temporaries are bounded by this, not by the cohort size
+    const int QUERY_BLOCK_WINDOW = 4;
+    // Queries a QueryExecutor runs at a time (0 = enough to keep the query threads busy)
+    const int ASYNC_QUERY_CONCURRENCY = 0;
+    // Submitted queries a QueryExecutor holds before Submit blocks
+    const int ASYNC_QUEUE_DEPTH = 64;
+    // Timings per primitive when the cost model is calibrated (the fastest one is kept)
+    const int COST_CALIBRATION_RUNS = 3;
+    // Spans kept by the tracer before it starts dropping them
+    const long TRACE_MAX_EVENTS = 1 << 20;
+
+    // TRANSPORT PARAMETERS
+
+    // Largest frame a connection accepts by default, i.e. a result on the client; a DistrubtionQuery answer holds
+    // one ciphertext per block
+    const unsigned long MAX_FRAME_BYTES = 1UL << 36;
+
+    // Largest public key (with its key-switching matrices) a QueryService accepts at the start of a session
+    const unsigned long MAX_KEY_FRAME_BYTES = 1UL << 32;
+
+    // Request frames a QueryService accepts: this much for the fixed fields and predicates, plus room for one
+    // ciphertext per DB column
+    const unsigned long REQUEST_FRAME_OVERHEAD = 1UL << 20;
+
+    // Size of each direction's ring of a shared-memory connection; larger frames stream through it
+    const unsigned long SHM_RING_BYTES = 1UL << 26;
+
+    // Largest chunk a shared-memory sender fills before the receiver can start reading it
+    const unsigned long SHM_CHUNK_BYTES = 1UL << 20;
 
 }
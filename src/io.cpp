@@ -0,0 +1,163 @@
+#include "io.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(const string& path){
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0){
+        throw runtime_error("ERROR: cannot open " + path);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0){
+        close(fd);
+        throw runtime_error("ERROR: cannot stat " + path);
+    }
+    m_size = st.st_size;
+    m_data = nullptr;
+
+    if (m_size > 0){
+        void* addr = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED){
+            close(fd);
+            throw runtime_error("ERROR: cannot mmap " + path);
+        }
+        m_data = static_cast<const char*>(addr);
+    }
+    // the mapping stays valid after the descriptor is closed
+    close(fd);
+}
+
+MappedFile::~MappedFile(){
+    if (m_data != nullptr){
+        munmap(const_cast<char*>(m_data), m_size);
+    }
+}
+
+MemoryBuffer::MemoryBuffer(const char* begin, size_t size){
+    char* p = const_cast<char*>(begin);
+    setg(p, p, p + size);
+}
+
+MemoryBuffer::pos_type MemoryBuffer::seekoff(off_type off, ios_base::seekdir dir, ios_base::openmode which){
+    if (!(which & ios_base::in)){
+        return pos_type(off_type(-1));
+    }
+    char* target;
+    if (dir == ios_base::beg){
+        target = eback() + off;
+    }
+    else if (dir == ios_base::cur){
+        target = gptr() + off;
+    }
+    else{
+        target = egptr() + off;
+    }
+    if (target < eback() || target > egptr()){
+        return pos_type(off_type(-1));
+    }
+    setg(eback(), target, egptr());
+    return pos_type(target - eback());
+}
+
+MemoryBuffer::pos_type MemoryBuffer::seekpos(pos_type pos, ios_base::openmode which){
+    return seekoff(off_type(pos), ios_base::beg, which);
+}
+
+CountingBuffer::int_type CountingBuffer::overflow(int_type c){
+    if (!traits_type::eq_int_type(c, traits_type::eof())){
+        m_count++;
+    }
+    return traits_type::not_eof(c);
+}
+
+streamsize CountingBuffer::xsputn(const char*, streamsize n){
+    m_count += n;
+    return n;
+}
+
+void write_u64(ostream& str, uint64_t value){
+    str.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+uint64_t read_u64(istream& str){
+    uint64_t value;
+    if (!str.read(reinterpret_cast<char*>(&value), sizeof(value))){
+        throw runtime_error("ERROR: unexpected end of stream");
+    }
+    return value;
+}
+
+void write_double(ostream& str, double value){
+    str.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+double read_double(istream& str){
+    double value;
+    if (!str.read(reinterpret_cast<char*>(&value), sizeof(value))){
+        throw runtime_error("ERROR: unexpected end of stream");
+    }
+    return value;
+}
+
+void write_string(ostream& str, const string& value){
+    write_u64(str, value.size());
+    str.write(value.data(), value.size());
+}
+
+string read_string(istream& str){
+    uint64_t size = read_u64(str);
+    if (size > MAX_STRING_BYTES){
+        throw runtime_error("ERROR: string of " + to_string(size) + " bytes, at most " + to_string(MAX_STRING_BYTES) + " are accepted");
+    }
+    // read in chunks, so a corrupt length fails at the end of the stream instead of allocating it up front
+    const uint64_t chunk = 1 << 20;
+    string value;
+    while (value.size() < size){
+        size_t read = value.size();
+        value.resize(read + min(chunk, size - read));
+        if (!str.read(&value[read], value.size() - read)){
+            throw runtime_error("ERROR: unexpected end of stream");
+        }
+    }
+    return value;
+}
+
+bool write_file_atomic(const string& path, const string& contents){
+    return write_file_atomic(path, [&contents](ostream& out){ out.write(contents.data(), contents.size()); });
+}
+
+bool write_file_atomic(const string& path, const function<void(ostream&)>& write){
+    string tmp_path = path + ".tmp." + to_string(getpid());
+    {
+        ofstream out(tmp_path, ios::binary | ios::trunc);
+        if (!out){
+            return false;
+        }
+        try{
+            write(out);
+        }
+        catch (...){
+            out.close();
+            remove(tmp_path.c_str());
+            throw;
+        }
+        out.close();
+        if (!out){
+            remove(tmp_path.c_str());
+            return false;
+        }
+    }
+    if (rename(tmp_path.c_str(), path.c_str()) != 0){
+        remove(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,82 @@
+/*
+Auxiliary functions for binary files: memory mapping and raw field IO
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <streambuf>
+#include <string>
+
+using namespace std;
+
+// Read-only memory mapping of a whole file
+class MappedFile{
+public:
+    MappedFile(const string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+private:
+    const char* m_data;
+    size_t m_size;
+};
+
+// Stream buffer reading directly from a byte range (e.g. a MappedFile) so that
+// HElib/NTL readers can consume it without an intermediate copy
+class MemoryBuffer : public streambuf{
+public:
+    MemoryBuffer(const char* begin, size_t size);
+
+protected:
+    pos_type seekoff(off_type off, ios_base::seekdir dir, ios_base::openmode which) override;
+    pos_type seekpos(pos_type pos, ios_base::openmode which) override;
+};
+
+// Stream buffer that discards its input and only counts the bytes written,
+// used to measure the serialized size of HElib objects
+class CountingBuffer : public streambuf{
+public:
+    CountingBuffer(): m_count(0) {}
+    size_t count() const { return m_count; }
+
+protected:
+    int_type overflow(int_type c) override;
+    streamsize xsputn(const char* s, streamsize n) override;
+
+private:
+    size_t m_count;
+};
+
+// number of bytes object.writeTo(...) produces
+template<typename T>
+size_t serialized_size(const T& object){
+    CountingBuffer buffer;
+    ostream str(&buffer);
+    object.writeTo(str);
+    return buffer.count();
+}
+
+void write_u64(ostream& str, uint64_t value);
+uint64_t read_u64(istream& str);
+
+void write_double(ostream& str, double value);
+double read_double(istream& str);
+
+// length-prefixed byte string; reading throws for a length past MAX_STRING_BYTES or past the end of the stream,
+// allocating only as much as the stream actually holds
+const uint64_t MAX_STRING_BYTES = 1ULL << 30;
+void write_string(ostream& str, const string& value);
+string read_string(istream& str);
+
+// write a file atomically: data goes to a temporary file that is renamed into place
+bool write_file_atomic(const string& path, const string& contents);
+// the same, streamed by write into the temporary file; an exception from write removes it and is rethrown
+bool write_file_atomic(const string& path, const function<void(ostream&)>& write);
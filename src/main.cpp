@@ -18,8 +18,8 @@
 #include <iostream>
 
 #include <helib/helib.h>
-#include "client.hpp"
 #include "server.hpp"
+#include "arena.hpp"
 #include "globals.hpp"
 
 
@@ -37,6 +37,8 @@ int main()
 {
     /*  Example of BGV scheme  */
     
+    CtxtArena::TuneAllocator();
+    
     
     std::cout << "Initialising context object..." << std::endl;
 
@@ -52,7 +54,6 @@ int main()
                                .build();
 
     Server server = Server(context);
-    Client client = Client(context);
     
     server.PrintContext();
     
@@ -118,5 +119,25 @@ int main()
     cout << "-----------------------------------------------------" << endl;
     server.PrintEncryptedDB(true);
 
+    cout << "Memory usage" << endl;
+    cout << "-----------------------------------------------------" << endl;
+    server.MemoryUsage().Print(cout);
+    for (const QueryMemory& m : server.QueryMemoryLog()){
+        cout << m.query << ": peak RSS " << m.peak_rss / (1024 * 1024) << " MB" << (m.overlapped ? " (shared with concurrent queries)" : "")
+             << ", " << m.ctxt_copies << " ciphertext copies" << endl;
+    }
+    cout << "Homomorphic operations" << endl;
+    cout << "-----------------------------------------------------" << endl;
+    for (const QueryOps& ops : server.QueryOpsLog()){
+        ops.Print(cout);
+    }
+    cout << "Noise budget" << endl;
+    cout << "-----------------------------------------------------" << endl;
+    for (const QueryNoise& noise : server.QueryNoiseLog()){
+        noise.Print(cout);
+    }
+    ArenaStats arena = CtxtArena::GlobalStats();
+    cout << "Query temporaries: " << arena.takes << " taken, " << arena.reused << " reused, " << arena.allocated << " allocated" << endl;
+
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,88 @@
+#include "memory.hpp"
+#include "arena.hpp"
+
+#include <fstream>
+#include <malloc.h>
+
+size_t HeapInUse(){
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+#else
+    struct mallinfo info = mallinfo();
+    return (size_t)(unsigned int)info.uordblks + (size_t)(unsigned int)info.hblkhd;
+#endif
+}
+
+// value of a "Key:   1234 kB" line of /proc/self/status, in bytes
+static size_t status_field(const string& key){
+    ifstream status("/proc/self/status");
+    string line;
+    while (getline(status, line)){
+        if (line.compare(0, key.size(), key) == 0 && line.size() > key.size() && line[key.size()] == ':'){
+            return stoul(line.substr(key.size() + 1)) * 1024;
+        }
+    }
+    return 0;
+}
+
+size_t CurrentRSS(){
+    return status_field("VmRSS");
+}
+
+size_t PeakRSS(){
+    return status_field("VmHWM");
+}
+
+bool ResetPeakRSS(){
+    ofstream clear_refs("/proc/self/clear_refs");
+    clear_refs << "5";
+    clear_refs.flush();
+    return (bool)clear_refs;
+}
+
+// scopes alive, and scopes ever started: a scope overlapped another if one was alive when it started or one
+// started after it
+static atomic<int> running_scopes(0);
+static atomic<long> started_scopes(0);
+
+QueryMemoryScope::QueryMemoryScope(const string& query, function<void(const QueryMemory&)> record): record(record){
+    // restarting the high-water mark under a running query would lose that query's peak
+    started = ++started_scopes;
+    memory.overlapped = running_scopes++ > 0;
+    if (!memory.overlapped){
+        ResetPeakRSS();
+    }
+    memory.query = query;
+    memory.rss_before = CurrentRSS();
+    memory.peak_rss = 0;
+    memory.ctxt_copies = CtxtArena::ThreadCopies();
+    worker_copies = 0;
+}
+
+void QueryMemoryScope::AddCopies(long copies){
+    worker_copies += copies;
+}
+
+QueryMemoryScope::~QueryMemoryScope(){
+    memory.peak_rss = PeakRSS();
+    memory.overlapped = memory.overlapped || started_scopes.load() != started || running_scopes.load() > 1;
+    running_scopes--;
+    memory.ctxt_copies = CtxtArena::ThreadCopies() - memory.ctxt_copies + worker_copies;
+    record(memory);
+}
+
+void MemoryReport::Print(ostream& out) const{
+    const double MB = 1024.0 * 1024.0;
+    out << "DB blocks       : " << db_blocks << " ciphertexts, " << db_bytes / MB << " MB" << endl;
+    out << "Seeded blocks   : " << seeded_bytes / MB << " MB" << endl;
+    out << "Column cache    : " << cache_bytes / MB << " MB" << endl;
+    out << "Keys            : " << keys_bytes / MB << " MB" << endl;
+    out << "Comparator      : " << comparator_bytes / MB << " MB (estimate " << comparator_estimate_bytes / MB << " MB)" << endl;
+    out << "One ciphertext  : " << measured_ctxt_bytes << " bytes (estimate " << estimated_ctxt_bytes << " bytes";
+    if (estimated_ctxt_bytes > 0){
+        out << ", measured/estimate = " << (double)measured_ctxt_bytes / estimated_ctxt_bytes;
+    }
+    out << ")" << endl;
+    out << "RSS             : " << rss_bytes / MB << " MB (peak " << peak_rss_bytes / MB << " MB)" << endl;
+}
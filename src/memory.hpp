@@ -0,0 +1,85 @@
+/*
+Memory accounting: heap and resident-set probes of the process (Linux / glibc) and the reports built on them
+*/
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+// bytes currently allocated through malloc
+size_t HeapInUse();
+// resident set size and its high-water mark, from /proc/self/status
+size_t CurrentRSS();
+size_t PeakRSS();
+// restarts the high-water mark at the current RSS; false if the kernel does not support it
+bool ResetPeakRSS();
+
+// heap bytes a copy of the object occupies (including the object itself). Allocations made by other threads
+// at the same time are counted too, so measure while the process is quiet
+template<typename T>
+size_t measured_bytes(const T& object){
+    size_t before = HeapInUse();
+    T* copy = new T(object);
+    size_t after = HeapInUse();
+    delete copy;
+    return after > before ? after - before : 0;
+}
+
+struct QueryMemory{
+    string query;
+    size_t rss_before;
+    // the high-water mark is process-wide: it is only restarted when no other query is running, so with
+    // overlapping queries it covers all of them since the first one started
+    size_t peak_rss;
+    // another query ran at some point during this one
+    bool overlapped;
+    // ciphertext copies the query made, on its own thread and on the query pool
+    long ctxt_copies;
+};
+
+// measures the peak RSS between construction and destruction and hands it to record
+class QueryMemoryScope{
+public:
+    QueryMemoryScope(const string& query, function<void(const QueryMemory&)> record);
+    ~QueryMemoryScope();
+
+    QueryMemoryScope(const QueryMemoryScope&) = delete;
+    QueryMemoryScope& operator=(const QueryMemoryScope&) = delete;
+
+    // copies the query made on worker threads
+    void AddCopies(long copies);
+
+private:
+    QueryMemory memory;
+    long started;
+    atomic<long> worker_copies;
+    function<void(const QueryMemory&)> record;
+};
+
+struct MemoryReport{
+    // measured: heap bytes of the DB blocks held as full ciphertexts
+    size_t db_bytes;
+    long db_blocks;
+    // seeded (half-size) storage form of the fresh blocks
+    size_t seeded_bytes;
+    // out-of-core column cache (computed from the prime sets of the resident columns)
+    size_t cache_bytes;
+    // measured when the keys were generated
+    size_t keys_bytes;
+    // measured when the comparator was built, and Comparator::memory_usage for comparison
+    size_t comparator_bytes;
+    size_t comparator_estimate_bytes;
+    // one fresh ciphertext: HElib's serialization estimate (StorageOfOneElement) against the measured heap bytes
+    size_t estimated_ctxt_bytes;
+    size_t measured_ctxt_bytes;
+
+    size_t rss_bytes;
+    size_t peak_rss_bytes;
+
+    void Print(ostream& out) const;
+};
@@ -0,0 +1,130 @@
+#include "noise.hpp"
+
+#include <sstream>
+#include <stdexcept>
+
+static thread_local QueryNoiseMonitor* current_monitor = nullptr;
+
+void NoiseStage::Add(double bits){
+    if (samples == 0 || bits < min_bits){
+        min_bits = bits;
+    }
+    if (samples == 0 || bits > max_bits){
+        max_bits = bits;
+    }
+    sum_bits += bits;
+    samples++;
+}
+
+void QueryNoise::Print(ostream& out) const{
+    out << query << ": inputs " << input_bits << " bits, predicted result " << predicted_bits << " bits";
+    if (!aborted_stage.empty()){
+        out << ", aborted at " << aborted_stage;
+    }
+    out << endl;
+    for (const auto& stage : stages){
+        out << "  " << stage.first << ": min " << stage.second.min_bits << ", mean " << stage.second.Mean()
+            << ", max " << stage.second.max_bits << " bits over " << stage.second.samples << " ciphertexts" << endl;
+    }
+}
+
+void QueryNoise::WriteJSON(ostream& out) const{
+    out << "{\"query\": \"" << query << "\", \"trace_query\": " << trace_query << ", \"input_bits\": " << input_bits
+        << ", \"predicted_bits\": " << predicted_bits << ", \"aborted_stage\": \"" << aborted_stage << "\", \"stages\": {";
+    bool first = true;
+    for (const auto& stage : stages){
+        out << (first ? "" : ", ") << "\"" << stage.first << "\": {\"min_bits\": " << stage.second.min_bits
+            << ", \"mean_bits\": " << stage.second.Mean() << ", \"max_bits\": " << stage.second.max_bits
+            << ", \"samples\": " << stage.second.samples << "}";
+        first = false;
+    }
+    out << "}}";
+}
+
+QueryNoiseMonitor::QueryNoiseMonitor(const string& query, long trace_query, double min_bits, function<void(const QueryNoise&)> record):
+    min_bits(min_bits), record(record), previous(current_monitor){
+    noise.query = query;
+    noise.trace_query = trace_query;
+    noise.input_bits = 0;
+    noise.predicted_bits = 0;
+    current_monitor = this;
+}
+
+QueryNoiseMonitor::~QueryNoiseMonitor(){
+    current_monitor = previous;
+    if (record){
+        record(noise);
+    }
+}
+
+void QueryNoiseMonitor::Predict(double input_bits, double predicted_bits, const string& plan){
+    {
+        lock_guard<mutex> guard(lock);
+        noise.input_bits = input_bits;
+        noise.predicted_bits = predicted_bits;
+    }
+    if (predicted_bits < min_bits){
+        ostringstream reason;
+        reason << "the inputs have " << input_bits << " bits of capacity and " << plan << " would leave "
+               << predicted_bits << " (at least " << min_bits << " needed to decrypt)";
+        Abort("plan", reason.str());
+    }
+}
+
+void QueryNoiseMonitor::Observe(const char* stage, const helib::Ctxt& ctxt){
+    double bits = ctxt.capacity();
+    {
+        lock_guard<mutex> guard(lock);
+        noise.stages[stage].Add(bits);
+    }
+    if (bits < min_bits){
+        ostringstream reason;
+        reason << "capacity dropped to " << bits << " bits (at least " << min_bits << " needed to decrypt)";
+        Abort(stage, reason.str());
+    }
+}
+
+void QueryNoiseMonitor::Expect(const char* stage, const helib::Ctxt& ctxt, double cost_bits){
+    double bits = ctxt.capacity();
+    if (bits - cost_bits < min_bits){
+        ostringstream reason;
+        reason << "the input has " << bits << " bits of capacity and the stage is expected to consume " << cost_bits
+               << " (at least " << min_bits << " needed to decrypt)";
+        Abort(stage, reason.str());
+    }
+}
+
+void QueryNoiseMonitor::Abort(const string& stage, const string& reason){
+    {
+        lock_guard<mutex> guard(lock);
+        // the first stage that ran out; blocks still in flight may report later ones
+        if (noise.aborted_stage.empty()){
+            noise.aborted_stage = stage;
+        }
+    }
+    throw invalid_argument("ERROR: " + noise.query + " aborted at " + stage + ", noise budget exhausted: " + reason);
+}
+
+QueryNoiseMonitor* QueryNoiseMonitor::Current(){
+    return current_monitor;
+}
+
+NoiseScope::NoiseScope(QueryNoiseMonitor* monitor): previous(current_monitor){
+    current_monitor = monitor;
+}
+
+NoiseScope::~NoiseScope(){
+    current_monitor = previous;
+}
+
+void ObserveNoise(const char* stage, const helib::Ctxt& ctxt){
+    if (current_monitor != nullptr){
+        current_monitor->Observe(stage, ctxt);
+    }
+}
+
+void ExpectNoise(const char* stage, const helib::Ctxt& ctxt, double cost_bits){
+    if (current_monitor != nullptr){
+        current_monitor->Expect(stage, ctxt, cost_bits);
+    }
+}
@@ -0,0 +1,87 @@
+/*
+Noise-budget telemetry: the capacity (bits of noise budget left) of the ciphertexts a query produces, recorded
+after each stage. A query that is predicted to run out, or does run out, is aborted instead of finishing with
+ciphertexts that no longer decrypt
+*/
+
+#pragma once
+
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <helib/helib.h>
+
+using namespace std;
+
+struct NoiseStage{
+    long samples = 0;
+    double min_bits = 0;
+    double max_bits = 0;
+    double sum_bits = 0;
+
+    void Add(double bits);
+    double Mean() const { return samples > 0 ? sum_bits / samples : 0; }
+};
+
+struct QueryNoise{
+    string query;
+    // same id as the query's trace events
+    long trace_query;
+    // capacity of the inputs and the predicted capacity of the result (before any block ran)
+    double input_bits;
+    double predicted_bits;
+    // capacity after each stage, over all blocks
+    map<string, NoiseStage> stages;
+    // stage the query was aborted at (empty if it was not)
+    string aborted_stage;
+
+    void Print(ostream& out) const;
+    void WriteJSON(ostream& out) const;
+};
+
+// noise telemetry of one query, shared by the threads that work on it and handed to record on destruction
+// (also when the query was aborted). Becomes the calling thread's monitor; worker threads join it with NoiseScope
+class QueryNoiseMonitor{
+public:
+    // capacities below min_bits abort the query
+    QueryNoiseMonitor(const string& query, long trace_query, double min_bits, function<void(const QueryNoise&)> record);
+    ~QueryNoiseMonitor();
+
+    QueryNoiseMonitor(const QueryNoiseMonitor&) = delete;
+    QueryNoiseMonitor& operator=(const QueryNoiseMonitor&) = delete;
+
+    // checks the predicted capacity of the result before the query starts; throws if it is below min_bits
+    void Predict(double input_bits, double predicted_bits, const string& plan);
+    // records the capacity of ctxt after stage; throws if it is below min_bits
+    void Observe(const char* stage, const helib::Ctxt& ctxt);
+    // before stage runs on ctxt: throws if the cost_bits it is expected to consume would leave less than min_bits
+    void Expect(const char* stage, const helib::Ctxt& ctxt, double cost_bits);
+
+    static QueryNoiseMonitor* Current();
+
+private:
+    [[noreturn]] void Abort(const string& stage, const string& reason);
+
+    QueryNoise noise;
+    double min_bits;
+    mutex lock;
+    function<void(const QueryNoise&)> record;
+    QueryNoiseMonitor* previous;
+};
+
+// makes monitor the calling thread's monitor until destruction
+class NoiseScope{
+public:
+    NoiseScope(QueryNoiseMonitor* monitor);
+    ~NoiseScope();
+
+private:
+    QueryNoiseMonitor* previous;
+};
+
+// records ctxt for the current query (no-op outside of one)
+void ObserveNoise(const char* stage, const helib::Ctxt& ctxt);
+// checks ctxt against the next stage's cost for the current query (no-op outside of one)
+void ExpectNoise(const char* stage, const helib::Ctxt& ctxt, double cost_bits);
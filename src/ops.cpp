@@ -0,0 +1,187 @@
+#include "ops.hpp"
+#include "trace.hpp"
+
+#include <atomic>
+
+const char* const HE_OP_NAMES[HE_OP_COUNT] = {
+    "ctxt_mult", "relinearize", "key_switch", "rotate", "ptxt_mult", "add", "mod_switch"
+};
+
+static atomic<long> global_counts[HE_OP_COUNT];
+static thread_local QueryOpCounter* current_counter = nullptr;
+
+OpCounts& OpCounts::operator+=(const OpCounts& other){
+    for (int op = 0; op < HE_OP_COUNT; op++){
+        counts[op] += other.counts[op];
+    }
+    return *this;
+}
+
+void OpCounts::Print(ostream& out) const{
+    for (int op = 0; op < HE_OP_COUNT; op++){
+        out << (op ? ", " : "") << HE_OP_NAMES[op] << " " << counts[op];
+    }
+}
+
+void OpCounts::WriteJSON(ostream& out) const{
+    out << "{";
+    for (int op = 0; op < HE_OP_COUNT; op++){
+        out << (op ? ", " : "") << "\"" << HE_OP_NAMES[op] << "\": " << counts[op];
+    }
+    out << "}";
+}
+
+void QueryOps::Print(ostream& out) const{
+    out << query << ": ";
+    total.Print(out);
+    out << endl;
+    for (const auto& stage : stages){
+        out << "  " << stage.first << ": ";
+        stage.second.Print(out);
+        out << endl;
+    }
+}
+
+void QueryOps::WriteJSON(ostream& out) const{
+    out << "{\"query\": \"" << query << "\", \"trace_query\": " << trace_query << ", \"total\": ";
+    total.WriteJSON(out);
+    out << ", \"stages\": {";
+    bool first = true;
+    for (const auto& stage : stages){
+        out << (first ? "" : ", ") << "\"" << stage.first << "\": ";
+        stage.second.WriteJSON(out);
+        first = false;
+    }
+    out << "}}";
+}
+
+QueryOpCounter::QueryOpCounter(const string& query, long trace_query, function<void(const QueryOps&)> record):
+    record(record), previous(current_counter){
+    ops.query = query;
+    ops.trace_query = trace_query;
+    current_counter = this;
+}
+
+QueryOpCounter::~QueryOpCounter(){
+    current_counter = previous;
+    if (record){
+        record(ops);
+    }
+}
+
+void QueryOpCounter::Add(const char* stage, HEOp op, long n){
+    lock_guard<mutex> guard(lock);
+    ops.total[op] += n;
+    ops.stages[stage != nullptr ? stage : ops.query][op] += n;
+}
+
+QueryOpCounter* QueryOpCounter::Current(){
+    return current_counter;
+}
+
+OpCountScope::OpCountScope(QueryOpCounter* counter): previous(current_counter){
+    current_counter = counter;
+}
+
+OpCountScope::~OpCountScope(){
+    current_counter = previous;
+}
+
+void CountOp(HEOp op, long n){
+    global_counts[op].fetch_add(n, memory_order_relaxed);
+    if (current_counter != nullptr){
+        current_counter->Add(TraceScope::CurrentStage(), op, n);
+    }
+}
+
+OpCounts GlobalOpCounts(){
+    OpCounts counts;
+    for (int op = 0; op < HE_OP_COUNT; op++){
+        counts.counts[op] = global_counts[op].load(memory_order_relaxed);
+    }
+    return counts;
+}
+
+namespace counted{
+
+// a multiplication brings both operands to a common prime set and may drop primes afterwards
+static void count_mod_switch(const helib::IndexSet& before, const helib::Ctxt& after){
+    if (after.getPrimeSet().card() < before.card()){
+        CountOp(HE_MOD_SWITCH);
+    }
+}
+
+static void count_mult(long n){
+    CountOp(HE_CTXT_MULT, n);
+    CountOp(HE_RELINEARIZE, n);
+    CountOp(HE_KEY_SWITCH, n);
+}
+
+void Multiply(helib::Ctxt& a, const helib::Ctxt& b){
+    helib::IndexSet before = a.getPrimeSet();
+    a.multiplyBy(b);
+    count_mult(1);
+    count_mod_switch(before, a);
+}
+
+void Square(helib::Ctxt& a){
+    helib::IndexSet before = a.getPrimeSet();
+    a.square();
+    count_mult(1);
+    count_mod_switch(before, a);
+}
+
+void Power(helib::Ctxt& a, long e){
+    helib::IndexSet before = a.getPrimeSet();
+    a.power(e);
+    // one squaring per bit below the top one, one multiplication per further set bit
+    long squarings = 0, multiplications = 0;
+    for (long bits = e; bits > 1; bits >>= 1){
+        squarings++;
+        multiplications += bits & 1;
+    }
+    count_mult(squarings + multiplications);
+    count_mod_switch(before, a);
+}
+
+void Rotate(const helib::EncryptedArray& ea, helib::Ctxt& a, long k){
+    ea.rotate(a, k);
+    CountOp(HE_ROTATE);
+    CountOp(HE_KEY_SWITCH);
+}
+
+void Frobenius(helib::Ctxt& a, long k){
+    a.frobeniusAutomorph(k);
+    CountOp(HE_KEY_SWITCH);
+}
+
+void Add(helib::Ctxt& a, const helib::Ctxt& b){
+    a += b;
+    CountOp(HE_ADD);
+}
+
+void Subtract(helib::Ctxt& a, const helib::Ctxt& b){
+    a -= b;
+    CountOp(HE_ADD);
+}
+
+void ModDownToSet(helib::Ctxt& a, const helib::IndexSet& primes){
+    a.modDownToSet(primes);
+    CountOp(HE_MOD_SWITCH);
+}
+
+helib::Ctxt& GetPower(helib::DynamicCtxtPowers& powers, long e){
+    auto computed = [&powers](){
+        long n = 0;
+        for (long i = 1; i <= powers.size(); i++){
+            n += powers.isPowerComputed(i);
+        }
+        return n;
+    };
+    long before = computed();
+    helib::Ctxt& power = powers.getPower(e);
+    count_mult(computed() - before);
+    return power;
+}
+
+}
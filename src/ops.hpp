@@ -0,0 +1,121 @@
+/*
+Homomorphic operation counters: the query code runs its ciphertext operations through the counted:: wrappers,
+which attribute each one to the running query (QueryOpCounter) and to the innermost trace span (the stage)
+*/
+
+#pragma once
+
+#include <array>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <helib/helib.h>
+
+using namespace std;
+
+enum HEOp{
+    // ciphertext x ciphertext, each followed by a relinearization
+    HE_CTXT_MULT,
+    HE_RELINEARIZE,
+    // every key switch: relinearizations, rotations and Frobenius automorphisms
+    HE_KEY_SWITCH,
+    HE_ROTATE,
+    HE_PTXT_MULT,
+    // ciphertext + ciphertext and ciphertext + constant
+    HE_ADD,
+    // explicit mod-downs and the ones a multiplication does on its own
+    HE_MOD_SWITCH,
+    HE_OP_COUNT
+};
+
+extern const char* const HE_OP_NAMES[HE_OP_COUNT];
+
+struct OpCounts{
+    array<long, HE_OP_COUNT> counts{};
+
+    long& operator[](HEOp op){ return counts[op]; }
+    long operator[](HEOp op) const { return counts[op]; }
+    OpCounts& operator+=(const OpCounts& other);
+
+    void Print(ostream& out) const;
+    // {"ctxt_mult": n, ...}
+    void WriteJSON(ostream& out) const;
+};
+
+struct QueryOps{
+    string query;
+    // same id as the query's trace events (0 if the query was not traced)
+    long trace_query;
+    OpCounts total;
+    // by the innermost span the operations ran in
+    map<string, OpCounts> stages;
+
+    void Print(ostream& out) const;
+    void WriteJSON(ostream& out) const;
+};
+
+// collects the operations of one query from every thread that works on it and hands them to record on
+// destruction. Becomes the calling thread's counter; worker threads join it with OpCountScope
+class QueryOpCounter{
+public:
+    QueryOpCounter(const string& query, long trace_query, function<void(const QueryOps&)> record);
+    ~QueryOpCounter();
+
+    QueryOpCounter(const QueryOpCounter&) = delete;
+    QueryOpCounter& operator=(const QueryOpCounter&) = delete;
+
+    void Add(const char* stage, HEOp op, long n);
+    // counter of the query the calling thread works on, nullptr if none
+    static QueryOpCounter* Current();
+
+private:
+    QueryOps ops;
+    mutex lock;
+    function<void(const QueryOps&)> record;
+    QueryOpCounter* previous;
+};
+
+// makes counter the calling thread's counter until destruction
+class OpCountScope{
+public:
+    OpCountScope(QueryOpCounter* counter);
+    ~OpCountScope();
+
+private:
+    QueryOpCounter* previous;
+};
+
+// counts towards the current query (if any) and the process-wide totals
+void CountOp(HEOp op, long n = 1);
+OpCounts GlobalOpCounts();
+
+// ciphertext operations that count themselves
+namespace counted{
+
+void Multiply(helib::Ctxt& a, const helib::Ctxt& b);
+void Square(helib::Ctxt& a);
+// square-and-multiply, as Ctxt::power does it
+void Power(helib::Ctxt& a, long e);
+void Rotate(const helib::EncryptedArray& ea, helib::Ctxt& a, long k);
+void Frobenius(helib::Ctxt& a, long k);
+void Add(helib::Ctxt& a, const helib::Ctxt& b);
+void Subtract(helib::Ctxt& a, const helib::Ctxt& b);
+void ModDownToSet(helib::Ctxt& a, const helib::IndexSet& primes);
+// power e of a DynamicCtxtPowers table, counting the powers it had to compute for it
+helib::Ctxt& GetPower(helib::DynamicCtxtPowers& powers, long e);
+
+template<typename... Args>
+void MultByConstant(helib::Ctxt& a, Args&&... args){
+    CountOp(HE_PTXT_MULT);
+    a.multByConstant(forward<Args>(args)...);
+}
+
+template<typename... Args>
+void AddConstant(helib::Ctxt& a, Args&&... args){
+    CountOp(HE_ADD);
+    a.addConstant(forward<Args>(args)...);
+}
+
+}
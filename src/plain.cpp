@@ -0,0 +1,159 @@
+#include "plain.hpp"
+
+#include <array>
+#include <stdexcept>
+#include <string>
+
+// one instruction where the target has it (plain.cpp is built with -mpopcnt when the compiler supports it)
+static inline long popcount(uint64_t x){
+    return __builtin_popcountll(x);
+}
+
+PlainEngine::PlainEngine(long _rows, shared_ptr<const vector<PackedColumn>> _columns) : rows(_rows), columns(_columns){
+    for (const PackedColumn& col : *columns){
+        if ((long)col.low.size() != Words() || (long)col.high.size() != Words()){
+            throw invalid_argument("ERROR: packed columns must hold " + to_string(Words()) + " words");
+        }
+    }
+}
+
+PlainEngine PlainEngine::FromDB(const vector<vector<unsigned long>>& db){
+    long num_rows = db.empty() ? 0 : db[0].size();
+    long words = (num_rows + 63) / 64;
+    auto packed = make_shared<vector<PackedColumn>>(db.size());
+    for (size_t col = 0; col < db.size(); col++){
+        if ((long)db[col].size() != num_rows){
+            throw invalid_argument("ERROR: all columns must have the same number of rows");
+        }
+        PackedColumn& column = (*packed)[col];
+        column.low = vector<uint64_t>(words, 0);
+        column.high = vector<uint64_t>(words, 0);
+        for (long row = 0; row < num_rows; row++){
+            unsigned long value = db[col][row];
+            if (value > 3){
+                throw invalid_argument("ERROR: the plaintext engine only stores genotypes 0..3");
+            }
+            column.low[row / 64] |= (uint64_t)(value & 1) << (row % 64);
+            column.high[row / 64] |= (uint64_t)(value >> 1) << (row % 64);
+        }
+    }
+    return PlainEngine(num_rows, packed);
+}
+
+const PackedColumn& PlainEngine::Column(int col) const{
+    if (col < 0 || col >= Columns()){
+        throw invalid_argument("ERROR: column " + to_string(col) + " does not exist");
+    }
+    return (*columns)[col];
+}
+
+unsigned long PlainEngine::Genotype(int col, long row) const{
+    const PackedColumn& column = Column(col);
+    return ((column.low[row / 64] >> (row % 64)) & 1) | (((column.high[row / 64] >> (row % 64)) & 1) << 1);
+}
+
+uint64_t PlainEngine::ValidMask(long w) const{
+    long valid = rows - w * 64;
+    return valid >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << valid) - 1;
+}
+
+uint64_t PlainEngine::Equals(int col, int value, long w) const{
+    const PackedColumn& column = (*columns)[col];
+    uint64_t low = column.low[w], high = column.high[w];
+    switch (value){
+        case 0: return ~(low | high) & ValidMask(w);
+        case 1: return low & ~high;
+        case 2: return high & ~low;
+        case 3: return low & high;
+        default: return 0;
+    }
+}
+
+uint64_t PlainEngine::Filter(bool conjunctive, const vector<pair<int, int>>& query, long w) const{
+    uint64_t match = conjunctive ? ValidMask(w) : 0;
+    for (const auto& predicate : query){
+        uint64_t equal = Equals(predicate.first, predicate.second, w);
+        match = conjunctive ? match & equal : match | equal;
+    }
+    return match;
+}
+
+long PlainEngine::CountingQuery(bool conjunctive, const vector<pair<int, int>>& query) const{
+    for (const auto& predicate : query){
+        Column(predicate.first);
+    }
+    long count = 0;
+    for (long w = 0; w < Words(); w++){
+        count += popcount(Filter(conjunctive, query, w));
+    }
+    return count;
+}
+
+pair<long, long> PlainEngine::MAFQuery(int snp, bool conjunctive, const vector<pair<int, int>>& query) const{
+    for (const auto& predicate : query){
+        Column(predicate.first);
+    }
+    const PackedColumn& target = Column(snp);
+    long alleles = 0, matches = 0;
+    for (long w = 0; w < Words(); w++){
+        uint64_t match = Filter(conjunctive, query, w);
+        alleles += popcount(match & target.low[w]) + 2 * popcount(match & target.high[w]);
+        matches += popcount(match);
+    }
+    return pair(alleles, 2 * matches);
+}
+
+vector<long> PlainEngine::DistrubtionQuery(const vector<pair<int, int>>& prs_params) const{
+    vector<long> scores(rows, 0);
+    // column by column, adding the weight for every set bit, so each plane is read once and in order
+    for (const auto& param : prs_params){
+        const PackedColumn& column = Column(param.first);
+        long weight = param.second;
+        for (long w = 0; w < Words(); w++){
+            for (uint64_t bits = column.low[w]; bits; bits &= bits - 1){
+                scores[w * 64 + __builtin_ctzll(bits)] += weight;
+            }
+            for (uint64_t bits = column.high[w]; bits; bits &= bits - 1){
+                scores[w * 64 + __builtin_ctzll(bits)] += 2 * weight;
+            }
+        }
+    }
+    return scores;
+}
+
+pair<long, long> PlainEngine::SimilarityQuery(int target_column, const vector<unsigned long>& d, int threshold) const{
+    const PackedColumn& target = Column(target_column);
+    // (g - d_i)^2 for each genotype g, per column
+    vector<array<long, 4>> distance(d.size());
+    for (size_t i = 0; i < d.size(); i++){
+        Column(i);
+        for (long g = 0; g < 4; g++){
+            distance[i][g] = (g - (long)d[i]) * (g - (long)d[i]);
+        }
+    }
+
+    long with = 0, without = 0;
+    long scores[64];
+    for (long w = 0; w < Words(); w++){
+        // the 64 scores of a word stay in registers / L1 while the columns stream past
+        for (int b = 0; b < 64; b++){
+            scores[b] = 0;
+        }
+        for (size_t i = 0; i < d.size(); i++){
+            uint64_t low = (*columns)[i].low[w], high = (*columns)[i].high[w];
+            const array<long, 4>& table = distance[i];
+            for (int b = 0; b < 64; b++){
+                scores[b] += table[((low >> b) & 1) | (((high >> b) & 1) << 1)];
+            }
+        }
+        uint64_t below = 0;
+        for (int b = 0; b < 64; b++){
+            below |= (uint64_t)(scores[b] < threshold) << b;
+        }
+        below &= ValidMask(w);
+        uint64_t above = ~below & ValidMask(w);
+        with += popcount(below & target.low[w]) + 2 * popcount(below & target.high[w]);
+        without += popcount(above & target.low[w]) + 2 * popcount(above & target.high[w]);
+    }
+    return pair(with, without);
+}
@@ -0,0 +1,54 @@
+/*
+Plaintext reference engine: every Server query over genotypes stored as two bit planes per column (bit 0 and bit 1
+of each genotype, 64 rows per word), so a predicate on a column is a few word operations and a count is a
+popcount. It gives the ground truth to check decrypted results against and the plaintext baseline of the
+benchmarks. Results are exact; the encrypted ones are the same modulo p
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// genotypes 0..3 of one column; rows past the last one are 0
+struct PackedColumn{
+    vector<uint64_t> low;
+    vector<uint64_t> high;
+};
+
+class PlainEngine{
+public:
+    // columns are shared, not copied, so an engine over a large cohort is cheap to make
+    PlainEngine(long rows, shared_ptr<const vector<PackedColumn>> columns);
+    // from a DB as SetData takes it (columns of rows); values must be genotypes
+    static PlainEngine FromDB(const vector<vector<unsigned long>>& db);
+
+    long Rows() const { return rows; }
+    int Columns() const { return columns->size(); }
+    unsigned long Genotype(int col, long row) const;
+
+    // as the Server queries, summed over all rows instead of squashed
+    long CountingQuery(bool conjunctive, const vector<pair<int, int>>& query) const;
+    pair<long, long> MAFQuery(int snp, bool conjunctive, const vector<pair<int, int>>& query) const;
+    // the score of every row
+    vector<long> DistrubtionQuery(const vector<pair<int, int>>& prs_params) const;
+    // d holds one genotype per column 0..d.size()-1
+    pair<long, long> SimilarityQuery(int target_column, const vector<unsigned long>& d, int threshold) const;
+
+private:
+    long Words() const { return (rows + 63) / 64; }
+    // rows of word w that exist
+    uint64_t ValidMask(long w) const;
+    // rows of word w whose genotype in col equals value
+    uint64_t Equals(int col, int value, long w) const;
+    // rows of word w that match the query
+    uint64_t Filter(bool conjunctive, const vector<pair<int, int>>& query, long w) const;
+    const PackedColumn& Column(int col) const;
+
+    long rows;
+    shared_ptr<const vector<PackedColumn>> columns;
+};
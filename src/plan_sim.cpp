@@ -0,0 +1,141 @@
+/*
+plan_sim: predicts, without encrypting anything, the capacity a query's result keeps for a set of BGV
+parameters, and searches the largest predicate count or the smallest modulus chain that still decrypts
+
+usage: plan_sim [--query counting|maf|distribution|similarity] [--predicates N] [--disjunctive] [--rows N]
+                [--masked] [--squash N] [--input-bits B] [--m N] [--p N] [--bits N]
+                [--fresh-bits B] [--floor-bits B] [--max-predicates] [--min-bits] [--json]
+
+--input-bits is the capacity of the stored blocks (QueryNoise::input_bits of a real run, 0 = fresh);
+--squash defaults to min(rows, slots), the slots the server squashes;
+--fresh-bits and --floor-bits override the estimated noise of a fresh ciphertext and of a mod-switch
+*/
+
+#include <iostream>
+#include <string>
+
+#include "server.hpp"
+#include "simulator.hpp"
+
+using namespace std;
+
+struct PlanOptions{
+    QueryShape shape;
+    unsigned long m = constants::M;
+    unsigned long p = constants::P;
+    unsigned long bits = constants::BITS;
+    double fresh_bits = 0;
+    double floor_bits = 0;
+    bool max_predicates = false;
+    bool min_bits = false;
+    bool json = false;
+};
+
+// largest values the searches try
+static const int MAX_PREDICATES = 4096;
+static const unsigned long MAX_BITS = 4096;
+
+static PlanOptions parse_options(int argc, char* argv[]){
+    PlanOptions options;
+    for (int i = 1; i < argc; i++){
+        string arg = argv[i];
+        auto value = [&](){
+            if (i + 1 >= argc){
+                throw invalid_argument("ERROR: missing value for " + arg);
+            }
+            return string(argv[++i]);
+        };
+
+        if (arg == "--query") options.shape.query = value();
+        else if (arg == "--predicates") options.shape.predicates = stoi(value());
+        else if (arg == "--disjunctive") options.shape.conjunctive = false;
+        else if (arg == "--rows") options.shape.rows = stol(value());
+        else if (arg == "--masked") options.shape.masked = true;
+        else if (arg == "--squash") options.shape.squash = stoi(value());
+        else if (arg == "--input-bits") options.shape.input_bits = stod(value());
+        else if (arg == "--m") options.m = stoul(value());
+        else if (arg == "--p") options.p = stoul(value());
+        else if (arg == "--bits") options.bits = stoul(value());
+        else if (arg == "--fresh-bits") options.fresh_bits = stod(value());
+        else if (arg == "--floor-bits") options.floor_bits = stod(value());
+        else if (arg == "--max-predicates") options.max_predicates = true;
+        else if (arg == "--min-bits") options.min_bits = true;
+        else if (arg == "--json") options.json = true;
+        else throw invalid_argument("ERROR: unknown option " + arg);
+    }
+    return options;
+}
+
+static NoiseParams noise_params(const PlanOptions& options, unsigned long bits){
+    NoiseParams params = NoiseParams::FromContext(options.m, options.p, bits);
+    if (options.fresh_bits > 0){
+        params.fresh_bits = options.fresh_bits;
+    }
+    if (options.floor_bits > 0){
+        params.floor_bits = options.floor_bits;
+        params.key_switch_bits = options.floor_bits;
+    }
+    return params;
+}
+
+int main(int argc, char* argv[]){
+    PlanOptions options;
+    SimResult result;
+    NoiseParams params;
+    try{
+        options = parse_options(argc, argv);
+        params = noise_params(options, options.bits);
+
+        if (options.min_bits){
+            // capacity only grows with the chain, so the first chain that decrypts is the smallest
+            unsigned long bits = 0;
+            do{
+                bits += 10;
+                params = noise_params(options, bits);
+                result = SimulateQuery(params, options.shape, NOISE_THRES);
+            } while (!result.decrypts && bits < MAX_BITS);
+        }
+        else if (options.max_predicates){
+            // deeper conjunctions only lose capacity, so search upwards until one fails
+            QueryShape shape = options.shape;
+            shape.predicates = 1;
+            result = SimulateQuery(params, shape, NOISE_THRES);
+            while (result.decrypts && shape.predicates < MAX_PREDICATES){
+                shape.predicates++;
+                SimResult next = SimulateQuery(params, shape, NOISE_THRES);
+                if (!next.decrypts){
+                    break;
+                }
+                result = next;
+            }
+        }
+        else{
+            result = SimulateQuery(params, options.shape, NOISE_THRES);
+        }
+    }
+    catch (const exception& e){
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    if (options.json){
+        cout << "{\"params\": {\"m\": " << params.m << ", \"p\": " << params.p << ", \"bits\": " << params.q_bits
+             << ", \"slots\": " << params.slots << ", \"fresh_bits\": " << params.fresh_bits << ", \"floor_bits\": "
+             << params.floor_bits << "}, \"result\": ";
+        result.WriteJSON(cout);
+        cout << "}" << endl;
+    }
+    else{
+        params.Print(cout);
+        result.Print(cout);
+        if (options.max_predicates){
+            cout << (result.decrypts ? "largest predicate count that decrypts: " + to_string(result.shape.predicates)
+                                     : string("no predicate count decrypts")) << endl;
+        }
+        if (options.min_bits){
+            cout << (result.decrypts ? "smallest chain that decrypts: " + to_string((long)params.q_bits) + " bits"
+                                     : string("no chain up to ") + to_string(MAX_BITS) + " bits decrypts") << endl;
+        }
+    }
+    return result.decrypts ? 0 : 2;
+}
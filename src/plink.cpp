@@ -0,0 +1,119 @@
+#include "plink.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+// .bed magic number followed by the SNP-major mode byte
+static const unsigned char BED_MAGIC[3] = {0x6c, 0x1b, 0x01};
+
+// 2-bit codes, low bits first: 00 = A1/A1, 01 = missing, 10 = A1/A2, 11 = A2/A2
+static const unsigned char CODE_TO_COUNT[4] = {2, 0, 1, 0};
+
+// four genotypes per .bed byte, expanded once so the inner loop is a table lookup and a 4-byte copy
+struct ByteTable{
+    unsigned char values[256][4];
+
+    ByteTable(){
+        for (int b = 0; b < 256; b++){
+            for (int k = 0; k < 4; k++){
+                values[b][k] = CODE_TO_COUNT[(b >> (2 * k)) & 3];
+            }
+        }
+    }
+};
+static const ByteTable BYTE_TABLE;
+
+static int count_lines(const string& path){
+    ifstream in(path);
+    if (!in){
+        throw invalid_argument("ERROR: cannot open " + path);
+    }
+    int lines = 0;
+    string line;
+    while (getline(in, line)){
+        if (!line.empty()){
+            lines++;
+        }
+    }
+    return lines;
+}
+
+PlinkBed::PlinkBed(const string& prefix){
+    num_samples = count_lines(prefix + ".fam");
+
+    ifstream bim(prefix + ".bim");
+    if (!bim){
+        throw invalid_argument("ERROR: cannot open " + prefix + ".bim");
+    }
+    string chrom, id;
+    string line;
+    while (getline(bim, line)){
+        if (line.empty()){
+            continue;
+        }
+        istringstream fields(line);
+        fields >> chrom >> id;
+        snp_ids.push_back(id);
+    }
+
+    bed = unique_ptr<MappedFile>(new MappedFile(prefix + ".bed"));
+    if (bed->size() < sizeof(BED_MAGIC) || memcmp(bed->data(), BED_MAGIC, sizeof(BED_MAGIC)) != 0){
+        throw invalid_argument("ERROR: " + prefix + ".bed is not a SNP-major PLINK .bed file");
+    }
+
+    bytes_per_snp = (num_samples + 3) / 4;
+    if (bed->size() != sizeof(BED_MAGIC) + bytes_per_snp * snp_ids.size()){
+        throw invalid_argument("ERROR: " + prefix + ".bed size does not match .bim/.fam");
+    }
+    genotypes = reinterpret_cast<const unsigned char*>(bed->data()) + sizeof(BED_MAGIC);
+}
+
+int PlinkBed::NumSamples() const{
+    return num_samples;
+}
+
+int PlinkBed::NumSnps() const{
+    return snp_ids.size();
+}
+
+const vector<string>& PlinkBed::SnpIds() const{
+    return snp_ids;
+}
+
+void PlinkBed::Decode(int snp, int first, int count, unsigned char* out) const{
+    const unsigned char* row = genotypes + snp * bytes_per_snp;
+    int k = 0;
+
+    // leading samples that share a byte with the previous block
+    for (; k < count && ((first + k) & 3) != 0; k++){
+        int sample = first + k;
+        out[k] = CODE_TO_COUNT[(row[sample >> 2] >> (2 * (sample & 3))) & 3];
+    }
+
+    // whole bytes
+    const unsigned char* byte = row + ((first + k) >> 2);
+    for (; k + 4 <= count; k += 4, byte++){
+        memcpy(out + k, BYTE_TABLE.values[*byte], 4);
+    }
+
+    // trailing samples
+    for (; k < count; k++){
+        int sample = first + k;
+        out[k] = CODE_TO_COUNT[(row[sample >> 2] >> (2 * (sample & 3))) & 3];
+    }
+}
+
+void PlinkBed::Decode(int snp, int first, int count, helib::Ptxt<helib::BGV>& ptxt) const{
+    // decode a cache-sized chunk at a time, then fill the slots
+    const int chunk = 4096;
+    unsigned char values[chunk];
+    for (int start = 0; start < count; start += chunk){
+        int n = min(chunk, count - start);
+        Decode(snp, first + start, n, values);
+        for (int k = 0; k < n; k++){
+            ptxt[start + k] = values[k];
+        }
+    }
+}
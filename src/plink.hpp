@@ -0,0 +1,35 @@
+/*
+PLINK binary fileset (.bed/.bim/.fam) reader: genotypes are decoded from the memory-mapped .bed file
+*/
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <helib/helib.h>
+#include "io.hpp"
+
+using namespace std;
+
+class PlinkBed{
+public:
+    // prefix of the fileset, e.g. "cohort" for cohort.bed, cohort.bim and cohort.fam
+    PlinkBed(const string& prefix);
+
+    int NumSamples() const;
+    int NumSnps() const;
+    const vector<string>& SnpIds() const;
+
+    // writes the A1 allele counts (0/1/2, missing = 0) of samples [first, first + count) of snp into slots 0..count-1
+    void Decode(int snp, int first, int count, helib::Ptxt<helib::BGV>& ptxt) const;
+    void Decode(int snp, int first, int count, unsigned char* out) const;
+
+private:
+    unique_ptr<MappedFile> bed;
+    const unsigned char* genotypes;
+    size_t bytes_per_snp;
+
+    int num_samples;
+    vector<string> snp_ids;
+};
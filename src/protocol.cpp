@@ -0,0 +1,264 @@
+#include "protocol.hpp"
+#include "globals.hpp"
+#include "io.hpp"
+#include "server.hpp"
+
+#include <chrono>
+#include <iterator>
+#include <stdexcept>
+
+static double seconds_since(chrono::steady_clock::time_point start){
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static void write_ctxts(ostream& out, const vector<helib::Ctxt>& ctxts){
+    write_u64(out, ctxts.size());
+    for (const helib::Ctxt& ctxt : ctxts){
+        ctxt.writeTo(out);
+    }
+}
+
+// max_count guards the loop against a count no frame could hold
+static vector<helib::Ctxt> read_ctxts(istream& in, const helib::PubKey& public_key, uint64_t max_count){
+    vector<helib::Ctxt> ctxts;
+    uint64_t count = read_u64(in);
+    if (count > max_count){
+        throw invalid_argument("ERROR: " + to_string(count) + " ciphertexts in a message that holds at most " + to_string(max_count));
+    }
+    for (uint64_t i = 0; i < count; i++){
+        ctxts.push_back(helib::Ctxt::readFrom(in, public_key));
+    }
+    return ctxts;
+}
+
+static int read_column(istream& in, int num_cols){
+    uint64_t col = read_u64(in);
+    if (col >= (uint64_t)num_cols){
+        throw invalid_argument("ERROR: column " + to_string(col) + " is outside the DB's " + to_string(num_cols) + " columns");
+    }
+    return (int)col;
+}
+
+static int read_value(istream& in, long p){
+    uint64_t value = read_u64(in);
+    if (value >= (uint64_t)p){
+        throw invalid_argument("ERROR: value " + to_string(value) + " is outside [0, " + to_string(p) + ")");
+    }
+    return (int)value;
+}
+
+void SendRequest(Connection& connection, const QueryRequest& request){
+    ostream& out = connection.BeginFrame(request.type);
+    out.put(request.conjunctive ? 1 : 0);
+    write_u64(out, request.column);
+    write_u64(out, request.threshold);
+    write_u64(out, request.predicates.size());
+    for (const auto& predicate : request.predicates){
+        write_u64(out, predicate.first);
+        write_u64(out, predicate.second);
+    }
+    write_ctxts(out, request.ciphertexts);
+    write_u64(out, request.seeded.size());
+    for (const SeededCtxt& seeded : request.seeded){
+        seeded.writeTo(out);
+    }
+    connection.EndFrame();
+}
+
+QueryRequest ReadRequest(istream& in, uint32_t type, const helib::PubKey& public_key, int num_cols){
+    if (type < MSG_COUNTING_QUERY || type > MSG_SIMILARITY_QUERY){
+        throw invalid_argument("ERROR: unexpected message type " + to_string(type));
+    }
+    long p = public_key.getPtxtSpace();
+    QueryRequest request;
+    request.type = (MessageType)type;
+    request.conjunctive = in.get() == 1;
+    // the column only means something to MAFQuery and SimilarityQuery
+    uint64_t column = read_u64(in);
+    request.threshold = read_value(in, p);
+    uint64_t predicates = read_u64(in);
+    if (predicates > (uint64_t)MAX_REQUEST_PREDICATES){
+        throw invalid_argument("ERROR: " + to_string(predicates) + " predicates, at most " + to_string(MAX_REQUEST_PREDICATES) + " are accepted");
+    }
+    for (uint64_t i = 0; i < predicates; i++){
+        int col = read_column(in, num_cols);
+        int value = read_value(in, p);
+        request.predicates.push_back(pair(col, value));
+    }
+    // SimilarityQuery compares d with the leading columns of the DB
+    request.ciphertexts = read_ctxts(in, public_key, num_cols);
+    uint64_t seeded = read_u64(in);
+    if (seeded > (uint64_t)num_cols){
+        throw invalid_argument("ERROR: " + to_string(seeded) + " seeded ciphertexts in a message that holds at most " + to_string(num_cols));
+    }
+    for (uint64_t i = 0; i < seeded; i++){
+        request.seeded.push_back(SeededCtxt::readFrom(in));
+    }
+
+    if (type == MSG_SIMILARITY_QUERY){
+        if (request.ciphertexts.empty() && request.seeded.empty()){
+            throw invalid_argument("ERROR: a similarity query needs at least one genotype");
+        }
+        if (!request.ciphertexts.empty() && !request.seeded.empty()){
+            throw invalid_argument("ERROR: a similarity query sends its genotypes either all in full or all seeded");
+        }
+    }
+    else if (request.predicates.empty()){
+        throw invalid_argument("ERROR: a query needs at least one predicate");
+    }
+    if (type == MSG_MAF_QUERY || type == MSG_SIMILARITY_QUERY){
+        if (column >= (uint64_t)num_cols){
+            throw invalid_argument("ERROR: column " + to_string(column) + " is outside the DB's " + to_string(num_cols) + " columns");
+        }
+        request.column = (int)column;
+    }
+    return request;
+}
+
+void SendResponse(Connection& connection, QueryResponse& response){
+    double waited_s = connection.Stats().send_s;
+    auto start = chrono::steady_clock::now();
+    ostream& out = connection.BeginFrame(MSG_RESULT);
+    write_ctxts(out, response.results);
+    response.serialize_s += seconds_since(start) - (connection.Stats().send_s - waited_s);
+    write_double(out, response.compute_s);
+    write_double(out, response.serialize_s);
+    connection.EndFrame();
+}
+
+QueryResponse ReadResponse(istream& in, uint32_t type, const helib::PubKey& public_key){
+    if (type == MSG_ERROR){
+        throw runtime_error(string(istreambuf_iterator<char>(in), istreambuf_iterator<char>()));
+    }
+    if (type != MSG_RESULT){
+        throw runtime_error("ERROR: unexpected message type " + to_string(type));
+    }
+    QueryResponse response;
+    response.results = read_ctxts(in, public_key, MAX_RESPONSE_CTXTS);
+    response.compute_s = read_double(in);
+    response.serialize_s = read_double(in);
+    return response;
+}
+
+void QueryLatency::Print(ostream& out) const{
+    const double ms = 1e3;
+    out << query << ": " << total_s * ms << " ms = compute " << compute_s * ms << " ms + serialization " << serialize_s * ms
+        << " ms + transport " << transport_s * ms << " ms + client crypto " << client_crypto_s * ms << " ms ("
+        << request_bytes << " bytes out, " << response_bytes << " bytes back)" << endl;
+}
+
+void QueryLatency::WriteJSON(ostream& out) const{
+    out << "{\"query\": \"" << query << "\", \"total_s\": " << total_s << ", \"compute_s\": " << compute_s
+        << ", \"serialize_s\": " << serialize_s << ", \"transport_s\": " << transport_s << ", \"client_crypto_s\": "
+        << client_crypto_s << ", \"request_bytes\": " << request_bytes << ", \"response_bytes\": " << response_bytes << "}";
+}
+
+QueryService::QueryService(Server& _server) : server(_server){
+    // a client's ciphertext may have up to twice the parts of a fresh one
+    ctxt_bytes = 2 * serialized_size(server.Encrypt(0UL));
+}
+
+size_t QueryService::RequestFrameBytes(){
+    return constants::REQUEST_FRAME_OVERHEAD + server.GetNumCols() * ctxt_bytes;
+}
+
+helib::PubKey QueryService::ReceivePublicKey(Connection& connection, const helib::Context& context){
+    connection.SetMaxFrameBytes(constants::MAX_KEY_FRAME_BYTES);
+    uint32_t type;
+    istream* in = connection.NextFrame(type);
+    if (!in || type != MSG_PUBLIC_KEY){
+        throw runtime_error("ERROR: a session has to start with the client's public key");
+    }
+    helib::PubKey public_key = helib::PubKey::readFrom(*in, context);
+    connection.ReleaseFrame();
+    return public_key;
+}
+
+QueryResponse QueryService::Answer(QueryRequest& request){
+    QueryResponse response;
+    switch (request.type){
+        case MSG_COUNTING_QUERY:
+            response.results.push_back(server.CountingQuery(request.conjunctive, request.predicates));
+            break;
+        case MSG_MAF_QUERY:{
+            pair<helib::Ctxt, helib::Ctxt> result = server.MAFQuery(request.column, request.conjunctive, request.predicates);
+            response.results.push_back(move(result.first));
+            response.results.push_back(move(result.second));
+            break;
+        }
+        case MSG_DISTRIBUTION_QUERY:
+            response.results = server.DistrubtionQuery(request.predicates);
+            break;
+        case MSG_SIMILARITY_QUERY:{
+            pair<helib::Ctxt, helib::Ctxt> result = request.seeded.empty() ? server.SimilarityQuery(request.column, request.ciphertexts, request.threshold)
+                                                                           : server.SimilarityQuery(request.column, request.seeded, request.threshold);
+            response.results.push_back(move(result.first));
+            response.results.push_back(move(result.second));
+            break;
+        }
+        default:
+            throw invalid_argument("ERROR: unexpected message type " + to_string(request.type));
+    }
+    return response;
+}
+
+// false if the peer cannot be reached any more
+static bool send_error(Connection& connection, const string& message){
+    try{
+        Frame reply;
+        reply.type = MSG_ERROR;
+        reply.payload = message;
+        connection.Send(reply);
+        return true;
+    }
+    catch (const exception&){
+        return false;
+    }
+}
+
+void QueryService::Serve(Connection& connection){
+    while (true){
+        connection.SetMaxFrameBytes(RequestFrameBytes());
+        uint32_t type;
+        istream* in;
+        try{
+            in = connection.NextFrame(type);
+        }
+        catch (const exception& e){
+            // an oversized or malformed frame leaves the stream out of step with the frames: report it and end
+            // the session
+            send_error(connection, e.what());
+            return;
+        }
+        if (!in || type == MSG_CLOSE){
+            return;
+        }
+        try{
+            // with shared memory the request is still arriving while it is decoded; that wait is transport time
+            double waited_s = connection.Stats().receive_s;
+            auto decode_start = chrono::steady_clock::now();
+            QueryRequest request = ReadRequest(*in, type, server.PublicKey(), server.GetNumCols());
+            connection.ReleaseFrame();
+            double decode_s = seconds_since(decode_start) - (connection.Stats().receive_s - waited_s);
+
+            auto compute_start = chrono::steady_clock::now();
+            QueryResponse response = Answer(request);
+            response.compute_s = seconds_since(compute_start);
+            response.serialize_s = decode_s;
+            SendResponse(connection, response);
+        }
+        catch (const exception& e){
+            // the rest of a bad request is skipped; if even that fails (a cut frame), the session ends
+            bool in_step = true;
+            try{
+                connection.ReleaseFrame();
+            }
+            catch (const exception&){
+                in_step = false;
+            }
+            if (!send_error(connection, e.what()) || !in_step){
+                return;
+            }
+        }
+    }
+}
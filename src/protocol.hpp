@@ -0,0 +1,107 @@
+/*
+Messages between a Client and a QueryService. A session starts with the client's public key (which carries the
+key-switching matrices the queries need); then every request frame is answered by one MSG_RESULT or MSG_ERROR
+frame, until MSG_CLOSE or the connection ends
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <helib/helib.h>
+#include "seeded.hpp"
+#include "transport.hpp"
+
+using namespace std;
+
+class Server;
+
+enum MessageType : uint32_t{
+    MSG_PUBLIC_KEY = 1,
+    MSG_COUNTING_QUERY,
+    MSG_MAF_QUERY,
+    MSG_DISTRIBUTION_QUERY,
+    MSG_SIMILARITY_QUERY,
+    MSG_RESULT,
+    MSG_ERROR,
+    MSG_CLOSE
+};
+
+// bounds on what a message may claim to hold, checked before anything is allocated for it
+const uint64_t MAX_REQUEST_PREDICATES = 1 << 16;
+const uint64_t MAX_RESPONSE_CTXTS = 1 << 24;
+
+struct QueryRequest{
+    MessageType type = MSG_COUNTING_QUERY;
+    bool conjunctive = true;
+    // MAFQuery: the SNP; SimilarityQuery: the target column
+    int column = 0;
+    int threshold = 0;
+    // the query's predicates, or the (column, weight) pairs of DistrubtionQuery
+    vector<pair<int, int>> predicates;
+    // SimilarityQuery: the encrypted genotypes of the individual, either in full or in seeded form
+    vector<helib::Ctxt> ciphertexts;
+    vector<SeededCtxt> seeded;
+};
+
+struct QueryResponse{
+    vector<helib::Ctxt> results;
+    // server side: the query itself, and decoding the request plus encoding this response
+    double compute_s = 0;
+    double serialize_s = 0;
+};
+
+// the Send functions write one whole frame straight into the connection; the Read functions parse the payload of
+// the frame NextFrame returned, in place
+void SendRequest(Connection& connection, const QueryRequest& request);
+// the request is checked against a DB of num_cols columns: columns in range, values and the threshold in [0, p),
+// at least one predicate (one genotype for SimilarityQuery), at most num_cols ciphertexts, all full or all seeded;
+// throws invalid_argument
+QueryRequest ReadRequest(istream& in, uint32_t type, const helib::PubKey& public_key, int num_cols);
+// serialize_s is measured while encoding (without the time spent waiting on the transport), and written after the results
+void SendResponse(Connection& connection, QueryResponse& response);
+// throws runtime_error with the server's message for a MSG_ERROR frame
+QueryResponse ReadResponse(istream& in, uint32_t type, const helib::PubKey& public_key);
+
+// where the time of one remote query went, as the client sees it
+struct QueryLatency{
+    string query;
+    double total_s = 0;
+    // encrypting the request and decrypting the results
+    double client_crypto_s = 0;
+    // encoding and decoding frames on both sides
+    double serialize_s = 0;
+    // the query on the server
+    double compute_s = 0;
+    // the rest: moving frames through the transport and waiting on it
+    double transport_s = 0;
+    size_t request_bytes = 0;
+    size_t response_bytes = 0;
+
+    void Print(ostream& out) const;
+    void WriteJSON(ostream& out) const;
+};
+
+// serves the requests of a Server that holds only the client's public key
+class QueryService{
+public:
+    QueryService(Server& server);
+
+    // answers requests until the client closes the session. A failed query is answered with MSG_ERROR; so is an
+    // oversized or malformed frame, which then ends the session, as the stream is out of step with the frames
+    void Serve(Connection& connection);
+
+    // first frame of a session, accepted up to MAX_KEY_FRAME_BYTES; requests are then limited by the DB's width
+    static helib::PubKey ReceivePublicKey(Connection& connection, const helib::Context& context);
+
+private:
+    QueryResponse Answer(QueryRequest& request);
+    // what a request can hold on the current DB: its fields and one ciphertext per column
+    size_t RequestFrameBytes();
+
+    Server& server;
+    size_t ctxt_bytes;
+};
@@ -0,0 +1,159 @@
+#include "seeded.hpp"
+#include "io.hpp"
+
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+// size of the PRNG seed of c1
+static const int SEED_BYTES = 32;
+// HElib writes a key handle (powerOfS, powerOfX, secretKeyID) before each part and an eye-catcher after the parts
+static const size_t HANDLE_BYTES = 24;
+static const size_t END_BYTES = 4;
+
+static string dcrt_bytes(const helib::DoubleCRT& dcrt){
+    ostringstream str(ios::binary);
+    dcrt.write(str);
+    return str.str();
+}
+
+// c1 is a deterministic function of the seed; the caller's random stream is left untouched
+static helib::DoubleCRT random_part(const helib::Context& context, const helib::IndexSet& primes, const string& seed){
+    helib::DoubleCRT part(context, primes);
+
+    NTL::RandomStreamPush push;
+    NTL::ZZ seed_zz = NTL::ZZFromBytes(reinterpret_cast<const unsigned char*>(seed.data()), seed.size());
+    part.randomize(&seed_zz);
+    return part;
+}
+
+void SeededCtxt::writeTo(ostream& str) const{
+    write_string(str, prefix);
+    write_string(str, seed);
+    write_string(str, suffix);
+    write_u64(str, primes.size());
+    for (long prime : primes){
+        write_u64(str, prime);
+    }
+}
+
+SeededCtxt SeededCtxt::readFrom(istream& str){
+    SeededCtxt seeded;
+    seeded.prefix = read_string(str);
+    seeded.seed = read_string(str);
+    seeded.suffix = read_string(str);
+    uint64_t num_primes = read_u64(str);
+    for (uint64_t i = 0; i < num_primes; i++){
+        seeded.primes.push_back(read_u64(str));
+    }
+    return seeded;
+}
+
+SeededEncryptor::SeededEncryptor(const helib::SecKey& secret_key, const helib::DoubleCRT& _key_poly): context(secret_key.getContext()), key_poly(_key_poly){
+    // a fresh ciphertext provides the metadata (prime set, noise bound, key handles) shared by all fresh encryptions;
+    // its plaintext fills every slot with the largest value, so the noise bound holds for any plaintext encrypted later
+    helib::Ptxt<helib::BGV> full(context);
+    for (long k = 0; k < full.size(); k++){
+        full[k] = context.getP() - 1;
+    }
+    helib::Ctxt fresh(secret_key);
+    secret_key.Encrypt(fresh, full);
+    primes = fresh.getPrimeSet();
+    key_poly.removePrimes(context.allPrimes() / primes);
+
+    ostringstream str(ios::binary);
+    fresh.writeTo(str);
+    string bytes = str.str();
+
+    // an unexpected size leaves the cut points empty, and RoundTrips fails
+    size_t part_bytes = dcrt_bytes(helib::DoubleCRT(context, primes)).size();
+    if (bytes.size() < 2 * part_bytes + HANDLE_BYTES + END_BYTES){
+        return;
+    }
+    size_t c1_start = bytes.size() - END_BYTES - part_bytes;
+    size_t c0_start = c1_start - HANDLE_BYTES - part_bytes;
+
+    head = bytes.substr(0, c0_start);
+    handle = bytes.substr(c0_start + part_bytes, HANDLE_BYTES);
+    suffix = bytes.substr(c1_start + part_bytes);
+}
+
+unique_ptr<SeededEncryptor> SeededEncryptor::Create(const helib::SecKey& secret_key, const helib::DoubleCRT& key_poly){
+    unique_ptr<SeededEncryptor> encryptor(new SeededEncryptor(secret_key, key_poly));
+    // the cut points rely on HElib's serialization layout, so check them once with a real round trip
+    if (!encryptor->RoundTrips(secret_key)){
+        return nullptr;
+    }
+    return encryptor;
+}
+
+bool SeededEncryptor::RoundTrips(const helib::SecKey& secret_key) const{
+    if (head.empty()){
+        return false;
+    }
+    helib::Ptxt<helib::BGV> probe(context);
+    for (long k = 0; k < probe.size(); k++){
+        probe[k] = k % context.getP();
+    }
+    try{
+        helib::Ptxt<helib::BGV> decrypted(context);
+        secret_key.Decrypt(decrypted, ExpandSeeded(Encrypt(probe), secret_key));
+        return decrypted == probe;
+    }
+    catch (const exception&){
+        // a misplaced cut fails to parse more often than it decrypts to garbage
+        return false;
+    }
+}
+
+SeededCtxt SeededEncryptor::Encrypt(const helib::Ptxt<helib::BGV>& ptxt) const{
+    SeededCtxt seeded;
+
+    random_device rd;
+    seeded.seed.resize(SEED_BYTES);
+    for (int i = 0; i < SEED_BYTES; i++){
+        seeded.seed[i] = static_cast<char>(rd());
+    }
+
+    helib::DoubleCRT c1 = random_part(context, primes, seeded.seed);
+
+    // c0 = m + p^r*e - c1*s
+    helib::DoubleCRT noise(context, primes);
+    noise.sampleGaussian(context.getStdev());
+    noise *= context.getPPowR();
+
+    helib::DoubleCRT c0(ptxt.getPolyRepr(), context, primes);
+    c0 += noise;
+
+    helib::DoubleCRT mask = c1;
+    mask *= key_poly;
+    c0 -= mask;
+
+    seeded.prefix = head + dcrt_bytes(c0) + handle;
+    seeded.suffix = suffix;
+    for (long i = primes.first(); i <= primes.last(); i = primes.next(i)){
+        seeded.primes.push_back(i);
+    }
+    return seeded;
+}
+
+helib::Ctxt ExpandSeeded(const SeededCtxt& seeded, const helib::PubKey& public_key){
+    const helib::Context& context = public_key.getContext();
+
+    // seeded ciphertexts also arrive from clients, so the primes are checked before anything is built over them
+    helib::IndexSet primes;
+    for (long prime : seeded.primes){
+        if (!context.getCtxtPrimes().contains(prime)){
+            throw invalid_argument("ERROR: prime " + to_string(prime) + " of a seeded ciphertext is not a ciphertext prime");
+        }
+        primes.insert(prime);
+    }
+    if (primes.card() == 0){
+        throw invalid_argument("ERROR: a seeded ciphertext needs at least one prime");
+    }
+
+    string bytes = seeded.prefix + dcrt_bytes(random_part(context, primes, seeded.seed)) + seeded.suffix;
+    MemoryBuffer buffer(bytes.data(), bytes.size());
+    istream str(&buffer);
+    return helib::Ctxt::readFrom(str, public_key);
+}
@@ -0,0 +1,58 @@
+/*
+Seeded ciphertexts: a fresh symmetric-key BGV ciphertext (c0, c1) with c0 + c1*s = m + p*e has a uniformly
+random c1, so it can be stored and sent as c0 plus the PRNG seed of c1, about half the size of the full ciphertext
+*/
+
+#pragma once
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <helib/helib.h>
+
+using namespace std;
+
+struct SeededCtxt{
+    // serialized ciphertext (HElib binary format) up to the random part c1
+    string prefix;
+    // seed c1 is regenerated from
+    string seed;
+    // serialized ciphertext after c1
+    string suffix;
+    // primes c1 is defined over
+    vector<long> primes;
+
+    bool empty() const { return prefix.empty(); }
+    size_t size() const { return prefix.size() + seed.size() + suffix.size() + primes.size() * sizeof(long); }
+
+    void writeTo(ostream& str) const;
+    static SeededCtxt readFrom(istream& str);
+};
+
+// Produces seeded ciphertexts; needs the secret key polynomial (the data owner's or the client's side)
+class SeededEncryptor{
+public:
+    // nullptr if this HElib's ciphertext serialization is not laid out the way seeded ciphertexts are cut from
+    static unique_ptr<SeededEncryptor> Create(const helib::SecKey& secret_key, const helib::DoubleCRT& key_poly);
+
+    SeededCtxt Encrypt(const helib::Ptxt<helib::BGV>& ptxt) const;
+
+private:
+    SeededEncryptor(const helib::SecKey& secret_key, const helib::DoubleCRT& key_poly);
+    // encrypts a probe, expands and decrypts it
+    bool RoundTrips(const helib::SecKey& secret_key) const;
+
+    const helib::Context& context;
+    helib::IndexSet primes;
+    // secret key polynomial over the ciphertext primes
+    helib::DoubleCRT key_poly;
+
+    // serialization of a fresh ciphertext, cut around c0 and c1: [head][c0][handle][c1][suffix]
+    string head;
+    string handle;
+    string suffix;
+};
+
+// Regenerates c1 from the seed; needs only the public key (the server's side). Throws invalid_argument for primes
+// that are not ciphertext primes of the key's context
+helib::Ctxt ExpandSeeded(const SeededCtxt& seeded, const helib::PubKey& public_key);
@@ -1,5 +1,23 @@
 #include "server.hpp"
+#include "arena.hpp"
+#include "cohort.hpp"
+#include "noise.hpp"
+#include "ops.hpp"
+#include "trace.hpp"
 #include "tools.hpp"
+#include "plink.hpp"
+#include "simulator.hpp"
+#include "vcf.hpp"
+#include "worker_pool.hpp"
+#include "io.hpp"
+#include <chrono>
+#include <cmath>
+#include <climits>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <fstream>
+#include <sstream>
 
 using namespace std;
 
@@ -9,6 +27,36 @@ using namespace std;
 
 // ------------------------------------------------------------------------------------------------------------------------
 
+// file format tag of SaveDB / LoadDB; version 2 added the column offset table at the end
+static const char DB_FILE_MAGIC[8] = {'P', 'I', 'R', 'D', 'B', '0', '0', '2'};
+static const char DB_FILE_MAGIC_V1[8] = {'P', 'I', 'R', 'D', 'B', '0', '0', '1'};
+
+// sum of ciphertexts added from several threads; the added ones go back to the adding thread's arena
+class CtxtSum{
+public:
+    void Add(helib::Ctxt&& ctxt){
+        {
+            lock_guard<mutex> guard(lock);
+            if (!sum){
+                sum = unique_ptr<helib::Ctxt>(new helib::Ctxt(move(ctxt)));
+                return;
+            }
+            counted::Add(*sum, ctxt);
+        }
+        CtxtArena::Local().Release(move(ctxt));
+    }
+
+    helib::Ctxt Result(){
+        if (!sum){
+            throw invalid_argument("ERROR: query over an empty DB");
+        }
+        return move(*sum);
+    }
+
+private:
+    mutex lock;
+    unique_ptr<helib::Ctxt> sum;
+};
 
 template<typename T, typename Allocator>
 void print_vector(const vector<T, Allocator>& vect, int num_entries)
@@ -20,261 +68,1572 @@ void print_vector(const vector<T, Allocator>& vect, int num_entries)
     cout << endl;
 }
 
-Server::Server(const helib::Context &context): secret_key(context), public_key(secret_key){
-    this->context = &context;
-        
-    secret_key.GenSecKey();
-    helib::addSome1DMatrices(secret_key);
-
-    const helib::EncryptedArray& ea = context.getEA();
-    num_slots = ea.size();
-    plaintext_modulus = context.getP();
+Server::Server(const helib::Context &context, int query_threads): secret_key(new helib::SecKey(context)), public_key(*secret_key), query_pool(query_threads){
+    this->context = &context;
+        
+    size_t heap_before_keys = HeapInUse();
+    // same as GenSecKey, but the key polynomial is kept for seeded encryption
+    helib::DoubleCRT key_poly(context, context.allPrimes());
+    double key_bound = key_poly.sampleSmallBounded();
+    secret_key->ImportSecKey(key_poly, key_bound);
+    helib::addSome1DMatrices(*secret_key);
+    key_bytes = HeapInUse() - heap_before_keys;
+    seeded_encryptor = SeededEncryptor::Create(*secret_key, key_poly);
+    if (!seeded_encryptor){
+        cerr << "WARNING: this HElib's ciphertext serialization does not support seeded ciphertexts, blocks are stored in full" << endl;
+    }
+    Init();
+}
+
+Server::Server(const helib::PubKey &_public_key, int query_threads): evaluation_key(new helib::PubKey(_public_key)), public_key(*evaluation_key), query_pool(query_threads){
+    this->context = &_public_key.getContext();
+    key_bytes = serialized_size(public_key);
+    Init();
+}
+
+void Server::Init(){
+    const helib::EncryptedArray& ea = context->getEA();
+    num_slots = ea.size();
+    plaintext_modulus = context->getP();
+
+    one_over_two = get_inverse(1,2,plaintext_modulus);
+
+    db_set = false;
+    comparator_ready = false;
+    comparator_bytes = 0;
+    max_profile_depth = 0;
+    compare_cost_bits = 0;
+    compare_seconds = 0;
+    running_queries = 0;
+    CalibrateNoise();
+}
+
+Server::~Server(){
+    try{
+        WaitForCompaction();
+    }
+    catch (const exception& e){
+        cerr << "WARNING: compaction failed: " << e.what() << endl;
+    }
+    CtxtArena::Forget(&public_key);
+}
+
+void Server::RequireSecretKey(const string& operation){
+    if (!secret_key){
+        throw invalid_argument("ERROR: " + operation + " needs the secret key, this server only holds the client's public key");
+    }
+}
+
+const he_cmp::Comparator& Server::GetComparator(){
+    call_once(comparator_once, [this](){
+        size_t heap_before = HeapInUse();
+        if (secret_key){
+            comparator = unique_ptr<he_cmp::Comparator>(new he_cmp::Comparator(*context, he_cmp::UNI, 1, 1, *secret_key, false, constants::COMPARATOR_CACHE_DIR));
+        }
+        else{
+            comparator = unique_ptr<he_cmp::Comparator>(new he_cmp::Comparator(*context, he_cmp::UNI, 1, 1, public_key, false, constants::COMPARATOR_CACHE_DIR));
+        }
+        size_t heap_after = HeapInUse();
+        comparator_bytes = heap_after > heap_before ? heap_after - heap_before : 0;
+        comparator_ready.store(true, memory_order_release);
+    });
+    return *comparator;
+}
+
+void Server::GenData(int _num_rows, int _num_cols){
+    // a synthetic cohort of _num_cols SNPs with the default frequencies and LD, generated block by block
+    CohortParams params;
+    params.rows = _num_rows;
+    params.snps = _num_cols;
+    params.phenotype = false;
+    params.keep_shadow = false;
+    SyntheticCohort cohort(params);
+    LoadBlocks(_num_rows, _num_cols, [&cohort](int col, int block, helib::Ptxt<helib::BGV>& ptxt){
+        cohort.Fill(col, block, ptxt);
+    });
+}
+
+void Server::SetData(vector<vector<unsigned long>> &db){
+    unique_lock<shared_mutex> lock(db_mutex);
+    num_cols = db.size();
+    if (num_cols == 0){
+        throw invalid_argument("ERROR: DB has zero columns! THIS DOES NOT WORK!");
+    }
+    
+    num_rows = db[0].size();
+    
+    num_compressed_rows = num_rows % num_slots == 0 ? num_rows / num_slots : (num_rows / num_slots) + 1;
+    
+    CloseDB();
+    encrypted_db = vector<vector<helib::Ctxt>>();
+    seeded_db = vector<vector<SeededCtxt>>();
+    column_expanded = vector<char>();
+    deleted_rows.clear();
+    row_masks.clear();
+    for(int i = 0; i < num_cols; i++){
+        AddSeededColumn();
+        for (int j = 0; j < num_compressed_rows; j++){
+            
+            helib::Ptxt<helib::BGV> ptxt(*context);
+            
+            int entries_left = min(num_slots, num_rows - (j * num_slots));
+            for (int k = 0; k < entries_left; k++){
+                ptxt[k] = db[i][j*num_slots + k];
+            }
+            
+            // blocks stay in seeded form until a query first touches the column
+            StoreBlock(i, j, ptxt);
+        }
+    }
+    if (num_compressed_rows > 0){
+        UpdateRowMask(num_compressed_rows - 1);
+    }
+
+    db_set = true;
+}
+
+void Server::AppendRows(vector<vector<unsigned long>> &rows){
+    unique_lock<shared_mutex> lock(db_mutex);
+    if (!db_set){
+        throw invalid_argument("ERROR: DB needs to be set to append rows");
+    }
+    RequireInMemory("AppendRows");
+    if ((int)rows.size() != num_cols){
+        throw invalid_argument("ERROR: appended rows need a value for every column");
+    }
+
+    // every column is checked before the first block is written, so a bad batch leaves the DB as it was
+    int new_rows = rows.empty() ? 0 : rows[0].size();
+    for (int i = 1; i < num_cols; i++){
+        if ((int)rows[i].size() != new_rows){
+            throw invalid_argument("ERROR: appended columns have different lengths");
+        }
+    }
+    if (new_rows == 0){
+        return;
+    }
+
+    // slots already used in the last block of every column
+    int used_slots = num_rows - (num_compressed_rows - 1) * num_slots;
+    int filled = min(num_slots - used_slots, new_rows);
+
+    int total_rows = num_rows + new_rows;
+    int total_compressed_rows = total_rows % num_slots == 0 ? total_rows / num_slots : (total_rows / num_slots) + 1;
+
+    for (int i = 0; i < num_cols; i++){
+        // the free slots of the last block are filled by adding an encryption that is zero everywhere
+        // except at the new rows' slot positions
+        if (filled > 0){
+            helib::Ptxt<helib::BGV> ptxt(*context);
+            for (int k = 0; k < filled; k++){
+                ptxt[used_slots + k] = rows[i][k];
+            }
+
+            helib::Ctxt ctxt(public_key);
+            public_key.Encrypt(ctxt, ptxt);
+            MutableBlock(i, num_compressed_rows - 1) += ctxt;
+        }
+
+        // remaining rows go to new blocks
+        for (int j = num_compressed_rows; j < total_compressed_rows; j++){
+            helib::Ptxt<helib::BGV> ptxt(*context);
+
+            int first = filled + (j - num_compressed_rows) * num_slots;
+            int entries_left = min(num_slots, new_rows - first);
+            for (int k = 0; k < entries_left; k++){
+                ptxt[k] = rows[i][first + k];
+            }
+
+            helib::Ctxt ctxt(public_key);
+            public_key.Encrypt(ctxt, ptxt);
+            LowerToStorageLevel(ctxt);
+            encrypted_db[i].push_back(ctxt);
+            seeded_db[i].push_back(SeededCtxt());
+        }
+    }
+
+    int old_last = num_compressed_rows - 1;
+    num_rows = total_rows;
+    num_compressed_rows = total_compressed_rows;
+    UpdateRowMask(old_last);
+    UpdateRowMask(num_compressed_rows - 1);
+}
+
+void Server::AddColumns(vector<vector<unsigned long>> &cols, vector<string> headers, int num_threads){
+    if (!headers.empty() && headers.size() != cols.size()){
+        throw invalid_argument("ERROR: new columns need one header each");
+    }
+    int rows_snapshot;
+    set<int> deleted_snapshot;
+    {
+        shared_lock<shared_mutex> lock(db_mutex);
+        if (!db_set){
+            throw invalid_argument("ERROR: DB needs to be set to add columns");
+        }
+        RequireInMemory("AddColumns");
+        rows_snapshot = num_rows;
+        deleted_snapshot = deleted_rows;
+    }
+
+    for (size_t i = 0; i < cols.size(); i++){
+        if ((int)cols[i].size() != rows_snapshot){
+            throw invalid_argument("ERROR: new columns need a value for every row");
+        }
+    }
+
+    // encryption runs without the DB lock, so queries keep being served meanwhile
+    int blocks = rows_snapshot % num_slots == 0 ? rows_snapshot / num_slots : (rows_snapshot / num_slots) + 1;
+    vector<vector<helib::Ctxt>> new_cols(cols.size(), vector<helib::Ctxt>(blocks, helib::Ctxt(public_key)));
+
+    WorkerPool pool(num_threads);
+    for (size_t i = 0; i < cols.size(); i++){
+        for (int j = 0; j < blocks; j++){
+            pool.Submit([this, &cols, &new_cols, &deleted_snapshot, rows_snapshot, i, j](){
+                helib::Ptxt<helib::BGV> ptxt(*context);
+
+                int entries_left = min(num_slots, rows_snapshot - (j * num_slots));
+                for (int k = 0; k < entries_left; k++){
+                    int row = j * num_slots + k;
+                    ptxt[k] = deleted_snapshot.count(row) ? 0 : cols[i][row];
+                }
+
+                public_key.Encrypt(new_cols[i][j], ptxt);
+            });
+        }
+    }
+    pool.Wait();
+
+    unique_lock<shared_mutex> lock(db_mutex);
+    if (num_rows != rows_snapshot || deleted_rows != deleted_snapshot){
+        throw runtime_error("ERROR: rows changed while columns were being added");
+    }
+    for (size_t i = 0; i < new_cols.size(); i++){
+        for (auto& ctxt : new_cols[i]){
+            LowerToStorageLevel(ctxt);
+        }
+        encrypted_db.push_back(move(new_cols[i]));
+        seeded_db.push_back(vector<SeededCtxt>(blocks));
+        column_expanded.push_back(1);
+        if (i < headers.size()){
+            column_headers.push_back(headers[i]);
+        }
+    }
+    num_cols += new_cols.size();
+}
+
+void Server::DeleteRow(int row){
+    unique_lock<shared_mutex> lock(db_mutex);
+    if (!db_set){
+        throw invalid_argument("ERROR: DB needs to be set to delete rows");
+    }
+    RequireInMemory("DeleteRow");
+    if (row < 0 || row >= num_rows){
+        throw invalid_argument("ERROR: row out of range");
+    }
+    if (deleted_rows.count(row)){
+        return;
+    }
+
+    // the row is zeroed in the stored blocks, at a constant multiplication's worth of capacity for the block
+    // (which InputCapacity then reports to the queries); filters still mask it, as EQTest(0) matches a zero
+    int block = row / num_slots;
+    NTL::ZZX mask = SlotMask(row % num_slots, false);
+    for (int i = 0; i < num_cols; i++){
+        counted::MultByConstant(MutableBlock(i, block), mask);
+    }
+    deleted_rows.insert(row);
+    UpdateRowMask(block);
+}
+
+void Server::StartCompaction(function<void(int, int)> moved){
+    WaitForCompaction();
+    {
+        shared_lock<shared_mutex> lock(db_mutex);
+        RequireInMemory("compaction");
+    }
+    compaction_thread = thread([this, moved](){
+        // one row per step, so the exclusive lock is only held for a few rotations at a time
+        try{
+            while (CompactStep(moved)){
+            }
+        }
+        catch (...){
+            compaction_error = current_exception();
+        }
+    });
+}
+
+void Server::WaitForCompaction(){
+    if (compaction_thread.joinable()){
+        compaction_thread.join();
+    }
+    if (compaction_error){
+        exception_ptr error = compaction_error;
+        compaction_error = nullptr;
+        rethrow_exception(error);
+    }
+}
+
+bool Server::CompactStep(const function<void(int, int)>& moved){
+    unique_lock<shared_mutex> lock(db_mutex);
+
+    // deleted rows are zero in the stored blocks, so the trimmed ones become the free slots AppendRows expects
+    TrimDeletedTail();
+    if (deleted_rows.empty()){
+        return false;
+    }
+
+    int hole = *deleted_rows.begin();
+    int last = num_rows - 1;
+    int hole_block = hole / num_slots;
+    int last_block = last / num_slots;
+    int hole_slot = hole % num_slots;
+    int last_slot = last % num_slots;
+
+    const helib::EncryptedArray& ea = context->getEA();
+    NTL::ZZX keep_last = SlotMask(last_slot, true);
+    NTL::ZZX clear_last = SlotMask(last_slot, false);
+
+    // the new blocks of every column are computed before any is stored, so a failed step leaves the DB as it was
+    CtxtArena& arena = CtxtArena::Local();
+    vector<helib::Ctxt> hole_blocks;
+    vector<helib::Ctxt> last_blocks;
+    for (int i = 0; i < num_cols; i++){
+        ColumnRef col = Column(i);
+        // isolate the last row, rotate it onto the hole (which DeleteRow zeroed) and clear its old slot
+        helib::Ctxt row = arena.Take((*col)[last_block]);
+        counted::MultByConstant(row, keep_last);
+        counted::Rotate(ea, row, hole_slot - last_slot);
+
+        helib::Ctxt hole_ctxt = arena.Take((*col)[hole_block]);
+        if (last_block == hole_block){
+            counted::MultByConstant(hole_ctxt, clear_last);
+        }
+        else{
+            helib::Ctxt last_ctxt = arena.Take((*col)[last_block]);
+            counted::MultByConstant(last_ctxt, clear_last);
+            last_blocks.push_back(move(last_ctxt));
+        }
+        counted::Add(hole_ctxt, row);
+        arena.Release(move(row));
+        hole_blocks.push_back(move(hole_ctxt));
+    }
+    for (int i = 0; i < num_cols; i++){
+        MutableBlock(i, hole_block) = move(hole_blocks[i]);
+        if (last_block != hole_block){
+            MutableBlock(i, last_block) = move(last_blocks[i]);
+        }
+    }
+
+    deleted_rows.erase(hole);
+    deleted_rows.insert(last);
+    UpdateRowMask(hole_block);
+    TrimDeletedTail();
+    if (moved){
+        moved(last, hole);
+    }
+    return true;
+}
+
+void Server::TrimDeletedTail(){
+    while (!deleted_rows.empty() && *deleted_rows.rbegin() == num_rows - 1){
+        deleted_rows.erase(num_rows - 1);
+        num_rows--;
+    }
+
+    int blocks = num_rows % num_slots == 0 ? num_rows / num_slots : (num_rows / num_slots) + 1;
+    if (blocks < num_compressed_rows){
+        for (int i = 0; i < num_cols; i++){
+            encrypted_db[i].resize(blocks, helib::Ctxt(public_key));
+            seeded_db[i].resize(blocks);
+        }
+        for (int j = blocks; j < num_compressed_rows; j++){
+            row_masks.erase(j);
+        }
+        num_compressed_rows = blocks;
+    }
+    if (num_compressed_rows > 0){
+        UpdateRowMask(num_compressed_rows - 1);
+    }
+}
+
+void Server::UpdateRowMask(int block){
+    // the free slots of the last block hold zeros, which predicates on genotype 0 would match
+    int used_slots = min(num_slots, num_rows - block * num_slots);
+    auto first = deleted_rows.lower_bound(block * num_slots);
+    if ((first == deleted_rows.end() || *first >= (block + 1) * num_slots) && used_slots == num_slots){
+        row_masks.erase(block);
+        return;
+    }
+
+    vector<long> mask(num_slots, 1);
+    for (int k = max(used_slots, 0); k < num_slots; k++){
+        mask[k] = 0;
+    }
+    for (auto it = first; it != deleted_rows.end() && *it < (block + 1) * num_slots; ++it){
+        mask[*it % num_slots] = 0;
+    }
+
+    NTL::ZZX poly;
+    context->getEA().encode(poly, mask);
+    row_masks[block] = poly;
+}
+
+NTL::ZZX Server::SlotMask(int slot, bool keep_only){
+    vector<long> mask(num_slots, keep_only ? 0 : 1);
+    mask[slot] = keep_only ? 1 : 0;
+
+    NTL::ZZX poly;
+    context->getEA().encode(poly, mask);
+    return poly;
+}
+
+void Server::ApplyRowMask(helib::Ctxt& ctxt, int block){
+    auto mask = row_masks.find(block);
+    if (mask != row_masks.end()){
+        counted::MultByConstant(ctxt, mask->second);
+    }
+}
+
+void Server::SetColumnHeaders(vector<string> &headers){
+    unique_lock<shared_mutex> lock(db_mutex);
+    column_headers = vector<string>();
+    for (int i = 0; i < headers.size(); i++){
+        column_headers.push_back(headers[i]);
+    }
+}
+
+void Server::SaveDB(const string& path){
+    shared_lock<shared_mutex> lock(db_mutex);
+    if (!db_set){
+        throw invalid_argument("ERROR: DB needs to be set to save it");
+    }
+    RequireInMemory("SaveDB");
+
+    // streamed into the temporary file, so the DB is never held twice in memory
+    bool written = write_file_atomic(path, [&](ostream& out){
+        out.write(DB_FILE_MAGIC, 8);
+        write_u64(out, num_rows);
+        write_u64(out, num_cols);
+        write_u64(out, num_slots);
+
+        write_u64(out, column_headers.size());
+        for (auto& header : column_headers){
+            write_string(out, header);
+        }
+        write_u64(out, deleted_rows.size());
+        for (int row : deleted_rows){
+            write_u64(out, row);
+        }
+
+        vector<uint64_t> offsets;
+        for (int i = 0; i < num_cols; i++){
+            offsets.push_back(out.tellp());
+            for (int j = 0; j < num_compressed_rows; j++){
+                if (!seeded_db[i][j].empty()){
+                    out.put(1);
+                    seeded_db[i][j].writeTo(out);
+                }
+                else{
+                    out.put(0);
+                    (*Column(i))[j].writeTo(out);
+                }
+            }
+        }
+        offsets.push_back(out.tellp());
+
+        // column offsets at the end, so that OpenDB can page single columns in: [offsets][position of offsets]
+        uint64_t table_position = out.tellp();
+        for (uint64_t offset : offsets){
+            write_u64(out, offset);
+        }
+        write_u64(out, table_position);
+    });
+    if (!written){
+        throw invalid_argument("ERROR: cannot write " + path);
+    }
+}
+
+void Server::LoadDB(const string& path){
+    MappedFile file(path);
+    MemoryBuffer buffer(file.data(), file.size());
+    istream in(&buffer);
+
+    WaitForCompaction();
+    unique_lock<shared_mutex> lock(db_mutex);
+
+    // the whole file is parsed before the current DB is replaced, so a bad file leaves it untouched
+    DBFileHeader header = ReadDBHeader(in, path);
+    int blocks = (header.num_rows + num_slots - 1) / num_slots;
+    vector<vector<helib::Ctxt>> columns(header.num_cols);
+    vector<vector<SeededCtxt>> seeded_columns(header.num_cols);
+    for (int i = 0; i < header.num_cols; i++){
+        columns[i] = vector<helib::Ctxt>(blocks, helib::Ctxt(public_key));
+        seeded_columns[i] = vector<SeededCtxt>(blocks);
+        for (int j = 0; j < blocks; j++){
+            if (in.get() == 1){
+                seeded_columns[i][j] = SeededCtxt::readFrom(in);
+            }
+            else{
+                columns[i][j] = helib::Ctxt::readFrom(in, public_key);
+                LowerToStorageLevel(columns[i][j]);
+            }
+        }
+    }
+
+    ApplyDBHeader(header);
+    for (int i = 0; i < header.num_cols; i++){
+        AddSeededColumn();
+        encrypted_db[i] = move(columns[i]);
+        seeded_db[i] = move(seeded_columns[i]);
+    }
+    num_cols = header.num_cols;
+
+    for (int row : deleted_rows){
+        UpdateRowMask(row / num_slots);
+    }
+    db_set = true;
+}
+
+void Server::OpenDB(const string& path, size_t memory_budget){
+    unique_ptr<MappedFile> file(new MappedFile(path));
+    MemoryBuffer buffer(file->data(), file->size());
+    istream in(&buffer);
+
+    WaitForCompaction();
+    unique_lock<shared_mutex> lock(db_mutex);
+
+    DBFileHeader header = ReadDBHeader(in, path);
+    if (header.version < 2){
+        throw invalid_argument("ERROR: " + path + " has no column offset table (version 1 DB file); LoadDB it and SaveDB it again to open it out-of-core");
+    }
+    uint64_t header_end = in.tellg();
+
+    // [columns][offsets][position of offsets]: every position comes from the file, so all of them are checked
+    // against it before a column is read through them
+    uint64_t size = file->size();
+    uint64_t table_bytes = ((uint64_t)header.num_cols + 1) * sizeof(uint64_t);
+    if (size < header_end + table_bytes + sizeof(uint64_t)){
+        throw invalid_argument("ERROR: " + path + " is truncated");
+    }
+    in.seekg(size - sizeof(uint64_t));
+    uint64_t table_position = read_u64(in);
+    if (table_position < header_end || table_position + table_bytes != size - sizeof(uint64_t)){
+        throw invalid_argument("ERROR: " + path + " has a corrupt column offset table");
+    }
+    in.seekg(table_position);
+    vector<uint64_t> offsets(header.num_cols + 1);
+    for (size_t i = 0; i < offsets.size(); i++){
+        offsets[i] = read_u64(in);
+        uint64_t previous = i == 0 ? header_end : offsets[i - 1];
+        if (offsets[i] < previous || offsets[i] > table_position){
+            throw invalid_argument("ERROR: " + path + " has a corrupt column offset table");
+        }
+    }
+
+    ApplyDBHeader(header);
+    column_offsets = move(offsets);
+    db_file = move(file);
+    column_cache = unique_ptr<ColumnCache>(new ColumnCache(memory_budget, [this](int col, size_t& bytes){
+        return ReadColumn(col, bytes);
+    }));
+    num_cols = header.num_cols;
+
+    for (int row : deleted_rows){
+        UpdateRowMask(row / num_slots);
+    }
+    db_set = true;
+}
+
+ColumnCacheStats Server::CacheStats(){
+    shared_lock<shared_mutex> lock(db_mutex);
+    if (!column_cache){
+        return ColumnCacheStats{0, 0, 0, 0, 0, 0};
+    }
+    return column_cache->Stats();
+}
+
+Server::DBFileHeader Server::ReadDBHeader(istream& in, const string& path){
+    DBFileHeader header;
+    char magic[8];
+    if (!in.read(magic, 8)){
+        throw invalid_argument("ERROR: " + path + " is not a DB file");
+    }
+    if (memcmp(magic, DB_FILE_MAGIC, 8) == 0){
+        header.version = 2;
+    }
+    else if (memcmp(magic, DB_FILE_MAGIC_V1, 8) == 0){
+        header.version = 1;
+    }
+    else{
+        throw invalid_argument("ERROR: " + path + " is not a DB file");
+    }
+
+    uint64_t rows = read_u64(in);
+    uint64_t cols = read_u64(in);
+    if (rows > (uint64_t)INT_MAX || cols > (uint64_t)INT_MAX){
+        throw invalid_argument("ERROR: " + path + " has a corrupt header");
+    }
+    if ((int)read_u64(in) != num_slots){
+        throw invalid_argument("ERROR: DB file was written with a different number of slots");
+    }
+    header.num_rows = rows;
+    header.num_cols = cols;
+
+    uint64_t num_headers = read_u64(in);
+    // each header takes at least its length field
+    if (num_headers > (uint64_t)in.rdbuf()->in_avail() / sizeof(uint64_t)){
+        throw invalid_argument("ERROR: " + path + " has a corrupt header");
+    }
+    header.column_headers = vector<string>(num_headers);
+    for (auto& column_header : header.column_headers){
+        column_header = read_string(in);
+    }
+    uint64_t num_deleted = read_u64(in);
+    for (uint64_t k = 0; k < num_deleted; k++){
+        uint64_t row = read_u64(in);
+        if (row >= rows){
+            throw invalid_argument("ERROR: " + path + " deletes row " + to_string(row) + " of " + to_string(rows));
+        }
+        header.deleted_rows.insert(row);
+    }
+    return header;
+}
+
+void Server::ApplyDBHeader(DBFileHeader& header){
+    BeginLoad(header.num_rows);
+    column_headers = move(header.column_headers);
+    deleted_rows = move(header.deleted_rows);
+}
+
+vector<helib::Ctxt> Server::ReadColumn(int col, size_t& bytes){
+    MemoryBuffer buffer(db_file->data() + column_offsets[col], column_offsets[col + 1] - column_offsets[col]);
+    istream in(&buffer);
+
+    vector<helib::Ctxt> column;
+    for (int j = 0; j < num_compressed_rows; j++){
+        if (in.get() == 1){
+            column.push_back(ExpandSeeded(SeededCtxt::readFrom(in), public_key));
+        }
+        else{
+            column.push_back(helib::Ctxt::readFrom(in, public_key));
+        }
+        LowerToStorageLevel(column.back());
+        // two parts, each a DoubleCRT of phi(m) 64-bit words per prime
+        bytes += 2 * column.back().getPrimeSet().card() * context->getPhiM() * sizeof(long);
+    }
+    return column;
+}
+
+void Server::CloseDB(){
+    // the cache goes first: its pending prefetches still read the file
+    column_cache.reset();
+    db_file.reset();
+    column_offsets.clear();
+}
+
+void Server::RequireInMemory(const string& operation){
+    if (column_cache){
+        throw invalid_argument("ERROR: " + operation + " needs the DB in memory, it was opened out-of-core");
+    }
+}
+
+void Server::PrefetchColumns(const vector<int>& cols){
+    if (column_cache){
+        column_cache->Prefetch(cols);
+    }
+}
+
+void Server::LoadVCF(const string& path, int num_threads){
+    unique_lock<shared_mutex> lock(db_mutex);
+
+    ifstream in(path);
+    if (!in){
+        throw invalid_argument("ERROR: cannot open VCF file " + path);
+    }
+
+    VCFReader reader(in);
+    if (reader.NumSamples() == 0){
+        throw invalid_argument("ERROR: VCF file has no samples");
+    }
+    BeginLoad(reader.NumSamples());
+
+    if (num_threads <= 0){
+        num_threads = max(1u, thread::hardware_concurrency());
+    }
+
+    // parsing is cheap next to encryption, so most threads encrypt; both queues are bounded,
+    // hence at most (queued + running) records and slot buffers are alive at any time
+    int parse_threads = max(1, num_threads / 4);
+    WorkerPool encrypt_pool(num_threads);
+    WorkerPool parse_pool(parse_threads);
+
+    string line;
+    int col = 0;
+    while (reader.NextRecord(line)){
+        parse_pool.Submit([this, &encrypt_pool, line = move(line), col](){
+            VCFRecord record = ParseVCFRecord(line, num_rows);
+            StoreColumnHeader(col, record.id);
+
+            for (int j = 0; j < num_compressed_rows; j++){
+                int entries_left = min(num_slots, num_rows - (j * num_slots));
+                vector<unsigned char> slots(record.genotypes.begin() + j * num_slots, record.genotypes.begin() + j * num_slots + entries_left);
+
+                encrypt_pool.Submit([this, col, j, slots = move(slots)](){
+                    StoreBlock(col, j, SlotsPlaintext(slots.data(), slots.size()));
+                });
+            }
+        });
+        col++;
+    }
+
+    parse_pool.Wait();
+    encrypt_pool.Wait();
+
+    num_cols = col;
+    if (num_cols == 0){
+        throw invalid_argument("ERROR: VCF file has no records");
+    }
+    db_set = true;
+}
+
+void Server::LoadPLINK(const string& prefix, int num_threads){
+    PlinkBed bed(prefix);
+    if (bed.NumSamples() == 0 || bed.NumSnps() == 0){
+        throw invalid_argument("ERROR: PLINK fileset " + prefix + " is empty");
+    }
+
+    LoadBlocks(bed.NumSamples(), bed.NumSnps(), [this, &bed](int col, int block, helib::Ptxt<helib::BGV>& ptxt){
+        int first = block * num_slots;
+        bed.Decode(col, first, min(num_slots, num_rows - first), ptxt);
+    }, num_threads);
+
+    unique_lock<shared_mutex> lock(db_mutex);
+    column_headers = bed.SnpIds();
+}
+
+void Server::LoadBlocks(int _num_rows, int _num_cols, function<void(int, int, helib::Ptxt<helib::BGV>&)> fill, int num_threads){
+    unique_lock<shared_mutex> lock(db_mutex);
+    BeginLoad(_num_rows);
+    for (int i = 0; i < _num_cols; i++){
+        AddSeededColumn();
+    }
+
+    WorkerPool pool(num_threads);
+    for (int i = 0; i < _num_cols; i++){
+        for (int j = 0; j < num_compressed_rows; j++){
+            pool.Submit([this, &fill, i, j](){
+                helib::Ptxt<helib::BGV> ptxt(*context);
+                fill(i, j, ptxt);
+                StoreBlock(i, j, ptxt);
+            });
+        }
+    }
+    pool.Wait();
+
+    num_cols = _num_cols;
+    db_set = true;
+}
+
+void Server::BeginLoad(int _num_rows){
+    lock_guard<mutex> guard(load_mutex);
+
+    db_set = false;
+    num_rows = _num_rows;
+    num_cols = 0;
+    num_compressed_rows = num_rows % num_slots == 0 ? num_rows / num_slots : (num_rows / num_slots) + 1;
+
+    CloseDB();
+    encrypted_db = vector<vector<helib::Ctxt>>();
+    seeded_db = vector<vector<SeededCtxt>>();
+    column_expanded = vector<char>();
+    column_headers = vector<string>();
+    deleted_rows.clear();
+    row_masks.clear();
+    if (num_compressed_rows > 0){
+        UpdateRowMask(num_compressed_rows - 1);
+    }
+}
+
+void Server::StoreBlock(int col, int block, const helib::Ptxt<helib::BGV>& ptxt){
+    // encryption runs outside the lock, so loaders can encrypt blocks in parallel
+    if (seeded_encryptor){
+        SeededCtxt seeded = seeded_encryptor->Encrypt(ptxt);
+        lock_guard<mutex> guard(load_mutex);
+        while ((int)encrypted_db.size() <= col){
+            AddSeededColumn();
+        }
+        seeded_db[col][block] = move(seeded);
+        return;
+    }
+
+    // a block without a seeded form is taken as it is when its column is expanded
+    helib::Ctxt ctxt(public_key);
+    public_key.Encrypt(ctxt, ptxt);
+    LowerToStorageLevel(ctxt);
+    lock_guard<mutex> guard(load_mutex);
+    while ((int)encrypted_db.size() <= col){
+        AddSeededColumn();
+    }
+    encrypted_db[col][block] = move(ctxt);
+}
+
+void Server::AddSeededColumn(){
+    encrypted_db.push_back(vector<helib::Ctxt>(num_compressed_rows, helib::Ctxt(public_key)));
+    seeded_db.push_back(vector<SeededCtxt>(num_compressed_rows));
+    column_expanded.push_back(0);
+}
+
+ColumnRef Server::Column(int i){
+    if (i < 0 || i >= num_cols){
+        throw invalid_argument("ERROR: column " + to_string(i) + " is outside the DB's " + to_string(num_cols) + " columns");
+    }
+    if (column_cache){
+        return column_cache->Get(i);
+    }
+    lock_guard<mutex> guard(expand_mutex);
+
+    if (!column_expanded[i]){
+        for (size_t j = 0; j < encrypted_db[i].size(); j++){
+            // the seeded form is kept (at about half a block) until the block is modified, so SaveDB still writes it seeded
+            if (!seeded_db[i][j].empty()){
+                encrypted_db[i][j] = ExpandSeeded(seeded_db[i][j], public_key);
+                LowerToStorageLevel(encrypted_db[i][j]);
+            }
+        }
+        column_expanded[i] = 1;
+    }
+    // non-owning: in-memory columns live as long as the DB
+    return ColumnRef(ColumnRef(), &encrypted_db[i]);
+}
+
+void Server::RegisterQueryProfile(int depth){
+    unique_lock<shared_mutex> lock(db_mutex);
+    // columns paged in from an opened DB read the storage level without the DB lock
+    RequireInMemory("RegisterQueryProfile (register query profiles before OpenDB)");
+    if (depth <= max_profile_depth){
+        return;
+    }
+    helib::IndexSet primes = MinimalPrimes(depth);
+
+    // blocks that were already lowered (expanded ones too) cannot get their levels back
+    for (size_t i = 0; i < encrypted_db.size(); i++){
+        for (size_t j = 0; j < encrypted_db[i].size(); j++){
+            if ((column_expanded[i] || seeded_db[i][j].empty()) && encrypted_db[i][j].getPrimeSet().card() < primes.card()){
+                throw invalid_argument("ERROR: DB blocks are stored below the level this profile needs; register it before loading data");
+            }
+        }
+    }
+
+    max_profile_depth = depth;
+    storage_primes = primes;
+    for (size_t i = 0; i < encrypted_db.size(); i++){
+        for (size_t j = 0; j < encrypted_db[i].size(); j++){
+            if (column_expanded[i] || seeded_db[i][j].empty()){
+                LowerToStorageLevel(encrypted_db[i][j]);
+            }
+        }
+    }
+}
+
+long Server::StorageLevelSavings(){
+    shared_lock<shared_mutex> lock(db_mutex);
+    if (storage_primes.card() == 0){
+        return 0;
+    }
+
+    long blocks = 0;
+    for (size_t i = 0; i < encrypted_db.size(); i++){
+        for (size_t j = 0; j < encrypted_db[i].size(); j++){
+            if (column_expanded[i] || seeded_db[i][j].empty()){
+                blocks++;
+            }
+        }
+    }
+    // two parts per ciphertext, each a DoubleCRT of phi(m) 64-bit words per prime
+    long dropped_primes = context->getCtxtPrimes().card() - storage_primes.card();
+    return blocks * 2 * dropped_primes * context->getPhiM() * sizeof(long);
+}
+
+helib::IndexSet Server::MinimalPrimes(int depth){
+    helib::Ptxt<helib::BGV> ptxt(*context);
+    helib::Ctxt fresh(public_key);
+    public_key.Encrypt(fresh, ptxt);
+
+    // a constant with a different value in every slot, like the row masks: its polynomial has full-size
+    // coefficients, where a scalar such as EQTest's 1/2 costs a few bits at most
+    vector<long> slots(num_slots);
+    mt19937 eng(1);
+    for (int k = 0; k < num_slots; k++){
+        slots[k] = eng() % plaintext_modulus;
+    }
+    NTL::ZZX full_constant;
+    context->getEA().encode(full_constant, slots);
+
+    // smallest prefix of the chain on which `depth` levels of the query circuit (a squaring followed by a
+    // multiplication by a full-size constant) still leave the capacity margin
+    const helib::IndexSet& all = context->getCtxtPrimes();
+    helib::IndexSet primes;
+    for (long i = all.first(); i <= all.last(); i = all.next(i)){
+        primes.insert(i);
+        helib::Ctxt probe = fresh;
+        probe.modDownToSet(primes);
+        for (int d = 0; d < depth; d++){
+            probe.square();
+            probe.multByConstant(full_constant);
+        }
+        if (probe.capacity() >= constants::STORAGE_CAPACITY_MARGIN){
+            return primes;
+        }
+    }
+    return all;
+}
+
+int Server::FilterDepth(size_t predicates){
+    // EQTest, then the MultiplyMany tree
+    return 1 + ceil(log2(max(predicates, (size_t)1)));
+}
 
-    one_over_two = get_inverse(1,2,plaintext_modulus);
-    neg_three_over_two = get_inverse(-3,2,plaintext_modulus);
-    neg_one_over_two = get_inverse(-1,2,plaintext_modulus);
+void Server::RequireProfileDepth(const string& query, int depth){
+    if (storage_primes.card() > 0 && depth > max_profile_depth){
+        throw invalid_argument("ERROR: " + query + " needs depth " + to_string(depth) + ", the blocks are stored for depth "
+                               + to_string(max_profile_depth) + "; register a profile this deep before loading data");
+    }
+}
 
-    db_set = false;
-    
-    comparator = unique_ptr<he_cmp::Comparator>(new he_cmp::Comparator(context, he_cmp::UNI, 1, 1, secret_key, false));
+void Server::CalibrateNoise(){
+    helib::Ptxt<helib::BGV> ptxt(*context);
+    helib::Ctxt fresh(public_key);
+    public_key.Encrypt(fresh, ptxt);
+
+    // measured at the top of the chain; the prediction is a guard against doomed plans, not an exact bound
+    helib::Ctxt product = fresh;
+    product.square();
+    mult_cost_bits = fresh.capacity() - product.capacity();
+    helib::Ctxt scaled = product;
+    scaled.multByConstant(NTL::ZZX(one_over_two));
+    const_mult_cost_bits = product.capacity() - scaled.capacity();
+    helib::Ctxt rotated = product;
+    context->getEA().rotate(rotated, 1);
+    rotate_cost_bits = max(0.0, product.capacity() - rotated.capacity());
+
+    // the comparator's multiplicative depth on fresh inputs; only the depth is taken, the chain's bits do not matter
+    NoiseParams params = NoiseParams::FromContext(context->getM(), plaintext_modulus, constants::BITS);
+    NoiseSimulator sim(params);
+    compare_depth = sim.Compare(sim.Fresh(), sim.Fresh()).depth;
 }
 
-void Server::GenData(int _num_rows, int _num_cols){
-    num_rows = _num_rows;
-    num_cols = _num_cols;
-    
-    num_compressed_rows = num_rows % num_slots == 0 ? num_rows / num_slots : (num_rows / num_slots) + 1;
-    
-    encrypted_db = vector<vector<helib::Ctxt>>();
-    for(int i = 0; i < num_cols; i++){
-        vector<helib::Ctxt> cipher_vector = vector<helib::Ctxt>();
-        for (int j = 0; j < num_compressed_rows; j++){
-            helib::Ptxt<helib::BGV> ptxt(*context);
-            
-            helib::Ctxt ctxt(public_key);
-            
-            public_key.Encrypt(ctxt, ptxt);
-            
-            cipher_vector.push_back(ctxt);
+double Server::InputCapacity(const vector<ColumnRef>& cols){
+    double bits = numeric_limits<double>::max();
+    for (const ColumnRef& col : cols){
+        for (const helib::Ctxt& block : *col){
+            bits = min(bits, block.capacity());
         }
-        encrypted_db.push_back(cipher_vector);
     }
-    
-    db_set = true;
-    
+    return bits;
 }
 
-void Server::SetData(vector<vector<unsigned long>> &db){
-    num_cols = db.size();
-    if (num_cols == 0){
-        throw invalid_argument("ERROR: DB has zero columns! THIS DOES NOT WORK!");
+double Server::FilterCost(size_t predicates){
+    // EQTest (a multiplication and a constant), the tree of MultiplyMany, and the mask of deleted rows and free slots
+    double bits = mult_cost_bits + const_mult_cost_bits + ceil(log2(max(predicates, (size_t)1))) * mult_cost_bits;
+    if (!row_masks.empty()){
+        bits += const_mult_cost_bits;
     }
-    
-    num_rows = db[0].size();
-    
-    num_compressed_rows = num_rows % num_slots == 0 ? num_rows / num_slots : (num_rows / num_slots) + 1;
-    
-    encrypted_db = vector<vector<helib::Ctxt>>();
-    for(int i = 0; i < num_cols; i++){
-        vector<helib::Ctxt> cipher_vector = vector<helib::Ctxt>();
-        for (int j = 0; j < num_compressed_rows; j++){
-            
-            helib::Ptxt<helib::BGV> ptxt(*context);
-            
-            int entries_left = min(num_slots, num_rows - (j * num_slots));
-            for (int k = 0; k < entries_left; k++){
-                ptxt[k] = db[i][j*num_slots + k];
-            }
-            
-            helib::Ctxt ctxt(public_key);
-            
-            public_key.Encrypt(ctxt, ptxt);
-            
-            cipher_vector.push_back(ctxt);
+    return bits;
+}
+
+double Server::SquashCost(int num_data_elements){
+    // the key switch of a rotation, and the sum of num_data_elements terms
+    return rotate_cost_bits + log2(max(num_data_elements, 1));
+}
+
+int Server::SquashWindow(){
+    return max(min(num_rows, num_slots), 1);
+}
+
+double Server::CompareCost(){
+    double learned = compare_cost_bits.load();
+    return learned > 0 ? learned : compare_depth * mult_cost_bits;
+}
+
+void Server::LearnCompareCost(double bits, double seconds){
+    double known = compare_cost_bits.load();
+    while (bits > known && !compare_cost_bits.compare_exchange_weak(known, bits)){
+    }
+    // running mean; concurrent updates may lose a sample, which only slows it down
+    double mean = compare_seconds.load();
+    compare_seconds.store(mean == 0 ? seconds : 0.8 * mean + 0.2 * seconds);
+}
+
+PrimitiveCosts Server::Costs(){
+    {
+        lock_guard<mutex> guard(costs_mutex);
+        if (primitive_costs.Calibrated()){
+            return primitive_costs;
         }
-        encrypted_db.push_back(cipher_vector);
     }
-    
+    return CalibrateCosts();
+}
 
-    db_set = true;
+PrimitiveCosts Server::CalibrateCosts(int runs){
+    PrimitiveCosts costs = CalibratePrimitives(public_key, runs);
+    lock_guard<mutex> guard(costs_mutex);
+    primitive_costs = costs;
+    return costs;
 }
 
-void Server::SetColumnHeaders(vector<string> &headers){
-    column_headers = vector<string>();
-    for (int i = 0; i < headers.size(); i++){
-        column_headers.push_back(headers[i]);
+QueryEstimate Server::EstimateCountingQuery(bool conjunctive, size_t predicates){
+    shared_lock<shared_mutex> lock(db_mutex);
+    return CountingQueryCost(conjunctive, predicates);
+}
+
+QueryEstimate Server::EstimateMAFQuery(bool conjunctive, size_t predicates){
+    shared_lock<shared_mutex> lock(db_mutex);
+    return MAFQueryCost(conjunctive, predicates);
+}
+
+QueryEstimate Server::EstimateDistrubtionQuery(size_t params){
+    shared_lock<shared_mutex> lock(db_mutex);
+    return DistrubtionQueryCost(params);
+}
+
+QueryEstimate Server::EstimateSimilarityQuery(size_t d_size){
+    shared_lock<shared_mutex> lock(db_mutex);
+    return SimilarityQueryCost(d_size);
+}
+
+void Server::SetAdmissionPolicy(AdmissionPolicy policy){
+    lock_guard<mutex> guard(admission_mutex);
+    admission_policy = policy;
+    admission_changed.notify_all();
+}
+
+static void add_mults(OpCounts& ops, long n){
+    ops[HE_CTXT_MULT] += n;
+    ops[HE_RELINEARIZE] += n;
+    ops[HE_KEY_SWITCH] += n;
+}
+
+// SquashCtxtLogTime over num_data_elements slots: a rotation and an addition per bit below the top one and per
+// set bit below it
+static OpCounts squash_ops(int num_data_elements){
+    OpCounts ops;
+    long steps = 30 - __builtin_clz(max(num_data_elements, 1)) + __builtin_popcount(max(num_data_elements, 1)) - 1;
+    ops[HE_ROTATE] += steps;
+    ops[HE_KEY_SWITCH] += steps;
+    ops[HE_ADD] += steps;
+    return ops;
+}
+
+OpCounts Server::FilterOps(bool conjunctive, size_t predicates){
+    OpCounts ops;
+    // EQTest, taking the dearest case (a = 0) for every predicate, then the MultiplyMany tree
+    add_mults(ops, predicates);
+    ops[HE_PTXT_MULT] += predicates;
+    ops[HE_ADD] += 2 * predicates;
+    add_mults(ops, predicates > 0 ? predicates - 1 : 0);
+    if (!conjunctive){
+        ops[HE_ADD] += predicates + 1;
     }
+    if (!row_masks.empty()){
+        ops[HE_PTXT_MULT] += 1;
+    }
+    return ops;
 }
 
+OpCounts Server::CompareOps(){
+    // the split NoiseSimulator::Compare models: z^2, its baby and giant powers, a product per giant step and the
+    // final product by z
+    CompareSteps steps = CompareSteps::ForModulus(plaintext_modulus);
+    OpCounts ops;
+    add_mults(ops, 2 + (steps.baby_steps - 1) + 2 * steps.giant_steps);
+    ops[HE_PTXT_MULT] += steps.degree;
+    ops[HE_ADD] += steps.degree + 1;
+    return ops;
+}
 
-helib::Ctxt Server::CountingQuery(bool conjunctive, vector<pair<int, int>>& query){
-    if (!db_set){
-        throw invalid_argument("ERROR: DB needs to be set to run query");
+void Server::EstimateLatency(QueryEstimate& estimate, const OpCounts& block_ops, const OpCounts& tail_ops, double block_extra_s){
+    PrimitiveCosts costs = Costs();
+    long parallel = max(1L, min({(long)query_pool.Size(), (long)constants::QUERY_BLOCK_WINDOW, estimate.blocks}));
+    estimate.seconds = (costs.Seconds(block_ops) + block_extra_s) * estimate.blocks / parallel + costs.Seconds(tail_ops);
+    for (int op = 0; op < HE_OP_COUNT; op++){
+        estimate.ops.counts[op] += block_ops.counts[op] * estimate.blocks + tail_ops.counts[op];
     }
-    
-    vector<vector<helib::Ctxt>> cols = filter(query);
+}
 
-    int num_columns = cols[0].size();
+QueryEstimate Server::CountingQueryCost(bool conjunctive, size_t predicates){
+    QueryEstimate estimate;
+    estimate.query = "CountingQuery";
+    estimate.blocks = num_compressed_rows;
+    estimate.depth = FilterDepth(predicates);
+
+    OpCounts block = FilterOps(conjunctive, predicates);
+    block[HE_ADD] += 1;
+    EstimateLatency(estimate, block, squash_ops(SquashWindow()), 0);
+
+    // a window of blocks with their predicates, the sum and the result; an opened DB also pins the columns
+    size_t ctxt_bytes = Costs().ctxt_bytes;
+    long window = min((long)constants::QUERY_BLOCK_WINDOW, estimate.blocks);
+    estimate.bytes = ctxt_bytes * (window * (predicates + 1) + 2);
+    if (db_file){
+        estimate.bytes += ctxt_bytes * predicates * estimate.blocks;
+    }
+    return estimate;
+}
 
-    vector<helib::Ctxt> filter_results;
-    if (conjunctive){
-        for (int j = 0; j < num_compressed_rows; j++){
-            helib::Ctxt temp = MultiplyMany(cols[j]);
-            filter_results.push_back(temp);
+QueryEstimate Server::MAFQueryCost(bool conjunctive, size_t predicates){
+    QueryEstimate estimate;
+    estimate.query = "MAFQuery";
+    estimate.blocks = num_compressed_rows;
+    estimate.depth = FilterDepth(predicates) + 1;
+
+    OpCounts block = FilterOps(conjunctive, predicates);
+    add_mults(block, 1);
+    block[HE_ADD] += 2;
+    OpCounts tail = squash_ops(SquashWindow());
+    tail += squash_ops(SquashWindow());
+    tail[HE_PTXT_MULT] += 1;
+    EstimateLatency(estimate, block, tail, 0);
+
+    size_t ctxt_bytes = Costs().ctxt_bytes;
+    long window = min((long)constants::QUERY_BLOCK_WINDOW, estimate.blocks);
+    estimate.bytes = ctxt_bytes * (window * (predicates + 2) + 4);
+    if (db_file){
+        estimate.bytes += ctxt_bytes * (predicates + 1) * estimate.blocks;
+    }
+    return estimate;
+}
+
+QueryEstimate Server::DistrubtionQueryCost(size_t params){
+    QueryEstimate estimate;
+    estimate.query = "DistrubtionQuery";
+    estimate.blocks = num_compressed_rows;
+    // constant multiplications only
+    estimate.depth = 0;
+
+    OpCounts block;
+    block[HE_PTXT_MULT] += params;
+    block[HE_ADD] += params > 0 ? params - 1 : 0;
+    EstimateLatency(estimate, block, OpCounts(), 0);
+
+    // the result keeps a score per block, next to a window of weighted columns
+    size_t ctxt_bytes = Costs().ctxt_bytes;
+    long window = min((long)constants::QUERY_BLOCK_WINDOW, estimate.blocks);
+    estimate.bytes = ctxt_bytes * (estimate.blocks + window * params);
+    if (db_file){
+        estimate.bytes += ctxt_bytes * params * estimate.blocks;
+    }
+    return estimate;
+}
+
+QueryEstimate Server::SimilarityQueryCost(size_t d_size){
+    QueryEstimate estimate;
+    estimate.query = "SimilarityQuery";
+    estimate.blocks = num_compressed_rows;
+
+    // scoring, the complement of the comparison and the two counts
+    OpCounts block;
+    block[HE_ADD] += d_size + (d_size > 0 ? d_size - 1 : 0) + 1 + 2;
+    add_mults(block, d_size + 2);
+    OpCounts compare = CompareOps();
+    long baby_steps = CompareSteps::ForModulus(plaintext_modulus).baby_steps;
+
+    // the comparator is timed once a query has run it; its depth is the simulated one
+    OpCounts tail = squash_ops(SquashWindow());
+    tail += squash_ops(SquashWindow());
+    double compare_s = compare_seconds.load();
+    estimate.depth = 2 + compare_depth;
+    if (compare_s > 0){
+        EstimateLatency(estimate, block, tail, compare_s);
+        for (int op = 0; op < HE_OP_COUNT; op++){
+            estimate.ops.counts[op] += compare.counts[op] * estimate.blocks;
         }
     }
     else{
-        for (int i = 0; i < num_compressed_rows; i++){
-            for (int j = 0; j < num_columns; j++){
-                AddOneMod2(cols[i][j]);
-            }
-        }
-        for (int j = 0; j < num_compressed_rows; j++){
-            helib::Ctxt temp = MultiplyMany(cols[j]);
-            filter_results.push_back(temp);
+        block += compare;
+        EstimateLatency(estimate, block, tail, 0);
+    }
+
+    // per block in flight: the scores, the predicates and the comparator's table of powers
+    size_t ctxt_bytes = Costs().ctxt_bytes;
+    long window = min((long)constants::QUERY_BLOCK_WINDOW, estimate.blocks);
+    estimate.bytes = ctxt_bytes * (window * (d_size + 2 + 2 * baby_steps + 4) + 4);
+    if (db_file){
+        estimate.bytes += ctxt_bytes * (d_size + 1) * estimate.blocks;
+    }
+    return estimate;
+}
+
+shared_ptr<void> Server::Admit(function<QueryEstimate()> estimate){
+    AdmissionPolicy policy;
+    {
+        lock_guard<mutex> guard(admission_mutex);
+        policy = admission_policy;
+    }
+    if (!policy){
+        return nullptr;
+    }
+
+    QueryEstimate query_estimate = estimate();
+    unique_lock<mutex> guard(admission_mutex);
+    while (true){
+        Admission decision = policy(query_estimate, running_queries);
+        if (decision == REJECT){
+            ostringstream reason;
+            query_estimate.Print(reason);
+            throw invalid_argument("ERROR: rejected by admission control, " + reason.str());
         }
-        for (int j = 0; j < num_compressed_rows; j++){
-            AddOneMod2(filter_results[j]);
+        if (decision == ADMIT || running_queries == 0){
+            break;
         }
+        admission_changed.wait(guard);
     }
+    running_queries++;
+    return shared_ptr<void>(nullptr, [this](void*){
+        lock_guard<mutex> guard(admission_mutex);
+        running_queries--;
+        admission_changed.notify_all();
+    });
+}
 
-    if (constants::DEBUG){
-        print_vector(Decrypt(filter_results[0]));
+void Server::LowerToStorageLevel(helib::Ctxt& ctxt){
+    if (storage_primes.card() > 0 && storage_primes.card() < ctxt.getPrimeSet().card()){
+        ctxt.modDownToSet(storage_primes);
     }
+}
 
-    helib::Ctxt result = AddMany(filter_results);
-    result = SquashCtxt(result);
-    return result;
-    
+helib::Ctxt& Server::MutableBlock(int i, int j){
+    Column(i);
+    seeded_db[i][j] = SeededCtxt();
+    return encrypted_db[i][j];
 }
 
-pair<helib::Ctxt, helib::Ctxt> Server::MAFQuery(int snp, bool conjunctive, vector<pair<int, int>> &query){
-    vector<vector<helib::Ctxt>> cols = filter(query);
-    int num_columns = cols[0].size();
+void Server::StoreColumnHeader(int col, const string& header){
+    lock_guard<mutex> guard(load_mutex);
 
-    vector<helib::Ctxt> filter_results;
-    if (conjunctive){
-        for (int j = 0; j < num_compressed_rows; j++){
-            helib::Ctxt temp = MultiplyMany(cols[j]);
-            filter_results.push_back(temp);
-        }
+    if ((int)column_headers.size() <= col){
+        column_headers.resize(col + 1);
     }
-    else{
-        for (int i = 0; i < num_compressed_rows; i++){
-            for (int j = 0; j < num_columns; j++){
-                AddOneMod2(cols[i][j]);
-            }
-        }
-        for (int j = 0; j < num_compressed_rows; j++){
-            helib::Ctxt temp = MultiplyMany(cols[j]);
-            filter_results.push_back(temp);
-        }
-        for (int j = 0; j < num_compressed_rows; j++){
-            AddOneMod2(filter_results[j]);
-        }
+    column_headers[col] = header;
+}
+
+helib::Ptxt<helib::BGV> Server::SlotsPlaintext(const unsigned char* values, int count){
+    helib::Ptxt<helib::BGV> ptxt(*context);
+    for (int k = 0; k < count; k++){
+        ptxt[k] = values[k];
     }
+    return ptxt;
+}
 
-    vector<helib::Ctxt> indv_MAF = vector<helib::Ctxt>();
 
-    for (int i = 0; i < num_compressed_rows; i++){
-        helib::Ctxt clone = encrypted_db[snp][i];
-        clone *= filter_results[i];
-        indv_MAF.push_back(clone);
+helib::Ctxt Server::CountingQuery(bool conjunctive, vector<pair<int, int>>& query){
+    // a deferred query waits without the DB lock, and its wait is not counted as its own time or memory
+    shared_ptr<void> admission = Admit([&](){
+        shared_lock<shared_mutex> lock(db_mutex);
+        return CountingQueryCost(conjunctive, query.size());
+    });
+    shared_lock<shared_mutex> lock(db_mutex);
+    if (!db_set){
+        throw invalid_argument("ERROR: DB needs to be set to run query");
     }
+    RequireProfileDepth("CountingQuery", FilterDepth(query.size()));
+    QueryMemoryScope memory_scope("CountingQuery", [this](const QueryMemory& m){ RecordQueryMemory(m); });
+    long trace_query = Tracer::Global().NewQuery();
+    TraceScope trace_scope(trace_query, -1);
+    QueryOpCounter op_counter("CountingQuery", trace_query, [this](const QueryOps& ops){ RecordQueryOps(ops); });
+    QueryNoiseMonitor noise_monitor("CountingQuery", trace_query, NOISE_THRES, [this](const QueryNoise& n){ RecordQueryNoise(n); });
+    TRACE_SPAN("CountingQuery");
+
+    vector<ColumnRef> query_cols = PinColumns(QueryColumns(query));
+    double input_bits = InputCapacity(query_cols);
+    noise_monitor.Predict(input_bits, input_bits - FilterCost(query.size()), "filtering " + to_string(query.size()) + " predicates");
+
+    CtxtSum count;
+    StreamBlocks(memory_scope, [&](int j){
+        helib::Ctxt filter_result = FilterBlock(conjunctive, query, query_cols, j);
+        if (constants::DEBUG && j == 0){
+            print_vector(Decrypt(filter_result));
+        }
+        count.Add(move(filter_result));
+    });
 
-    helib::Ctxt freq = AddMany(indv_MAF);
-    helib::Ctxt number_of_patients = AddMany(filter_results);
-
-    freq = SquashCtxt(freq);
-    number_of_patients = SquashCtxt(number_of_patients);
+    helib::Ctxt sum = count.Result();
+    helib::Ctxt result = SquashCtxtLogTime(sum, SquashWindow());
+    CtxtArena::Local().Release(move(sum));
+    return result;
+}
 
-    number_of_patients.multByConstant(NTL::ZZX(2));
-    return pair(freq, number_of_patients);
+pair<helib::Ctxt, helib::Ctxt> Server::MAFQuery(int snp, bool conjunctive, vector<pair<int, int>> &query){
+    shared_ptr<void> admission = Admit([&](){
+        shared_lock<shared_mutex> lock(db_mutex);
+        return MAFQueryCost(conjunctive, query.size());
+    });
+    shared_lock<shared_mutex> lock(db_mutex);
+    if (!db_set){
+        throw invalid_argument("ERROR: DB needs to be set to run query");
+    }
+    RequireProfileDepth("MAFQuery", FilterDepth(query.size()) + 1);
+    QueryMemoryScope memory_scope("MAFQuery", [this](const QueryMemory& m){ RecordQueryMemory(m); });
+    long trace_query = Tracer::Global().NewQuery();
+    TraceScope trace_scope(trace_query, -1);
+    QueryOpCounter op_counter("MAFQuery", trace_query, [this](const QueryOps& ops){ RecordQueryOps(ops); });
+    QueryNoiseMonitor noise_monitor("MAFQuery", trace_query, NOISE_THRES, [this](const QueryNoise& n){ RecordQueryNoise(n); });
+    TRACE_SPAN("MAFQuery");
+
+    vector<int> col_ids = QueryColumns(query);
+    col_ids.push_back(snp);
+    vector<ColumnRef> query_cols = PinColumns(col_ids);
+    ColumnRef snp_col = query_cols.back();
+    query_cols.pop_back();
+    double input_bits = InputCapacity(query_cols);
+    noise_monitor.Predict(input_bits, input_bits - FilterCost(query.size()) - mult_cost_bits,
+                          "filtering " + to_string(query.size()) + " predicates and weighting by the SNP");
+
+    CtxtSum freq_sum;
+    CtxtSum patients_sum;
+    StreamBlocks(memory_scope, [&](int j){
+        helib::Ctxt filter_result = FilterBlock(conjunctive, query, query_cols, j);
+
+        helib::Ctxt freq = CtxtArena::Local().Take((*snp_col)[j]);
+        counted::Multiply(freq, filter_result);
+        ObserveNoise("frequency", freq);
+        freq_sum.Add(move(freq));
+        patients_sum.Add(move(filter_result));
+    });
+
+    helib::Ctxt freq_total = freq_sum.Result();
+    helib::Ctxt patients_total = patients_sum.Result();
+
+    helib::Ctxt freq = SquashCtxtLogTime(freq_total, SquashWindow());
+    helib::Ctxt number_of_patients = SquashCtxtLogTime(patients_total, SquashWindow());
+
+    counted::MultByConstant(number_of_patients, NTL::ZZX(2));
+
+    CtxtArena& arena = CtxtArena::Local();
+    arena.Release(move(freq_total));
+    arena.Release(move(patients_total));
+    return pair(move(freq), move(number_of_patients));
 }
 
 vector<helib::Ctxt> Server::DistrubtionQuery(vector<pair<int, int>>& prs_params){
+    shared_ptr<void> admission = Admit([&](){
+        shared_lock<shared_mutex> lock(db_mutex);
+        return DistrubtionQueryCost(prs_params.size());
+    });
+    shared_lock<shared_mutex> lock(db_mutex);
+    if (!db_set){
+        throw invalid_argument("ERROR: DB needs to be set to run query");
+    }
+    QueryMemoryScope memory_scope("DistrubtionQuery", [this](const QueryMemory& m){ RecordQueryMemory(m); });
+    long trace_query = Tracer::Global().NewQuery();
+    TraceScope trace_scope(trace_query, -1);
+    QueryOpCounter op_counter("DistrubtionQuery", trace_query, [this](const QueryOps& ops){ RecordQueryOps(ops); });
+    QueryNoiseMonitor noise_monitor("DistrubtionQuery", trace_query, NOISE_THRES, [this](const QueryNoise& n){ RecordQueryNoise(n); });
+    TRACE_SPAN("DistrubtionQuery");
     
-    vector<helib::Ctxt> scores;
-
-    for(int j = 0; j < num_compressed_rows; j++){
+    vector<ColumnRef> prs_cols = PinColumns(QueryColumns(prs_params));
+    double input_bits = InputCapacity(prs_cols);
+    noise_monitor.Predict(input_bits, input_bits - const_mult_cost_bits, "weighting the scores");
+
+    // one score per block is the result itself, so only the per-block temporaries are bounded
+    vector<helib::Ctxt> scores(num_compressed_rows, helib::Ctxt(public_key));
+    StreamBlocks(memory_scope, [&](int j){
+        CtxtArena& arena = CtxtArena::Local();
         vector<helib::Ctxt> indvs_scores;
-        for(pair<int, int> i : prs_params){
-            helib::Ctxt temp = encrypted_db[i.first][j];
+        for(size_t k = 0; k < prs_params.size(); k++){
+            helib::Ctxt temp = arena.Take((*prs_cols[k])[j]);
 
-            temp.multByConstant(NTL::ZZX(i.second));
-            indvs_scores.push_back(temp);
+            counted::MultByConstant(temp, NTL::ZZX(prs_params[k].second));
+            indvs_scores.push_back(move(temp));
         }
-        helib::Ctxt score = AddMany(indvs_scores);
-        scores.push_back(score);
-    }
+        scores[j] = AddMany(indvs_scores);
+        ObserveNoise("score", scores[j]);
+        arena.Release(indvs_scores);
+    });
     return scores;
 }
 
+pair<helib::Ctxt, helib::Ctxt> Server::SimilarityQuery(int target_column, vector<SeededCtxt>& d, int threshold){
+    vector<helib::Ctxt> expanded;
+    for (auto& seeded : d){
+        expanded.push_back(ExpandSeeded(seeded, public_key));
+    }
+    return SimilarityQuery(target_column, expanded, threshold);
+}
 
 pair<helib::Ctxt, helib::Ctxt> Server::SimilarityQuery(int target_column, vector<helib::Ctxt>& d, int threshold){
-    // Compute Normalized Score
+    shared_ptr<void> admission = Admit([&](){
+        shared_lock<shared_mutex> lock(db_mutex);
+        return SimilarityQueryCost(d.size());
+    });
+    shared_lock<shared_mutex> lock(db_mutex);
+    if (!db_set){
+        throw invalid_argument("ERROR: DB needs to be set to run query");
+    }
+    RequireProfileDepth("SimilarityQuery", 2 + compare_depth);
+    QueryMemoryScope memory_scope("SimilarityQuery", [this](const QueryMemory& m){ RecordQueryMemory(m); });
+    long trace_query = Tracer::Global().NewQuery();
+    TraceScope trace_scope(trace_query, -1);
+    QueryOpCounter op_counter("SimilarityQuery", trace_query, [this](const QueryOps& ops){ RecordQueryOps(ops); });
+    QueryNoiseMonitor noise_monitor("SimilarityQuery", trace_query, NOISE_THRES, [this](const QueryNoise& n){ RecordQueryNoise(n); });
+    TRACE_SPAN("SimilarityQuery");
+
+    vector<int> col_ids;
+    for (size_t i = 0; i < d.size(); i++){
+        col_ids.push_back(i);
+    }
+    col_ids.push_back(target_column);
+    vector<ColumnRef> d_cols = PinColumns(col_ids);
+    ColumnRef target = d_cols.back();
+    d_cols.pop_back();
+
+    double input_bits = InputCapacity(d_cols);
+    for (const helib::Ctxt& ctxt : d){
+        input_bits = min(input_bits, ctxt.capacity());
+    }
+    // the comparator's cost is learned from the queries that ran it, until then it is its simulated depth
+    double compare_bits = CompareCost();
+    double predicted_bits = input_bits - mult_cost_bits - compare_bits - mult_cost_bits - SquashCost(SquashWindow());
+    noise_monitor.Predict(input_bits, predicted_bits, "scoring, comparing, counting and squashing");
 
-    vector<vector<helib::Ctxt>> normalized_scores = vector<vector<helib::Ctxt>>();
+    const he_cmp::Comparator& cmp = GetComparator();
+    helib::Ctxt thres = Encrypt((unsigned long)threshold);
 
-    for (int j = 0; j < num_compressed_rows; j++){
-        vector<helib::Ctxt> temp = vector<helib::Ctxt>();
+    CtxtSum count_with;
+    CtxtSum count_without;
+    StreamBlocks(memory_scope, [&](int j){
+        CtxtArena& arena = CtxtArena::Local();
+
+        // Compute Normalized Score
+        vector<helib::Ctxt> normalized_scores = vector<helib::Ctxt>();
         for (size_t i = 0; i < d.size(); i++){
-            helib::Ctxt clone = encrypted_db[i][j];
-            clone -= d[i];
-            clone.square();
-            temp.push_back(clone);
+            helib::Ctxt clone = arena.Take((*d_cols[i])[j]);
+            counted::Subtract(clone, d[i]);
+            counted::Square(clone);
+            normalized_scores.push_back(move(clone));
+        }
+        helib::Ctxt score = AddMany(normalized_scores);
+        arena.Release(normalized_scores);
+        ObserveNoise("score", score);
+        if (constants::DEBUG){
+            cout << "After scoring (block " << j << "):" << endl;
+            print_vector(Decrypt(score));
         }
-        normalized_scores.push_back(temp);
-    }
-    vector<helib::Ctxt> scores = vector<helib::Ctxt>();
 
-    for (int j = 0; j < num_compressed_rows; j++){
-        scores.push_back(AddMany(normalized_scores[j]));
-    } 
-    if (constants::DEBUG){
-        cout << "After scoring:" << endl;
-        for (int j = 0; j < num_compressed_rows; j++){
-            print_vector(Decrypt(scores[j]));
-        } 
-    }
+        // a score that cannot survive the comparison and the count is caught before the comparator's cost is paid
+        ExpectNoise("compare", score, compare_bits + mult_cost_bits);
+
+        // compare overwrites its output, so it needs no copy of the score
+        helib::Ctxt predicate(public_key);
+        double score_bits = score.capacity();
+        auto compare_start = chrono::steady_clock::now();
+        cmp.compare(predicate, score, thres);
+        double compare_s = chrono::duration<double>(chrono::steady_clock::now() - compare_start).count();
+        arena.Release(move(score));
+        LearnCompareCost(score_bits - predicate.capacity(), compare_s);
+        ObserveNoise("compare", predicate);
+        if (constants::DEBUG){
+            cout << "After thres (block " << j << "):" << endl;
+            print_vector(Decrypt(predicate));
+        }
 
-    helib::Ctxt thres = Encrypt((unsigned long)threshold);
-    vector<helib::Ctxt> predicate = vector<helib::Ctxt>();
-    for (int j = 0; j < num_compressed_rows; j++){
-        helib::Ctxt res = scores[j];
-        comparator->compare(res, scores[j], thres);
-        predicate.push_back(res);
-    }
+        helib::Ctxt inverse_predicate = arena.Take(predicate);
+        AddOneMod2(inverse_predicate);
 
-    if (constants::DEBUG){
-        cout << "After thres:" << endl;
-        for (int j = 0; j < num_compressed_rows; j++){
-            print_vector(Decrypt(predicate[j]));
-        } 
+        // deleted rows and free slots are zero in the target, so they count for nothing
+        counted::Multiply(predicate, (*target)[j]);
+        counted::Multiply(inverse_predicate, (*target)[j]);
+        ObserveNoise("count", predicate);
+        count_with.Add(move(predicate));
+        count_without.Add(move(inverse_predicate));
+    });
+
+    helib::Ctxt with_total = count_with.Result();
+    helib::Ctxt without_total = count_without.Result();
+
+    helib::Ctxt squashed_with = SquashCtxtLogTime(with_total, SquashWindow());
+    helib::Ctxt squashed_without = SquashCtxtLogTime(without_total, SquashWindow());
+
+    CtxtArena& arena = CtxtArena::Local();
+    arena.Release(move(with_total));
+    arena.Release(move(without_total));
+    return pair(move(squashed_with), move(squashed_without));
+}
+
+vector<int> Server::QueryColumns(const vector<pair<int, int>>& query){
+    vector<int> col_ids;
+    for (pair<int, int> i : query){
+        col_ids.push_back(i.first);
     }
-    
-    vector<helib::Ctxt> inverse_predicate = vector<helib::Ctxt>();
-    for (int j = 0; j < num_compressed_rows; j++){
-        helib::Ctxt inv = inverse_predicate[j];
-        AddOneMod2(inv);
-        inverse_predicate.push_back(inv);
+    return col_ids;
+}
+
+vector<ColumnRef> Server::PinColumns(const vector<int>& col_ids){
+    TRACE_SPAN("PinColumns");
+    PrefetchColumns(col_ids);
+    vector<ColumnRef> cols;
+    for (int col : col_ids){
+        cols.push_back(Column(col));
     }
+    return cols;
+}
 
+void Server::StreamBlocks(QueryMemoryScope& scope, function<void(int)> block){
+    TaskGroup blocks(query_pool, constants::QUERY_BLOCK_WINDOW);
+    long query = TraceScope::CurrentQuery();
+    QueryOpCounter* op_counter = QueryOpCounter::Current();
+    QueryNoiseMonitor* noise_monitor = QueryNoiseMonitor::Current();
     for (int j = 0; j < num_compressed_rows; j++){
-        predicate[j] *= encrypted_db[target_column][j];
-        inverse_predicate[j] *= encrypted_db[target_column][j];
+        blocks.Submit([&scope, &block, query, op_counter, noise_monitor, j](){
+            TraceScope trace_scope(query, j);
+            OpCountScope op_scope(op_counter);
+            NoiseScope noise_scope(noise_monitor);
+            TRACE_SPAN("block");
+            long copies_before = CtxtArena::ThreadCopies();
+            block(j);
+            scope.AddCopies(CtxtArena::ThreadCopies() - copies_before);
+        });
     }
+    blocks.Wait();
+}
 
-    helib::Ctxt count_with = AddMany(predicate);
-    helib::Ctxt count_without = AddMany(inverse_predicate);
-
-    count_with = SquashCtxt(count_with);
-    count_without = SquashCtxt(count_without);
-    
-    return pair(count_with, count_without);
+vector<helib::Ctxt> Server::FilterPredicates(vector<pair<int, int>>& query, const vector<ColumnRef>& query_cols, int block){
+    vector<helib::Ctxt> indv_vector;
+    for(size_t k = 0; k < query.size(); k++){
+        pair<int, int> i = query[k];
+        const helib::Ctxt& ctxt = (*query_cols[k])[block];
+        indv_vector.push_back(EQTest(i.second, ctxt));
+        if (constants::DEBUG == 2){
+            cout << "checking equality to " << i.second << endl;
+            cout << "original:";
+            print_vector(Decrypt(ctxt));
+            cout << "result  :"; 
+            print_vector(Decrypt(EQTest(i.second, ctxt)));
+        }
+    }
+    return indv_vector;
 }
 
+helib::Ctxt Server::FilterBlock(bool conjunctive, vector<pair<int, int>>& query, const vector<ColumnRef>& query_cols, int block){
+    TRACE_SPAN("filter");
+    vector<helib::Ctxt> predicates = FilterPredicates(query, query_cols, block);
+
+    // a disjunction is the negated conjunction of the negated predicates
+    if (!conjunctive){
+        for (auto& predicate : predicates){
+            AddOneMod2(predicate);
+        }
+    }
+    helib::Ctxt result = MultiplyMany(predicates);
+    if (!conjunctive){
+        AddOneMod2(result);
+    }
+    CtxtArena::Local().Release(predicates);
 
+    ApplyRowMask(result, block);
+    ObserveNoise("filter", result);
+    return result;
+}
 
 void Server::AddOneMod2(helib::Ctxt& a){
     //   0 -> 1
@@ -282,10 +1641,14 @@ void Server::AddOneMod2(helib::Ctxt& a){
     // f(x)-> -x+1
     
     a.negate();
-    a.addConstant(NTL::ZZX(1));
+    counted::AddConstant(a, NTL::ZZX(1));
 }
 
 helib::Ctxt Server::MultiplyMany(vector<helib::Ctxt>& v){
+    TRACE_SPAN("MultiplyMany");
+    if (v.empty()){
+        throw invalid_argument("ERROR: MultiplyMany of no ciphertexts");
+    }
     int num_entries = v.size();
     int depth = ceil(log2(num_entries));
 
@@ -293,14 +1656,18 @@ helib::Ctxt Server::MultiplyMany(vector<helib::Ctxt>& v){
         int jump_factor = pow(2, d);
         int skip_factor = 2 * jump_factor;
 
-        for (int i = 0; i < num_entries; i+= skip_factor){            
-            v[i].multiplyBy(v[i + jump_factor]);
+        for (int i = 0; i + jump_factor < num_entries; i+= skip_factor){            
+            counted::Multiply(v[i], v[i + jump_factor]);
         }
      }
-     return v[0];
+     return move(v[0]);
 }
 
 helib::Ctxt Server::AddMany(vector<helib::Ctxt>& v){
+    TRACE_SPAN("AddMany");
+    if (v.empty()){
+        throw invalid_argument("ERROR: AddMany of no ciphertexts");
+    }
     int num_entries = v.size();
     int depth = ceil(log2(num_entries));
 
@@ -308,133 +1675,116 @@ helib::Ctxt Server::AddMany(vector<helib::Ctxt>& v){
         int jump_factor = pow(2, d);
         int skip_factor = 2 * jump_factor;
 
-        for (int i = 0; i < num_entries; i+= skip_factor){
-            v[i] += v[i + jump_factor];
+        for (int i = 0; i + jump_factor < num_entries; i+= skip_factor){
+            counted::Add(v[i], v[i + jump_factor]);
         }
      }
-     return v[0];
+     return move(v[0]);
 }
 
 helib::Ctxt Server::SquashCtxt(helib::Ctxt& ciphertext, int num_data_elements){
+    TRACE_SPAN("SquashCtxt");
     const helib::EncryptedArray& ea = context->getEA();
 
-    helib::Ctxt result = ciphertext;
+    helib::Ctxt result = CtxtArena::Local().Take(ciphertext);
     
     for (int i = 1; i < num_data_elements; i++) {
-        ea.rotate(ciphertext, -(1));
-        result += ciphertext;
+        counted::Rotate(ea, ciphertext, -(1));
+        counted::Add(result, ciphertext);
     }
+    ObserveNoise("SquashCtxt", result);
     return result;
 }
 
-helib::Ctxt Server::SquashCtxtLogTime(helib::Ctxt& ciphertext){
+helib::Ctxt Server::SquashCtxtLogTime(const helib::Ctxt& ciphertext, int num_data_elements){
+    TRACE_SPAN("SquashCtxtLogTime");
     const helib::EncryptedArray& ea = context->getEA();
-
-    helib::Ctxt result = ciphertext;
-
-    int depth = ceil(log2(num_slots));
-
-    int shift = num_slots;
-    int decrease;
-    
-    for (int i = 0; i < depth; i++) {
-        if ((shift % 2) == 1){
-            decrease = (shift - 1) / 2;
-            shift = (shift + 1) / 2;
-        }
-        else{
-            decrease = shift / 2;
-            shift = shift - decrease;
+    CtxtArena& arena = CtxtArena::Local();
+    int elements = num_data_elements > 0 ? min(num_data_elements, num_slots) : num_slots;
+
+    // slot i of result holds the sum of the `window` slots from i on. The window doubles for every bit of
+    // elements and grows by one slot for every set bit, which sums each slot exactly once for any count
+    // (halving the shift double counts slots unless it is a power of two)
+    helib::Ctxt result = arena.Take(ciphertext);
+    int window = 1;
+    for (int bit = 30 - __builtin_clz(elements); bit >= 0; bit--){
+        helib::Ctxt shifted = arena.Take(result);
+        counted::Rotate(ea, shifted, -window);
+        counted::Add(result, shifted);
+        arena.Release(move(shifted));
+        window *= 2;
+
+        if ((elements >> bit) & 1){
+            counted::Rotate(ea, result, -1);
+            counted::Add(result, ciphertext);
+            window++;
         }
-
-        if (shift == 0)
-            continue;
-
-        ea.rotate(result, -(shift));
-        ciphertext += result;
-        result = ciphertext;
     }
-    return ciphertext;
+    ObserveNoise("SquashCtxtLogTime", result);
+    return result;
 }
 
-helib::Ctxt Server::EQTest(unsigned long a, helib::Ctxt& b){
-
-    helib::Ctxt clone = b;
-    helib::Ctxt result = b;
+helib::Ctxt Server::EQTest(unsigned long a, const helib::Ctxt& b){
+    TRACE_SPAN("EQTest");
+    // each polynomial is factored so that b is copied once and multiplied into the copy
+    helib::Ctxt result = CtxtArena::Local().Take(b);
     
     switch (a){
         case 0:
         {
-            //f(x) = x^2 / 2 - 3/2 x + 1
+            //f(x) = x^2 / 2 - 3/2 x + 1 = x (x - 3) / 2 + 1
             // 0 -> 1
             // 1 -> 0
             // 2 -> 0
-            result.square();
-
-            result.multByConstant(NTL::ZZX(one_over_two));
-            clone.multByConstant(NTL::ZZX(neg_three_over_two));
-            
-            result += clone;
-
-            result.addConstant(NTL::ZZX(1));
-            return result;
+            counted::AddConstant(result, NTL::ZZX(plaintext_modulus - 3));
+            counted::Multiply(result, b);
+            counted::MultByConstant(result, NTL::ZZX(one_over_two));
+            counted::AddConstant(result, NTL::ZZX(1));
+            break;
         }
         case 1:
         {
-            //f(x) = -x^2 + 2x 
+            //f(x) = -x^2 + 2x = x (2 - x)
             // 0 -> 0
             // 1 -> 1
             // 2 -> 0
-            clone.square();
-
-            result.multByConstant(NTL::ZZX(2));
-
-            result -= clone;
-            return result;
+            result.negate();
+            counted::AddConstant(result, NTL::ZZX(2));
+            counted::Multiply(result, b);
+            break;
         }
         case 2:{
-            //f(x) = x^2 / 2 - x / 2
+            //f(x) = x^2 / 2 - x / 2 = x (x - 1) / 2
             // 0 -> 0
             // 1 -> 0
             // 2 -> 1
-           
-            result.square();
-
-            result.multByConstant(NTL::ZZX(one_over_two)); 
-            clone.multByConstant(NTL::ZZX(neg_one_over_two));
-            
-            result += clone;
-            return result;
+            counted::AddConstant(result, NTL::ZZX(plaintext_modulus - 1));
+            counted::Multiply(result, b);
+            counted::MultByConstant(result, NTL::ZZX(one_over_two));
+            break;
         }
         default:
             cout << "Can't use a value of a other than 0, 1, or 2" << endl;
             throw invalid_argument("ERROR: invalid value for EQTest");
     }
+    ObserveNoise("EQTest", result);
+    return result;
 }
 
 vector<vector<helib::Ctxt>> Server::filter(vector<pair<int, int>>& query){
     vector<vector<helib::Ctxt>> feature_cols;
 
+    vector<ColumnRef> query_cols = PinColumns(QueryColumns(query));
     for(int j = 0; j < num_compressed_rows; j++){
-        vector<helib::Ctxt> indv_vector;
-        for(pair<int, int> i : query){
-            indv_vector.push_back(EQTest(i.second, encrypted_db[i.first][j]));
-            if (constants::DEBUG == 2){
-                cout << "checking equality to " << i.second << endl;
-                cout << "original:";
-                print_vector(Decrypt(encrypted_db[i.first][j]));
-                cout << "result  :"; 
-                print_vector(Decrypt(EQTest(i.second, encrypted_db[i.first][j])));
-            }
-        }
-        feature_cols.push_back(indv_vector);
+        feature_cols.push_back(FilterPredicates(query, query_cols, j));
     }
     return feature_cols;
 }
 
-vector<long> Server::Decrypt(helib::Ctxt ctxt){
+vector<long> Server::Decrypt(const helib::Ctxt& ctxt){
+    RequireSecretKey("Decrypt");
     helib::Ptxt<helib::BGV> new_plaintext_result(*context);
-    secret_key.Decrypt(new_plaintext_result, ctxt);
+    secret_key->Decrypt(new_plaintext_result, ctxt);
     
     vector<helib::PolyMod> poly_mod_result = new_plaintext_result.getSlotRepr();
     
@@ -447,14 +1797,15 @@ vector<long> Server::Decrypt(helib::Ctxt ctxt){
     return result; 
 }
 
-helib::Ptxt<helib::BGV> Server::DecryptPlaintext(helib::Ctxt ctxt){
-    
-    if (constants::DEBUG && ctxt.capacity() < 2){
-        cout << "NOISE BOUNDS EXCEEDED!!!" << endl;
+helib::Ptxt<helib::BGV> Server::DecryptPlaintext(const helib::Ctxt& ctxt){
+    RequireSecretKey("DecryptPlaintext");
+    double capacity = ctxt.capacity();
+    if (capacity < NOISE_THRES){
+        cerr << "WARNING: noise bounds exceeded, decrypting a ciphertext with " << capacity << " bits of capacity left" << endl;
     }
 
     helib::Ptxt<helib::BGV> new_plaintext_result(*context);
-    secret_key.Decrypt(new_plaintext_result, ctxt);
+    secret_key->Decrypt(new_plaintext_result, ctxt);
     
     return new_plaintext_result;
 }
@@ -487,8 +1838,23 @@ helib::Ctxt Server::Encrypt(vector<unsigned long> a){
     return ctxt; 
 }
 
-helib::Ctxt Server::GetAnyElement(){
-    return encrypted_db[0][0];
+SeededCtxt Server::EncryptSeeded(unsigned long a){
+    RequireSecretKey("EncryptSeeded");
+    if (!seeded_encryptor){
+        throw runtime_error("ERROR: seeded ciphertexts are not supported by this HElib serialization format");
+    }
+    helib::Ptxt<helib::BGV> ptxt(*context);
+
+    for (int i = 0; i < num_slots; i++)
+        ptxt[i] = a;
+
+    return seeded_encryptor->Encrypt(ptxt);
+}
+
+shared_ptr<const helib::Ctxt> Server::GetAnyElement(){
+    shared_lock<shared_mutex> lock(db_mutex);
+    ColumnRef column = Column(0);
+    return shared_ptr<const helib::Ctxt>(column, &(*column)[0]);
 }
 
 
@@ -500,6 +1866,8 @@ void Server::PrintContext(){
 }
 
 void Server::PrintEncryptedDB(bool with_headers){
+    shared_lock<shared_mutex> lock(db_mutex);
+
 	if (with_headers){
         vector<int> string_length_count = vector<int>();
 
@@ -514,7 +1882,7 @@ void Server::PrintEncryptedDB(bool with_headers){
             
             vector<vector<long>> temp_storage = vector<vector<long>>();
             for (int i = 0; i < num_cols; i++){
-                temp_storage.push_back(Decrypt(encrypted_db[i][j]));
+                temp_storage.push_back(Decrypt((*Column(i))[j]));
             }
             for (int jj = 0; jj < min(num_slots, num_rows - (j * num_slots)); jj++){
 
@@ -545,7 +1913,7 @@ void Server::PrintEncryptedDB(bool with_headers){
             
             vector<vector<long>> temp_storage = vector<vector<long>>();
             for (int i = 0; i < num_cols; i++){
-                temp_storage.push_back(Decrypt(encrypted_db[i][j]));
+                temp_storage.push_back(Decrypt((*Column(i))[j]));
             }
             for (int jj = 0; jj < min(num_slots, num_rows - (j * num_slots)); jj++){
 
@@ -572,6 +1940,11 @@ int Server::GetSlotSize(){
     return num_slots;
 }
 
+int Server::GetNumCols(){
+    shared_lock<shared_mutex> lock(db_mutex);
+    return num_cols;
+}
+
 // IMPORTED FROM HELIB SOURCE CODE
 inline long estimateCtxtSize(const helib::Context& context, long offset)
 {
@@ -644,6 +2017,84 @@ inline long estimateCtxtSize(const helib::Context& context, long offset)
   return size + offset;
 }
 
+MemoryReport Server::MemoryUsage(){
+    shared_lock<shared_mutex> lock(db_mutex);
+    MemoryReport report{};
+
+    // blocks at the same level have the same size, so one of each level is measured
+    map<long, size_t> bytes_per_level;
+    for (size_t i = 0; i < encrypted_db.size(); i++){
+        for (size_t j = 0; j < encrypted_db[i].size(); j++){
+            if (!seeded_db[i][j].empty()){
+                report.seeded_bytes += seeded_db[i][j].size();
+            }
+            if (column_expanded[i] || seeded_db[i][j].empty()){
+                long level = encrypted_db[i][j].getPrimeSet().card();
+                if (bytes_per_level.count(level) == 0){
+                    bytes_per_level[level] = measured_bytes(encrypted_db[i][j]);
+                }
+                report.db_bytes += bytes_per_level[level];
+                report.db_blocks++;
+            }
+        }
+    }
+    if (column_cache){
+        report.cache_bytes = column_cache->Stats().resident_bytes;
+    }
+
+    report.keys_bytes = key_bytes;
+    if (comparator_ready.load(memory_order_acquire)){
+        report.comparator_bytes = comparator_bytes;
+        report.comparator_estimate_bytes = comparator->memory_usage();
+    }
+
+    report.estimated_ctxt_bytes = estimateCtxtSize(*context, 0);
+    report.measured_ctxt_bytes = measured_bytes(Encrypt(0UL));
+
+    report.rss_bytes = CurrentRSS();
+    report.peak_rss_bytes = PeakRSS();
+    return report;
+}
+
+vector<QueryMemory> Server::QueryMemoryLog(){
+    lock_guard<mutex> guard(query_memory_mutex);
+    return vector<QueryMemory>(query_memory.begin(), query_memory.end());
+}
+
+vector<QueryOps> Server::QueryOpsLog(){
+    lock_guard<mutex> guard(query_ops_mutex);
+    return vector<QueryOps>(query_ops.begin(), query_ops.end());
+}
+
+vector<QueryNoise> Server::QueryNoiseLog(){
+    lock_guard<mutex> guard(query_noise_mutex);
+    return vector<QueryNoise>(query_noise.begin(), query_noise.end());
+}
+
+void Server::RecordQueryNoise(const QueryNoise& noise){
+    lock_guard<mutex> guard(query_noise_mutex);
+    query_noise.push_back(noise);
+    if (query_noise.size() > QUERY_MEMORY_LOG_SIZE){
+        query_noise.pop_front();
+    }
+}
+
+void Server::RecordQueryOps(const QueryOps& ops){
+    lock_guard<mutex> guard(query_ops_mutex);
+    query_ops.push_back(ops);
+    if (query_ops.size() > QUERY_MEMORY_LOG_SIZE){
+        query_ops.pop_front();
+    }
+}
+
+void Server::RecordQueryMemory(const QueryMemory& memory){
+    lock_guard<mutex> guard(query_memory_mutex);
+    query_memory.push_back(memory);
+    if (query_memory.size() > QUERY_MEMORY_LOG_SIZE){
+        query_memory.pop_front();
+    }
+}
+
 int Server::StorageOfOneElement(){
     if (!db_set){
         throw invalid_argument("ERROR: DB needs to be set to get storage cost");
@@ -651,3 +2102,10 @@ int Server::StorageOfOneElement(){
 
     return estimateCtxtSize(*context, 0);
 }
+
+long Server::ComparatorMemory(){
+    if (!comparator_ready.load(memory_order_acquire)){
+        return 0;
+    }
+    return comparator->memory_usage();
+}
@@ -2,16 +2,36 @@
 
 #include <iostream>
 #include <helib/helib.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
 #include <memory>
+#include <map>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <thread>
 #include <string>
 #include <vector>
 #include "globals.hpp"
+#include "io.hpp"
+#include "memory.hpp"
+#include "noise.hpp"
+#include "ops.hpp"
+#include "column_cache.hpp"
+#include "cost.hpp"
 #include "comparator.hpp"
+#include "seeded.hpp"
 #include "tools.hpp"
+#include "worker_pool.hpp"
 
 #define MAX_NUMBER_BITS 4
 #define NOISE_THRES 2
 #define WARN false
+// number of recent queries whose memory, operation counts and noise are kept
+#define QUERY_MEMORY_LOG_SIZE 256
 
 using namespace std;
 
@@ -19,45 +39,246 @@ class Server{
 public:
     
     //Setup
-    Server(const helib::Context &context);
+    // query_threads: size of the pool the blocks of all queries run on (0 = all hardware threads)
+    Server(const helib::Context &context, int query_threads = constants::QUERY_THREADS);
+    // evaluation only: the server holds the client's public key (with its key-switching matrices) and no secret
+    // key, so it encrypts the DB under the client's key and cannot decrypt; see client.hpp and protocol.hpp
+    Server(const helib::PubKey &public_key, int query_threads = constants::QUERY_THREADS);
+    ~Server();
+    // random genotypes (a SyntheticCohort without phenotype), see cohort.hpp for cohorts with a plaintext copy
     void GenData(int _num_rows, int _num_cols);
     void SetData(vector<vector<unsigned long>> &db);
     void SetColumnHeaders(vector<string> &headers);
+    // appends rows (same column-major layout as SetData) without re-encrypting existing blocks
+    void AppendRows(vector<vector<unsigned long>> &rows);
+    // encrypts new SNP columns (one value per row) in parallel and attaches them
+    void AddColumns(vector<vector<unsigned long>> &cols, vector<string> headers = vector<string>(), int num_threads = 0);
+    // zeroes the row in the stored blocks and masks it out of every filter from then on; costs its block a
+    // constant multiplication's worth of capacity
+    void DeleteRow(int row);
+    // repacks blocks in the background under the public key: the last live row is masked and rotated into each
+    // deleted slot, at a constant multiplication and a rotation's worth of capacity for the blocks involved.
+    // Row indices past the first deleted row are not stable: moved(from, to) is called, under the DB lock, for
+    // every row that moves. A failure stops compaction and is rethrown by WaitForCompaction
+    void StartCompaction(function<void(int, int)> moved = nullptr);
+    void WaitForCompaction();
+    // persisted DB: blocks that were never modified are written in seeded (half-size) form
+    void SaveDB(const string& path);
+    void LoadDB(const string& path);
+    // serves a saved DB out-of-core: columns are paged in on demand into an LRU cache of memory_budget bytes,
+    // prefetched from the columns each query names. The opened DB is read-only
+    void OpenDB(const string& path, size_t memory_budget);
+    // hits, misses and evictions of the column cache (all zero unless the DB was opened out-of-core)
+    ColumnCacheStats CacheStats();
+    // streams a VCF file into encrypted blocks; memory stays bounded by the queue sizes, not the cohort
+    void LoadVCF(const string& path, int num_threads = 0);
+    // maps a PLINK .bed/.bim/.fam fileset and decodes it block by block straight into plaintext slots
+    void LoadPLINK(const string& prefix, int num_threads = 0);
+    // encrypts _num_cols x _num_rows values in parallel; fill(col, block, ptxt) writes the block's slots
+    void LoadBlocks(int _num_rows, int _num_cols, function<void(int, int, helib::Ptxt<helib::BGV>&)> fill, int num_threads = 0);
+    // declares the multiplicative depth of a query that will run; blocks are kept mod-switched down to the
+    // fewest primes the deepest registered profile needs (e.g. CountingQuery with n predicates: 1 + ceil(log2 n),
+    // MAFQuery one more). Register profiles before loading data, lowered blocks cannot be raised again; queries
+    // deeper than the deepest profile are rejected
+    void RegisterQueryProfile(int depth);
+    // bytes saved by the lowered blocks compared to the full chain
+    long StorageLevelSavings();
     
+    // cost model: latencies of the primitives on this context, measured on first use (or again here)
+    PrimitiveCosts Costs();
+    PrimitiveCosts CalibrateCosts(int runs = constants::COST_CALIBRATION_RUNS);
+    // predicted latency, memory and depth of a query on the current DB
+    QueryEstimate EstimateCountingQuery(bool conjunctive, size_t predicates);
+    QueryEstimate EstimateMAFQuery(bool conjunctive, size_t predicates);
+    QueryEstimate EstimateDistrubtionQuery(size_t params);
+    QueryEstimate EstimateSimilarityQuery(size_t d_size);
+    // asked with the estimate before every query starts; an empty policy (the default) admits everything
+    void SetAdmissionPolicy(AdmissionPolicy policy);
+
     //Querries
     helib::Ctxt CountingQuery(bool conjunctive, vector<pair<int, int>>& query);
     pair<helib::Ctxt, helib::Ctxt> MAFQuery(int snp, bool conjunctive, vector<pair<int, int>> &query);
     vector<helib::Ctxt> DistrubtionQuery(vector<pair<int, int>>& prs_params);
     pair<helib::Ctxt, helib::Ctxt> SimilarityQuery(int target_column, vector<helib::Ctxt>& d, int threshold);
+    pair<helib::Ctxt, helib::Ctxt> SimilarityQuery(int target_column, vector<SeededCtxt>& d, int threshold);
 
     
     void AddOneMod2(helib::Ctxt& a);
+    // accumulate in place into v[0] and move it out; v is consumed
     helib::Ctxt MultiplyMany(vector<helib::Ctxt>& v);
     helib::Ctxt AddMany(vector<helib::Ctxt>& v);
     helib::Ctxt SquashCtxt(helib::Ctxt& ciphertext, int num_data_entries = 10);
-    helib::Ctxt SquashCtxtLogTime(helib::Ctxt& ciphertext);
-    helib::Ctxt EQTest(unsigned long a, helib::Ctxt& b);
+    // the sum of the first num_data_elements slots (0 = all of them, then in every slot) in slot 0, in
+    // O(log num_data_elements) rotations; ciphertext is left as it is
+    helib::Ctxt SquashCtxtLogTime(const helib::Ctxt& ciphertext, int num_data_elements = 0);
+    helib::Ctxt EQTest(unsigned long a, const helib::Ctxt& b);
+    // predicate ciphertexts of every block; the queries themselves stream blocks through FilterBlock instead
     vector<vector<helib::Ctxt>> filter(vector<pair<int, int>>& query);
     
     //Encrypt / Decrypt Methods
-    helib::Ptxt<helib::BGV> DecryptPlaintext(helib::Ctxt ctxt);
-    vector<long> Decrypt(helib::Ctxt ctxt);
+    const helib::PubKey& PublicKey() const { return public_key; }
+    bool HasSecretKey() const { return secret_key != nullptr; }
+    // the decrypting methods and EncryptSeeded need the secret key
+    helib::Ptxt<helib::BGV> DecryptPlaintext(const helib::Ctxt& ctxt);
+    vector<long> Decrypt(const helib::Ctxt& ctxt);
     helib::Ctxt Encrypt(unsigned long a);
     helib::Ctxt Encrypt(vector<unsigned long> a);
-    helib::Ctxt GetAnyElement();
+    // symmetric-key encryption in seeded form, for uploads
+    SeededCtxt EncryptSeeded(unsigned long a);
+    // pins the block instead of copying it
+    shared_ptr<const helib::Ctxt> GetAnyElement();
     
     void PrintContext();
     void PrintEncryptedDB(bool with_headers);
     int GetSlotSize();
+    int GetNumCols();
+    // threads of the pool the queries' blocks run on
+    int QueryThreads() const { return query_pool.Size(); }
 
+    // estimate from HElib's serialization code; MemoryUsage reports the measured bytes next to it
     int StorageOfOneElement();
+    // measured bytes per component (DB, seeded blocks, cache, keys, comparator) and the process RSS
+    MemoryReport MemoryUsage();
+    // peak RSS of the most recent queries
+    vector<QueryMemory> QueryMemoryLog();
+    // homomorphic operations of the most recent queries, in total and by stage
+    vector<QueryOps> QueryOpsLog();
+    // capacity left after each stage of the most recent queries; a query whose result would not decrypt
+    // (predicted from the inputs before it starts, or observed after a stage) throws instead of finishing
+    vector<QueryNoise> QueryNoiseLog();
+    // bytes held by the comparator, 0 until the first query that needs it
+    long ComparatorMemory();
     
 private:
+    // builds the comparator on first use; safe to call from concurrent queries
+    const he_cmp::Comparator& GetComparator();
+    void RecordQueryMemory(const QueryMemory& memory);
+    void RecordQueryOps(const QueryOps& ops);
+    void RecordQueryNoise(const QueryNoise& noise);
+    // state both constructors set up once the keys are in place
+    void Init();
+    void RequireSecretKey(const string& operation);
+
+    // capacity costs of a multiplication, of a multiplication by a full-size constant and of a rotation, measured
+    // once; the comparator's depth comes from the simulator
+    void CalibrateNoise();
+    // smallest capacity of the blocks of the given columns
+    double InputCapacity(const vector<ColumnRef>& cols);
+    // capacity FilterBlock consumes for a query with the given number of predicates
+    double FilterCost(size_t predicates);
+    // capacity the squash consumes over num_data_elements slots
+    double SquashCost(int num_data_elements);
+    // slots the queries squash: every row of the DB, folded into one block by the sum over blocks
+    int SquashWindow();
+    // capacity a comparison consumes: the largest drop seen once one has run, the simulated depth until then
+    double CompareCost();
+    // keeps the largest capacity drop seen across a comparison and a running mean of its latency
+    void LearnCompareCost(double bits, double seconds);
+
+    // estimates for the queries, with the DB lock held
+    QueryEstimate CountingQueryCost(bool conjunctive, size_t predicates);
+    QueryEstimate MAFQueryCost(bool conjunctive, size_t predicates);
+    QueryEstimate DistrubtionQueryCost(size_t params);
+    QueryEstimate SimilarityQueryCost(size_t d_size);
+    // operations FilterBlock runs on one block, and one comparison (measured once one has run)
+    OpCounts FilterOps(bool conjunctive, size_t predicates);
+    OpCounts CompareOps();
+    // fills in latency, given the operations of one block, of the blocks' serial tail and the parallelism
+    void EstimateLatency(QueryEstimate& estimate, const OpCounts& block_ops, const OpCounts& tail_ops, double block_extra_s);
+    // waits or throws as the admission policy decides; the query is running while the returned token is held.
+    // Called before the query takes the DB lock
+    shared_ptr<void> Admit(function<QueryEstimate()> estimate);
+
+    // streaming query pipeline: blocks are filtered, reduced and accumulated QUERY_BLOCK_WINDOW at a time on the
+    // shared query pool, so several queries can be in flight with bounded memory each
+    void StreamBlocks(QueryMemoryScope& scope, function<void(int)> block);
+    vector<int> QueryColumns(const vector<pair<int, int>>& query);
+    vector<ColumnRef> PinColumns(const vector<int>& col_ids);
+    vector<helib::Ctxt> FilterPredicates(vector<pair<int, int>>& query, const vector<ColumnRef>& query_cols, int block);
+    // conjunction (or disjunction) of the predicates on one block, with deleted rows masked out
+    helib::Ctxt FilterBlock(bool conjunctive, vector<pair<int, int>>& query, const vector<ColumnRef>& query_cols, int block);
+
+    // loaders that produce blocks out of order: reset the DB for _num_rows rows, then store blocks as they are encrypted
+    void BeginLoad(int _num_rows);
+    // encrypts in seeded form when the server has the secret key, as a full public-key ciphertext otherwise
+    void StoreBlock(int col, int block, const helib::Ptxt<helib::BGV>& ptxt);
+    void StoreColumnHeader(int col, const string& header);
+    helib::Ptxt<helib::BGV> SlotsPlaintext(const unsigned char* values, int count);
+    // appends an empty column whose blocks arrive in seeded form
+    void AddSeededColumn();
+
+    // column i, with seeded blocks expanded on first use (their seeded form is kept); pinned while the reference is held
+    ColumnRef Column(int i);
+    void PrefetchColumns(const vector<int>& cols);
+    // block about to be modified: it is expanded and its seeded form is dropped
+    helib::Ctxt& MutableBlock(int i, int j);
+
+    // storage level: ciphertext primes for a query circuit of the given depth, measured on a probe ciphertext
+    helib::IndexSet MinimalPrimes(int depth);
+    // multiplicative depth of FilterBlock with the given number of predicates
+    static int FilterDepth(size_t predicates);
+    // rejects a query deeper than the profiles the blocks were lowered for
+    void RequireProfileDepth(const string& query, int depth);
+    void LowerToStorageLevel(helib::Ctxt& ctxt);
+
+    // DB files: header shared by LoadDB and OpenDB, parsed and checked before anything of the server changes;
+    // version 1 files have no column offset table, so only LoadDB reads them
+    struct DBFileHeader{
+        int version;
+        int num_rows;
+        int num_cols;
+        vector<string> column_headers;
+        set<int> deleted_rows;
+    };
+    DBFileHeader ReadDBHeader(istream& in, const string& path);
+    // resets the DB for the header's rows and takes its column headers and deleted rows
+    void ApplyDBHeader(DBFileHeader& header);
+    vector<helib::Ctxt> ReadColumn(int col, size_t& bytes);
+    void CloseDB();
+    void RequireInMemory(const string& operation);
+
+    // moves one row into the first hole; returns false when there is nothing left to compact
+    bool CompactStep(const function<void(int, int)>& moved);
+    // drops deleted rows (and emptied blocks) at the end of the DB
+    void TrimDeletedTail();
+    // 1 at the slot and 0 elsewhere (keep_only), or the reverse
+    NTL::ZZX SlotMask(int slot, bool keep_only);
+    // slot masks with 0 at the deleted rows of a block and at the free slots of the last block
+    void UpdateRowMask(int block);
+    void ApplyRowMask(helib::Ctxt& ctxt, int block);
+
     const helib::Context* context;
-    helib::SecKey secret_key;
+    // exactly one of them is set, public_key refers to it
+    unique_ptr<helib::SecKey> secret_key;
+    unique_ptr<helib::PubKey> evaluation_key;
     const helib::PubKey& public_key;
 
     unique_ptr<he_cmp::Comparator> comparator;
+    once_flag comparator_once;
+    atomic<bool> comparator_ready;
+    // heap bytes measured while the keys and the comparator were built
+    size_t key_bytes;
+    size_t comparator_bytes;
+    deque<QueryMemory> query_memory;
+    mutex query_memory_mutex;
+    deque<QueryOps> query_ops;
+    mutex query_ops_mutex;
+    deque<QueryNoise> query_noise;
+    mutex query_noise_mutex;
+    double mult_cost_bits;
+    double const_mult_cost_bits;
+    double rotate_cost_bits;
+    int compare_depth;
+    atomic<double> compare_cost_bits;
+
+    PrimitiveCosts primitive_costs;
+    mutex costs_mutex;
+    // seconds of one comparison, 0 until a similarity query ran one
+    atomic<double> compare_seconds;
+    AdmissionPolicy admission_policy;
+    int running_queries;
+    mutex admission_mutex;
+    condition_variable admission_changed;
     
     bool db_set;
     
@@ -67,11 +288,33 @@ private:
     int num_slots;
     
     vector<vector<helib::Ctxt>> encrypted_db; 
+    // storage form of the blocks that are unchanged since encryption and not expanded yet (empty otherwise)
+    vector<vector<SeededCtxt>> seeded_db;
+    vector<char> column_expanded;
+    mutex expand_mutex;
+    unique_ptr<SeededEncryptor> seeded_encryptor;
+    // empty until a query profile is registered (full chain)
+    helib::IndexSet storage_primes;
+    int max_profile_depth;
+    // out-of-core mode (OpenDB); encrypted_db and seeded_db stay empty
+    unique_ptr<MappedFile> db_file;
+    vector<uint64_t> column_offsets;
+    unique_ptr<ColumnCache> column_cache;
     vector<string> column_headers;
+    mutex load_mutex;
+
+    // queries hold it shared, updates (append, add/delete, compaction steps) hold it exclusively
+    shared_mutex db_mutex;
+    set<int> deleted_rows;
+    map<int, NTL::ZZX> row_masks;
+    thread compaction_thread;
+    // set by the compaction thread, read once it is joined
+    exception_ptr compaction_error;
     
     int one_over_two;
-    int neg_three_over_two;
-    int neg_one_over_two;
 
     int plaintext_modulus;
+
+    // shared by the blocks of all running queries
+    WorkerPool query_pool;
 };
\ No newline at end of file
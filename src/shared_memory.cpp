@@ -0,0 +1,469 @@
+#include "shared_memory.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <signal.h>
+#include <stdexcept>
+#include <streambuf>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+static const uint64_t REGION_MAGIC = 0x324d454d53524950; // "PIRSMEM2"
+// chunks start on this boundary, so a header never wraps around the end of a ring
+static const size_t CHUNK_ALIGN = 16;
+// a data chunk is never opened smaller than this; the end of the ring is skipped instead
+static const size_t MIN_CHUNK_DATA = 4096;
+static const size_t MIN_RING_BYTES = 1 << 16;
+
+enum ChunkKind : uint32_t{
+    CHUNK_BEGIN = 1, // value: the frame's message type
+    CHUNK_DATA,      // length bytes of payload follow
+    CHUNK_END,       // value: 1 if the sender abandoned the frame
+    CHUNK_WRAP       // the rest of the ring is unused, the next chunk is at its start
+};
+
+struct ChunkHeader{
+    uint32_t kind;
+    uint32_t value;
+    uint64_t length;
+};
+static_assert(sizeof(ChunkHeader) == CHUNK_ALIGN, "chunk headers fill one alignment unit");
+
+// one direction; head and tail count bytes since the start, on cache lines of their own
+struct SharedRing{
+    // published by the sender
+    alignas(64) atomic<uint64_t> head;
+    // handed back by the receiver
+    alignas(64) atomic<uint64_t> tail;
+    alignas(64) atomic<uint32_t> sender_closed;
+    atomic<uint32_t> receiver_closed;
+};
+
+struct SharedRegion{
+    atomic<uint64_t> magic;
+    uint64_t ring_bytes;
+    // [0]: creator to opener, [1]: opener to creator
+    SharedRing rings[2];
+    // process ids of the creator and the opener (0 until it opened), for noticing a peer that died
+    atomic<int32_t> pids[2];
+};
+static_assert(atomic<uint64_t>::is_always_lock_free && atomic<uint32_t>::is_always_lock_free
+              && atomic<int32_t>::is_always_lock_free, "the rings are shared between processes");
+
+static size_t data_offset(){
+    return (sizeof(SharedRegion) + 4095) / 4096 * 4096;
+}
+
+static size_t round_up(size_t bytes){
+    return (bytes + CHUNK_ALIGN - 1) / CHUNK_ALIGN * CHUNK_ALIGN;
+}
+
+static double seconds_since(chrono::steady_clock::time_point start){
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// false once the peer's process is gone; a peer in this process, or one that has not opened yet, counts as alive
+static bool peer_alive(const atomic<int32_t>& peer_pid){
+    pid_t pid = peer_pid.load(memory_order_acquire);
+    return pid == 0 || pid == getpid() || kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+// yields for a while, then sleeps, so that waiting on a long query does not hold a core; returns the time waited.
+// A peer that died without closing its end ends the wait too, so the caller has to check ready() again
+template<typename Ready>
+static double wait_until(Ready ready, const atomic<int32_t>& peer_pid){
+    if (ready()){
+        return 0;
+    }
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; !ready(); i++){
+        if (i < 1024){
+            this_thread::yield();
+        }
+        else{
+            this_thread::sleep_for(chrono::microseconds(50));
+            // checked about every 50 ms of sleeping
+            if (i % 1024 == 0 && !peer_alive(peer_pid)){
+                break;
+            }
+        }
+    }
+    return seconds_since(start);
+}
+
+// sending end of a ring: the put area is the unused part of the chunk being filled, inside the ring itself
+class RingWriter : public streambuf{
+public:
+    RingWriter(SharedRing& _ring, char* _data, size_t _capacity, TransportStats& _stats, const atomic<int32_t>& _peer_pid)
+        : ring(_ring), data(_data), capacity(_capacity), stats(_stats), peer_pid(_peer_pid){
+        head = ring.head.load(memory_order_acquire);
+    }
+
+    void Begin(uint32_t type){
+        if (in_frame){
+            // the previous frame failed half-way; its receiver gets an error instead of a truncated payload
+            Commit();
+            Control(CHUNK_END, 1);
+        }
+        frame_start = head;
+        Control(CHUNK_BEGIN, type);
+        in_frame = true;
+    }
+
+    void End(){
+        if (!in_frame){
+            throw logic_error("ERROR: EndFrame without BeginFrame");
+        }
+        Commit();
+        Control(CHUNK_END, 0);
+        in_frame = false;
+        stats.frames_sent++;
+        stats.bytes_sent += head - frame_start;
+    }
+
+protected:
+    int_type overflow(int_type c) override{
+        if (!in_frame){
+            return traits_type::eof();
+        }
+        Commit();
+        Open();
+        if (!traits_type::eq_int_type(c, traits_type::eof())){
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    int sync() override{
+        if (in_frame){
+            Commit();
+        }
+        return 0;
+    }
+
+private:
+    // waits until bytes more fit behind the receiver's tail
+    void Reserve(size_t bytes){
+        auto fits = [&](){
+            if (ring.receiver_closed.load(memory_order_acquire)){
+                throw runtime_error("ERROR: the peer closed the shared-memory connection");
+            }
+            return head + bytes - ring.tail.load(memory_order_acquire) <= capacity;
+        };
+        stats.send_s += wait_until(fits, peer_pid);
+        if (!fits()){
+            throw runtime_error("ERROR: the peer process exited without closing the shared-memory connection");
+        }
+    }
+
+    void Publish(){
+        ring.head.store(head, memory_order_release);
+    }
+
+    void Control(ChunkKind kind, uint32_t value){
+        Reserve(sizeof(ChunkHeader));
+        ChunkHeader header{kind, value, 0};
+        memcpy(data + head % capacity, &header, sizeof(header));
+        head += sizeof(header);
+        Publish();
+    }
+
+    // starts a data chunk as large as the contiguous free space allows
+    void Open(){
+        size_t offset = head % capacity;
+        size_t room = capacity - offset;
+        if (room < sizeof(ChunkHeader) + MIN_CHUNK_DATA){
+            Reserve(room);
+            ChunkHeader header{CHUNK_WRAP, 0, 0};
+            memcpy(data + offset, &header, sizeof(header));
+            head += room;
+            offset = 0;
+            room = capacity;
+        }
+        Reserve(sizeof(ChunkHeader) + MIN_CHUNK_DATA);
+        size_t free = capacity - (head - ring.tail.load(memory_order_acquire));
+        size_t size = min({room, free, sizeof(ChunkHeader) + constants::SHM_CHUNK_BYTES}) - sizeof(ChunkHeader);
+        chunk = data + offset;
+        setp(chunk + sizeof(ChunkHeader), chunk + sizeof(ChunkHeader) + size);
+    }
+
+    // writes the header of the chunk being filled and hands it to the receiver
+    void Commit(){
+        if (!chunk){
+            return;
+        }
+        size_t length = pptr() - pbase();
+        if (length > 0){
+            ChunkHeader header{CHUNK_DATA, 0, length};
+            memcpy(chunk, &header, sizeof(header));
+            head += sizeof(header) + round_up(length);
+            Publish();
+        }
+        chunk = nullptr;
+        setp(nullptr, nullptr);
+    }
+
+    SharedRing& ring;
+    char* data;
+    size_t capacity;
+    TransportStats& stats;
+    const atomic<int32_t>& peer_pid;
+    uint64_t head;
+    uint64_t frame_start = 0;
+    char* chunk = nullptr;
+    bool in_frame = false;
+};
+
+// receiving end of a ring: the get area is the payload of one chunk, read where the sender wrote it
+class RingReader : public streambuf{
+public:
+    RingReader(SharedRing& _ring, const char* _data, size_t _capacity, TransportStats& _stats, const atomic<int32_t>& _peer_pid,
+               const size_t& _max_frame_bytes)
+        : ring(_ring), data(_data), capacity(_capacity), stats(_stats), peer_pid(_peer_pid), max_frame_bytes(_max_frame_bytes){
+        tail = ring.tail.load(memory_order_acquire);
+    }
+
+    // false when the sender closed the connection between frames
+    bool Begin(uint32_t& type){
+        End();
+        const ChunkHeader* header = Next();
+        if (!header){
+            return false;
+        }
+        if (header->kind != CHUNK_BEGIN){
+            throw runtime_error("ERROR: malformed shared-memory frame");
+        }
+        type = header->value;
+        frame_start = tail;
+        payload_bytes = 0;
+        Release(sizeof(ChunkHeader));
+        in_frame = true;
+        ended = false;
+        return true;
+    }
+
+    // skips what is left of the current frame
+    void End(){
+        if (!in_frame){
+            return;
+        }
+        draining = true;
+        while (!ended){
+            setg(nullptr, nullptr, nullptr);
+            underflow();
+        }
+        draining = false;
+        in_frame = false;
+        stats.frames_received++;
+        stats.bytes_received += tail - frame_start;
+    }
+
+protected:
+    int_type underflow() override{
+        if (gptr() < egptr()){
+            return traits_type::to_int_type(*gptr());
+        }
+        if (!in_frame || ended){
+            return traits_type::eof();
+        }
+        if (chunk_bytes > 0){
+            Release(chunk_bytes);
+            chunk_bytes = 0;
+            setg(nullptr, nullptr, nullptr);
+        }
+        const ChunkHeader* header = Next();
+        if (!header){
+            ended = true;
+            throw runtime_error("ERROR: connection closed in the middle of a frame");
+        }
+        if (header->kind == CHUNK_END){
+            bool abandoned = header->value != 0;
+            Release(sizeof(ChunkHeader));
+            ended = true;
+            if (abandoned && !draining){
+                throw runtime_error("ERROR: the sender abandoned the frame");
+            }
+            return traits_type::eof();
+        }
+        if (header->kind != CHUNK_DATA || sizeof(ChunkHeader) + header->length > capacity - tail % capacity){
+            throw runtime_error("ERROR: malformed shared-memory frame");
+        }
+        payload_bytes += header->length;
+        if (payload_bytes > max_frame_bytes && !draining){
+            throw runtime_error("ERROR: frame exceeds the limit of " + to_string(max_frame_bytes) + " bytes");
+        }
+        char* begin = const_cast<char*>(reinterpret_cast<const char*>(header)) + sizeof(ChunkHeader);
+        setg(begin, begin, begin + header->length);
+        chunk_bytes = sizeof(ChunkHeader) + round_up(header->length);
+        return traits_type::to_int_type(*gptr());
+    }
+
+private:
+    // the next chunk's header, past a wrap; nullptr if the sender closed (or died) and left nothing more
+    const ChunkHeader* Next(){
+        while (true){
+            stats.receive_s += wait_until([&](){
+                return ring.head.load(memory_order_acquire) > tail || ring.sender_closed.load(memory_order_acquire);
+            }, peer_pid);
+            if (ring.head.load(memory_order_acquire) == tail){
+                return nullptr;
+            }
+            const ChunkHeader* header = reinterpret_cast<const ChunkHeader*>(data + tail % capacity);
+            if (header->kind != CHUNK_WRAP){
+                return header;
+            }
+            Release(capacity - tail % capacity);
+        }
+    }
+
+    // hands bytes of the ring back to the sender
+    void Release(size_t bytes){
+        tail += bytes;
+        ring.tail.store(tail, memory_order_release);
+    }
+
+    SharedRing& ring;
+    const char* data;
+    size_t capacity;
+    TransportStats& stats;
+    const atomic<int32_t>& peer_pid;
+    uint64_t tail;
+    const size_t& max_frame_bytes;
+    uint64_t frame_start = 0;
+    uint64_t payload_bytes = 0;
+    size_t chunk_bytes = 0;
+    bool in_frame = false;
+    bool ended = false;
+    bool draining = false;
+};
+
+static void check_name(const string& name){
+    if (name.size() < 2 || name[0] != '/' || name.find('/', 1) != string::npos){
+        throw invalid_argument("ERROR: shared-memory name " + name + " must be one '/' followed by a name");
+    }
+}
+
+unique_ptr<SharedMemoryConnection> SharedMemoryConnection::Create(const string& name, size_t ring_bytes){
+    check_name(name);
+    if (ring_bytes < MIN_RING_BYTES || ring_bytes % 4096 != 0){
+        throw invalid_argument("ERROR: a shared-memory ring needs a multiple of 4096 bytes, at least " + to_string(MIN_RING_BYTES));
+    }
+    size_t mapped_bytes = data_offset() + 2 * ring_bytes;
+
+    // an existing region may belong to a live connection, so it is never replaced
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0 && errno == EEXIST){
+        throw runtime_error("ERROR: shared memory " + name + " already exists; another connection uses the name, or a crashed "
+                            "run left it behind (remove /dev/shm" + name + ")");
+    }
+    if (fd < 0){
+        throw runtime_error("ERROR: cannot create shared memory " + name + ": " + string(strerror(errno)));
+    }
+    if (ftruncate(fd, mapped_bytes) != 0){
+        string reason = strerror(errno);
+        close(fd);
+        shm_unlink(name.c_str());
+        throw runtime_error("ERROR: cannot size shared memory " + name + ": " + reason);
+    }
+    void* address = mmap(nullptr, mapped_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (address == MAP_FAILED){
+        shm_unlink(name.c_str());
+        throw runtime_error("ERROR: cannot map shared memory " + name + ": " + string(strerror(errno)));
+    }
+
+    SharedRegion* region = new (address) SharedRegion();
+    region->ring_bytes = ring_bytes;
+    region->pids[0].store(getpid(), memory_order_relaxed);
+    region->pids[1].store(0, memory_order_relaxed);
+    region->magic.store(REGION_MAGIC, memory_order_release);
+    return unique_ptr<SharedMemoryConnection>(new SharedMemoryConnection(name, true, region, mapped_bytes));
+}
+
+unique_ptr<SharedMemoryConnection> SharedMemoryConnection::Open(const string& name){
+    check_name(name);
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0){
+        throw runtime_error("ERROR: cannot open shared memory " + name + ": " + string(strerror(errno)));
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < data_offset()){
+        close(fd);
+        throw runtime_error("ERROR: shared memory " + name + " is not a connection");
+    }
+    size_t mapped_bytes = info.st_size;
+    void* address = mmap(nullptr, mapped_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (address == MAP_FAILED){
+        throw runtime_error("ERROR: cannot map shared memory " + name + ": " + string(strerror(errno)));
+    }
+
+    SharedRegion* region = static_cast<SharedRegion*>(address);
+    if (region->magic.load(memory_order_acquire) != REGION_MAGIC || data_offset() + 2 * region->ring_bytes != mapped_bytes){
+        munmap(address, mapped_bytes);
+        throw runtime_error("ERROR: shared memory " + name + " is not a connection");
+    }
+    if (!peer_alive(region->pids[0])){
+        munmap(address, mapped_bytes);
+        throw runtime_error("ERROR: the process that created shared memory " + name + " has exited");
+    }
+    region->pids[1].store(getpid(), memory_order_release);
+    return unique_ptr<SharedMemoryConnection>(new SharedMemoryConnection(name, false, region, mapped_bytes));
+}
+
+SharedMemoryConnection::SharedMemoryConnection(const string& _name, bool _creator, SharedRegion* _region, size_t _mapped_bytes)
+    : name(_name), creator(_creator), region(_region), mapped_bytes(_mapped_bytes), out(nullptr), in(nullptr){
+    int sending = creator ? 0 : 1;
+    char* base = reinterpret_cast<char*>(region) + data_offset();
+    size_t ring_bytes = region->ring_bytes;
+    const atomic<int32_t>& peer_pid = region->pids[1 - sending];
+    writer.reset(new RingWriter(region->rings[sending], base + sending * ring_bytes, ring_bytes, stats, peer_pid));
+    reader.reset(new RingReader(region->rings[1 - sending], base + (1 - sending) * ring_bytes, ring_bytes, stats, peer_pid,
+                                max_frame_bytes));
+    out.rdbuf(writer.get());
+    in.rdbuf(reader.get());
+    // the rings report a closed peer by throwing; the streams pass that on instead of only setting badbit
+    out.exceptions(ios::badbit);
+    in.exceptions(ios::badbit);
+}
+
+SharedMemoryConnection::~SharedMemoryConnection(){
+    int sending = creator ? 0 : 1;
+    region->rings[sending].sender_closed.store(1, memory_order_release);
+    region->rings[1 - sending].receiver_closed.store(1, memory_order_release);
+    munmap(region, mapped_bytes);
+    if (creator){
+        shm_unlink(name.c_str());
+    }
+}
+
+ostream& SharedMemoryConnection::BeginFrame(uint32_t type){
+    writer->Begin(type);
+    out.clear();
+    return out;
+}
+
+void SharedMemoryConnection::EndFrame(){
+    out.flush();
+    writer->End();
+}
+
+istream* SharedMemoryConnection::NextFrame(uint32_t& type){
+    if (!reader->Begin(type)){
+        return nullptr;
+    }
+    in.clear();
+    return &in;
+}
+
+void SharedMemoryConnection::ReleaseFrame(){
+    reader->End();
+}
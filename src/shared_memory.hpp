@@ -0,0 +1,56 @@
+/*
+Shared-memory transport for a Client and a Server on the same host. Both ends map one POSIX shared-memory region
+holding a ring buffer per direction. The sender serializes a frame's payload straight into its ring and the
+receiver parses it in place, so a ciphertext is written once and never copied through a socket or an intermediate
+buffer. Frames larger than a ring stream through it in chunks
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include "globals.hpp"
+#include "transport.hpp"
+
+using namespace std;
+
+struct SharedRegion;
+class RingWriter;
+class RingReader;
+
+class SharedMemoryConnection : public Connection{
+public:
+    // creates the region (e.g. "/pir.1234"), failing if the name exists; ring_bytes per direction
+    static unique_ptr<SharedMemoryConnection> Create(const string& name, size_t ring_bytes = constants::SHM_RING_BYTES);
+    // maps a region another thread or process created, after its Create returned. Either end notices a peer
+    // process that exited without closing, within some 50 ms of waiting on it
+    static unique_ptr<SharedMemoryConnection> Open(const string& name);
+    // the peer sees the connection closed; the creator also removes the region's name
+    ~SharedMemoryConnection() override;
+
+    SharedMemoryConnection(const SharedMemoryConnection&) = delete;
+    SharedMemoryConnection& operator=(const SharedMemoryConnection&) = delete;
+
+    // the stream writes into the ring; chunks become visible to the peer as they fill, the rest at EndFrame
+    ostream& BeginFrame(uint32_t type) override;
+    void EndFrame() override;
+    // the stream reads from the ring, and each chunk is handed back to the sender once read
+    istream* NextFrame(uint32_t& type) override;
+    void ReleaseFrame() override;
+
+    const string& Name() const { return name; }
+
+private:
+    SharedMemoryConnection(const string& name, bool creator, SharedRegion* region, size_t mapped_bytes);
+
+    string name;
+    bool creator;
+    SharedRegion* region;
+    size_t mapped_bytes;
+    unique_ptr<RingWriter> writer;
+    unique_ptr<RingReader> reader;
+    ostream out;
+    istream in;
+};
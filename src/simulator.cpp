@@ -0,0 +1,319 @@
+#include "simulator.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+// log2(2^a + 2^b)
+static double log_add(double a, double b){
+    double high = max(a, b);
+    return high + log2(1 + exp2(min(a, b) - high));
+}
+
+static long gcd_long(long a, long b){
+    while (b != 0){
+        long t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+NoiseParams NoiseParams::FromContext(unsigned long m, unsigned long p, unsigned long bits){
+    if (m < 2 || p < 2 || gcd_long(m, p) != 1){
+        throw invalid_argument("ERROR: m and p must be coprime and at least 2");
+    }
+    NoiseParams params;
+    params.m = m;
+    params.p = p;
+
+    long phi = m;
+    long rest = m;
+    for (long f = 2; f * f <= rest; f++){
+        if (rest % f == 0){
+            phi -= phi / f;
+            while (rest % f == 0){
+                rest /= f;
+            }
+        }
+    }
+    if (rest > 1){
+        phi -= phi / rest;
+    }
+    params.phi_m = phi;
+
+    // slots = phi(m) / ord_m(p)
+    long order = 1;
+    for (unsigned long power = p % m; power != 1; power = power * p % m){
+        order++;
+    }
+    params.slots = phi / order;
+
+    // HElib's high-probability bounds (scale 10) for a dense ternary secret key (variance 1/2) and error of
+    // standard deviation 3.2: a mod-switch adds p * sqrt(phi(m) * (1 + phi(m)/2) / 12) * scale, a fresh
+    // encryption carries p * scale * 3.2 * sqrt(phi(m)) * sqrt(phi(m)/2 + 1). Key switching uses special primes
+    // chosen to keep its noise at the mod-switch floor
+    const double scale = 10;
+    const double sigma = 3.2;
+    params.q_bits = bits;
+    params.floor_bits = log2(p * sqrt(phi * (1 + phi / 2.0) / 12.0) * scale);
+    params.fresh_bits = log2(p * scale * sigma * sqrt((double)phi) * sqrt(phi / 2.0 + 1));
+    params.key_switch_bits = params.floor_bits;
+    return params;
+}
+
+void NoiseParams::Print(ostream& out) const{
+    out << "m " << m << ", p " << p << ", phi(m) " << phi_m << ", slots " << slots << ", modulus " << q_bits
+        << " bits, fresh noise " << fresh_bits << " bits, mod-switch floor " << floor_bits << " bits, key switch "
+        << key_switch_bits << " bits" << endl;
+}
+
+NoiseSimulator::NoiseSimulator(const NoiseParams& params): params(params){
+}
+
+SimCtxt NoiseSimulator::Fresh() const{
+    return SimCtxt{params.q_bits, params.fresh_bits, 0};
+}
+
+SimCtxt NoiseSimulator::WithCapacity(double capacity_bits) const{
+    SimCtxt fresh = Fresh();
+    if (capacity_bits <= 0 || capacity_bits >= fresh.Capacity()){
+        return fresh;
+    }
+    return SimCtxt{capacity_bits + params.floor_bits, params.floor_bits, 0};
+}
+
+SimCtxt NoiseSimulator::ModDown(const SimCtxt& a, double q_bits) const{
+    if (q_bits >= a.q_bits){
+        return a;
+    }
+    double dropped = a.q_bits - q_bits;
+    return SimCtxt{q_bits, log_add(a.noise_bits - dropped, params.floor_bits), a.depth};
+}
+
+SimCtxt NoiseSimulator::ModDownToFloor(const SimCtxt& a) const{
+    if (a.noise_bits <= params.floor_bits + 1){
+        return a;
+    }
+    return ModDown(a, a.q_bits - (a.noise_bits - params.floor_bits));
+}
+
+SimCtxt NoiseSimulator::Add(const SimCtxt& a, const SimCtxt& b) const{
+    double q_bits = min(a.q_bits, b.q_bits);
+    SimCtxt x = ModDown(a, q_bits);
+    SimCtxt y = ModDown(b, q_bits);
+    return SimCtxt{q_bits, log_add(x.noise_bits, y.noise_bits), max(x.depth, y.depth)};
+}
+
+SimCtxt NoiseSimulator::Sum(const SimCtxt& a, long terms) const{
+    SimCtxt sum = a;
+    sum.noise_bits += log2((double)max(terms, 1L));
+    return sum;
+}
+
+SimCtxt NoiseSimulator::Multiply(const SimCtxt& a, const SimCtxt& b) const{
+    SimCtxt x = ModDownToFloor(a);
+    SimCtxt y = ModDownToFloor(b);
+    double q_bits = min(x.q_bits, y.q_bits);
+    x = ModDown(x, q_bits);
+    y = ModDown(y, q_bits);
+    // bounds multiply, then relinearization adds a key switch
+    return SimCtxt{q_bits, log_add(x.noise_bits + y.noise_bits, params.key_switch_bits), max(x.depth, y.depth) + 1};
+}
+
+SimCtxt NoiseSimulator::MultByConstant(const SimCtxt& a, double constant_bits) const{
+    SimCtxt product = a;
+    product.noise_bits += max(constant_bits, 0.0);
+    return product;
+}
+
+SimCtxt NoiseSimulator::Rotate(const SimCtxt& a) const{
+    SimCtxt rotated = a;
+    rotated.noise_bits = log_add(a.noise_bits, params.key_switch_bits);
+    return rotated;
+}
+
+// powers 1..n of a: powers of two by squaring, the others as x^k * x^(e-k) with k the largest power of two below e
+static vector<SimCtxt> powers(const NoiseSimulator& sim, const SimCtxt& a, long n){
+    vector<SimCtxt> v(1, a);
+    for (long e = 2; e <= n; e++){
+        long k = 1;
+        while (2 * k < e){
+            k *= 2;
+        }
+        v.push_back(2 * k == e ? sim.Square(v[k - 1]) : sim.Multiply(v[k - 1], v[e - k - 1]));
+    }
+    return v;
+}
+
+SimCtxt NoiseSimulator::Power(const SimCtxt& a, long e) const{
+    return powers(*this, a, max(e, 1L)).back();
+}
+
+double NoiseSimulator::SmallConstantBits(long c) const{
+    long p = params.p;
+    long centered = min(((c % p) + p) % p, p - ((c % p) + p) % p);
+    return log2((double)max(centered, 1L));
+}
+
+double NoiseSimulator::PlaintextBits() const{
+    return log2(params.p / 2.0) + 0.5 * log2((double)params.phi_m);
+}
+
+SimCtxt NoiseSimulator::EQTest(const SimCtxt& x) const{
+    // the dearest case (a = 0): x (x - 3) / 2 + 1
+    SimCtxt result = Multiply(x, x);
+    return MultByConstant(result, SmallConstantBits((params.p + 1) / 2));
+}
+
+SimCtxt NoiseSimulator::MultiplyMany(const SimCtxt& a, long n) const{
+    SimCtxt result = a;
+    for (long width = 1; width < n; width *= 2){
+        result = Multiply(result, result);
+    }
+    return result;
+}
+
+SimCtxt NoiseSimulator::SquashCtxt(const SimCtxt& a, int num_data_elements) const{
+    SimCtxt result = a;
+    SimCtxt rotated = a;
+    for (int i = 1; i < num_data_elements; i++){
+        rotated = Rotate(rotated);
+        result = Add(result, rotated);
+    }
+    return result;
+}
+
+SimCtxt NoiseSimulator::SquashCtxtLogTime(const SimCtxt& a, int num_data_elements) const{
+    SimCtxt result = a;
+    for (int bit = 30 - __builtin_clz(max(num_data_elements, 1)); bit >= 0; bit--){
+        result = Add(result, Rotate(result));
+        if ((num_data_elements >> bit) & 1){
+            result = Add(Rotate(result), a);
+        }
+    }
+    return result;
+}
+
+CompareSteps CompareSteps::ForModulus(long p){
+    CompareSteps steps;
+    steps.degree = max(1L, (p - 3) / 2);
+    long kk = (long)sqrt(steps.degree / 2.0);
+    steps.baby_steps = 1;
+    while (steps.baby_steps < kk){
+        steps.baby_steps *= 2;
+    }
+    if ((steps.baby_steps == 16 && steps.degree > 167) || (steps.baby_steps > 16 && steps.baby_steps > 1.44 * kk)){
+        steps.baby_steps /= 2;
+    }
+    steps.giant_steps = (steps.degree + steps.baby_steps - 1) / steps.baby_steps;
+    return steps;
+}
+
+SimCtxt NoiseSimulator::Compare(const SimCtxt& x, const SimCtxt& y) const{
+    SimCtxt z = Add(x, y);
+    long p = params.p;
+    if (p <= 3){
+        return Add(z, MultByConstant(Square(z), SmallConstantBits(2)));
+    }
+
+    CompareSteps steps = CompareSteps::ForModulus(p);
+    long baby_steps = steps.baby_steps;
+    long giant_steps = steps.giant_steps;
+
+    SimCtxt z2 = Square(z);
+    vector<SimCtxt> baby = powers(*this, z2, baby_steps);
+    vector<SimCtxt> giant = powers(*this, baby.back(), giant_steps);
+
+    // baby-step polynomials (constants times baby powers), combined with the giant powers level by level
+    double coef_bits = SmallConstantBits(p / 2);
+    SimCtxt result = Sum(MultByConstant(baby.back(), coef_bits), baby_steps);
+    for (long level = 1; level < giant_steps; level *= 2){
+        result = Sum(Multiply(result, giant[level - 1]), 2);
+    }
+    result = Multiply(result, z);
+
+    SimCtxt top_term = Multiply(baby.back(), giant.back());
+    return Add(result, MultByConstant(top_term, coef_bits));
+}
+
+void SimResult::Print(ostream& out) const{
+    out << shape.query << " (" << shape.predicates << " predicates, " << (shape.conjunctive ? "conjunctive" : "disjunctive")
+        << ", " << blocks << " blocks)" << endl;
+    for (const auto& stage : stages){
+        out << "  " << stage.first << ": capacity " << stage.second.Capacity() << " bits, depth " << stage.second.depth << endl;
+    }
+    out << "  result: capacity " << result.Capacity() << " bits, depth " << result.depth << ", "
+        << (decrypts ? "decrypts" : "DOES NOT DECRYPT") << endl;
+}
+
+void SimResult::WriteJSON(ostream& out) const{
+    out << "{\"query\": \"" << shape.query << "\", \"predicates\": " << shape.predicates << ", \"conjunctive\": "
+        << (shape.conjunctive ? "true" : "false") << ", \"blocks\": " << blocks << ", \"stages\": [";
+    for (size_t i = 0; i < stages.size(); i++){
+        out << (i ? ", " : "") << "{\"stage\": \"" << stages[i].first << "\", \"capacity_bits\": " << stages[i].second.Capacity()
+            << ", \"depth\": " << stages[i].second.depth << "}";
+    }
+    out << "], \"capacity_bits\": " << result.Capacity() << ", \"depth\": " << result.depth << ", \"decrypts\": "
+        << (decrypts ? "true" : "false") << "}";
+}
+
+SimResult SimulateQuery(const NoiseParams& params, const QueryShape& shape, double min_bits){
+    if (shape.predicates <= 0 || shape.rows <= 0 || params.slots <= 0){
+        throw invalid_argument("ERROR: predicates, rows and slots must be positive");
+    }
+    NoiseSimulator sim(params);
+    SimResult sim_result;
+    sim_result.shape = shape;
+    sim_result.blocks = (shape.rows + params.slots - 1) / params.slots;
+    int squash = shape.squash > 0 ? shape.squash : (int)min(shape.rows, params.slots);
+    auto stage = [&sim_result](const string& name, const SimCtxt& ctxt){
+        sim_result.stages.push_back(pair(name, ctxt));
+        return ctxt;
+    };
+
+    SimCtxt block = sim.WithCapacity(shape.input_bits);
+    stage("input", block);
+
+    // FilterBlock, shared by counting and maf
+    auto filter = [&](){
+        SimCtxt predicate = stage("EQTest", sim.EQTest(block));
+        SimCtxt result = stage("MultiplyMany", sim.MultiplyMany(predicate, shape.predicates));
+        if (shape.masked){
+            result = stage("mask", sim.MultByConstant(result, sim.PlaintextBits()));
+        }
+        return result;
+    };
+
+    SimCtxt result;
+    if (shape.query == "counting"){
+        SimCtxt sum = stage("sum", sim.Sum(filter(), sim_result.blocks));
+        result = stage("SquashCtxtLogTime", sim.SquashCtxtLogTime(sum, squash));
+    }
+    else if (shape.query == "maf"){
+        SimCtxt filtered = filter();
+        SimCtxt freq = stage("frequency", sim.Multiply(block, filtered));
+        SimCtxt sum = stage("sum", sim.Sum(freq, sim_result.blocks));
+        result = stage("SquashCtxtLogTime", sim.SquashCtxtLogTime(sum, squash));
+    }
+    else if (shape.query == "distribution"){
+        SimCtxt weighted = stage("weight", sim.MultByConstant(block, sim.SmallConstantBits(params.p / 2)));
+        result = stage("score", sim.Sum(weighted, shape.predicates));
+    }
+    else if (shape.query == "similarity"){
+        // the query ciphertexts d come fresh from the client
+        SimCtxt diff = sim.Add(block, sim.Fresh());
+        SimCtxt score = stage("score", sim.Sum(sim.Square(diff), shape.predicates));
+        SimCtxt predicate = stage("compare", sim.Compare(score, sim.Fresh()));
+        SimCtxt count = stage("count", sim.Multiply(predicate, block));
+        SimCtxt sum = stage("sum", sim.Sum(count, sim_result.blocks));
+        result = stage("SquashCtxtLogTime", sim.SquashCtxtLogTime(sum, squash));
+    }
+    else{
+        throw invalid_argument("ERROR: query must be counting, maf, distribution or similarity");
+    }
+
+    sim_result.result = result;
+    sim_result.decrypts = result.Capacity() >= min_bits;
+    return sim_result;
+}
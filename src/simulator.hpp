@@ -0,0 +1,128 @@
+/*
+Offline noise and depth simulator: replays the server's query circuits (EQTest, the MultiplyMany tree, the squash
+rotations, the comparator's Paterson-Stockmeyer evaluation) on noise estimates alone, without keys or encryption,
+to predict the capacity a query's result keeps for a given set of BGV parameters.
+
+The model follows HElib's bookkeeping: every ciphertext carries the bits of its modulus and a bound on its noise
+(both log2, canonical embedding); products multiply the bounds, a multiplication first mods its operands down to
+the mod-switch noise floor, key switching adds noise at that floor. The modulus chain is treated as continuous, so
+the prediction is a few bits more optimistic than HElib's discrete primes; calibrate the constants against
+QueryNoiseLog when planning close to the limit
+*/
+
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+struct NoiseParams{
+    unsigned long m = 0;
+    unsigned long p = 0;
+    long phi_m = 0;
+    long slots = 0;
+    // bits of the ciphertext modulus at the top of the chain
+    double q_bits = 0;
+    // noise of a fresh encryption
+    double fresh_bits = 0;
+    // noise a mod-switch leaves (and the level HElib mods down to before a multiplication)
+    double floor_bits = 0;
+    // noise a key switch (relinearization, rotation) adds
+    double key_switch_bits = 0;
+
+    // estimates from the BGV parameters (the defaults of globals.hpp are M, P and BITS)
+    static NoiseParams FromContext(unsigned long m, unsigned long p, unsigned long bits);
+    void Print(ostream& out) const;
+};
+
+struct SimCtxt{
+    double q_bits;
+    double noise_bits;
+    int depth;
+
+    double Capacity() const { return q_bits - noise_bits; }
+};
+
+class NoiseSimulator{
+public:
+    NoiseSimulator(const NoiseParams& params);
+
+    SimCtxt Fresh() const;
+    // a fresh ciphertext mod-switched down to the given capacity (e.g. a block at the storage level)
+    SimCtxt WithCapacity(double capacity_bits) const;
+
+    SimCtxt Add(const SimCtxt& a, const SimCtxt& b) const;
+    // sum of `terms` ciphertexts like a
+    SimCtxt Sum(const SimCtxt& a, long terms) const;
+    SimCtxt Multiply(const SimCtxt& a, const SimCtxt& b) const;
+    SimCtxt Square(const SimCtxt& a) const { return Multiply(a, a); }
+    // by a constant whose canonical-embedding norm is 2^constant_bits
+    SimCtxt MultByConstant(const SimCtxt& a, double constant_bits) const;
+    SimCtxt Rotate(const SimCtxt& a) const;
+    // power e, computed the way HElib's DynamicCtxtPowers does
+    SimCtxt Power(const SimCtxt& a, long e) const;
+
+    // the server's circuits
+    SimCtxt EQTest(const SimCtxt& x) const;
+    // MultiplyMany over n ciphertexts like a
+    SimCtxt MultiplyMany(const SimCtxt& a, long n) const;
+    SimCtxt SquashCtxt(const SimCtxt& a, int num_data_elements) const;
+    // the doubling window the queries squash with
+    SimCtxt SquashCtxtLogTime(const SimCtxt& a, int num_data_elements) const;
+    // Comparator::compare with the univariate circuit (d = 1, len = 1)
+    SimCtxt Compare(const SimCtxt& x, const SimCtxt& y) const;
+
+    // norm bits of a constant in [0, p) and of a full plaintext (e.g. a slot mask)
+    double SmallConstantBits(long c) const;
+    double PlaintextBits() const;
+
+private:
+    SimCtxt ModDown(const SimCtxt& a, double q_bits) const;
+    // what a multiplication mods an operand down to
+    SimCtxt ModDownToFloor(const SimCtxt& a) const;
+
+    NoiseParams params;
+};
+
+// the comparator's Paterson-Stockmeyer split of its degree (p - 3) / 2 comparison polynomial in z^2 (p > 3): baby
+// steps are sqrt(degree / 2) rounded to a power of two
+struct CompareSteps{
+    long degree;
+    long baby_steps;
+    long giant_steps;
+
+    static CompareSteps ForModulus(long p);
+};
+
+struct QueryShape{
+    // counting, maf, distribution or similarity
+    string query = "counting";
+    int predicates = 1;
+    bool conjunctive = true;
+    long rows = 1000;
+    // rows were deleted, so every block is masked
+    bool masked = false;
+    // slots summed by the squash, 0 = min(rows, slots) as the server does
+    int squash = 0;
+    // capacity of the stored blocks (0 = fresh, full chain)
+    double input_bits = 0;
+};
+
+struct SimResult{
+    QueryShape shape;
+    long blocks = 0;
+    // state after each stage, in circuit order
+    vector<pair<string, SimCtxt>> stages;
+    SimCtxt result;
+    bool decrypts = false;
+
+    void Print(ostream& out) const;
+    void WriteJSON(ostream& out) const;
+};
+
+// replays one query on one block of each column (blocks are alike) and sums over the blocks;
+// decryption is predicted to succeed if min_bits of capacity are left
+SimResult SimulateQuery(const NoiseParams& params, const QueryShape& shape, double min_bits);
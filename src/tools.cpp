@@ -1,4 +1,5 @@
 #include "tools.hpp"
+#include "ops.hpp"
 
 void digit_decomp(vector<long>& decomp, unsigned long input, unsigned long base, int nslots)
 {
@@ -38,14 +39,14 @@ void simplePolyEval(Ctxt& ret, const NTL::ZZX& poly, DynamicCtxtPowers& babyStep
     rem(coef, coeff(poly,i),p);
     if (coef > p/2) coef -= p;
 
-    Ctxt tmp = babyStep.getPower(i); // X^i
-    tmp.multByConstant(coef);        // f_i X^i
-    ret += tmp;
+    Ctxt tmp = counted::GetPower(babyStep, i); // X^i
+    counted::MultByConstant(tmp, coef);        // f_i X^i
+    counted::Add(ret, tmp);
   }
   // Add the free term
   rem(coef, ConstTerm(poly), p);
   if (coef > p/2) coef -= p;
-  ret.addConstant(coef);
+  counted::AddConstant(ret, coef);
   //  if (verbose) checkPolyEval(ret, babyStep[0], poly);
 }
 
@@ -86,11 +87,11 @@ void PatersonStockmeyer(Ctxt& ret, const NTL::ZZX& poly, long k, long t, long de
 
   Ctxt tmp(ret.getPubKey(), ret.getPtxtSpace());
   simplePolyEval(tmp, c, babyStep);
-  tmp += giantStep.getPower(t);
-  ret.multiplyBy(tmp);
+  counted::Add(tmp, counted::GetPower(giantStep, t));
+  counted::Multiply(ret, tmp);
 
   PatersonStockmeyer(tmp, s, k, t/2, delta, babyStep, giantStep);
-  ret += tmp;
+  counted::Add(ret, tmp);
 }
 
 // This procedure assumes that k*(2^e +1) > deg(poly) > k*(2^e -1),
@@ -116,9 +117,9 @@ void degPowerOfTwo(Ctxt& ret, const NTL::ZZX& poly, long k,
 
   // multiply by X^{k(n-1)} with minimum depth
   for (long i=1; i<n; i*=2) {  
-    tmp.multiplyBy(giantStep.getPower(i));
+    counted::Multiply(tmp, counted::GetPower(giantStep, i));
   }
-  ret += tmp;
+  counted::Add(ret, tmp);
 }
 
 void recursivePolyEval(Ctxt& ret, const NTL::ZZX& poly, long k,
@@ -159,14 +160,14 @@ void recursivePolyEval(Ctxt& ret, const NTL::ZZX& poly, long k,
 
   PatersonStockmeyer(ret, q, k, t/2, 0, babyStep, giantStep);
 
-  Ctxt tmp = giantStep.getPower(u/k);
+  Ctxt tmp = counted::GetPower(giantStep, u/k);
   if (delta!=0) { // if u is not divisible by k then compute it
-    tmp.multiplyBy(babyStep.getPower(delta));
+    counted::Multiply(tmp, counted::GetPower(babyStep, delta));
   }
-  ret.multiplyBy(tmp);
+  counted::Multiply(ret, tmp);
 
   recursivePolyEval(tmp, r, k, babyStep, giantStep);
-  ret += tmp;
+  counted::Add(ret, tmp);
 }
  
 // Function to find modulo inverse of a
@@ -0,0 +1,110 @@
+#include "trace.hpp"
+#include "globals.hpp"
+
+#include <fstream>
+#include <stdexcept>
+
+static thread_local long trace_query = 0;
+static thread_local int trace_block = -1;
+static thread_local const char* trace_stage = nullptr;
+
+// small, stable ids instead of std::thread::id
+static int trace_thread_id(){
+    static atomic<int> next_thread(1);
+    static thread_local int id = next_thread++;
+    return id;
+}
+
+Tracer& Tracer::Global(){
+    static Tracer tracer;
+    return tracer;
+}
+
+Tracer::Tracer(): enabled(false), next_query(1), epoch(chrono::steady_clock::now()), dropped(0){
+}
+
+void Tracer::Enable(bool _enabled){
+    enabled.store(_enabled, memory_order_relaxed);
+}
+
+long Tracer::NewQuery(){
+    return next_query++;
+}
+
+double Tracer::Now() const{
+    return chrono::duration<double, micro>(chrono::steady_clock::now() - epoch).count();
+}
+
+void Tracer::Record(const TraceEvent& event){
+    lock_guard<mutex> guard(lock);
+    if ((long)events.size() >= constants::TRACE_MAX_EVENTS){
+        dropped++;
+        return;
+    }
+    events.push_back(event);
+}
+
+void Tracer::WriteChromeTrace(ostream& out){
+    lock_guard<mutex> guard(lock);
+
+    out << "{\"traceEvents\": [" << endl;
+    for (size_t i = 0; i < events.size(); i++){
+        const TraceEvent& e = events[i];
+        out << "  {\"name\": \"" << e.name << "\", \"cat\": \"pir\", \"ph\": \"X\", \"ts\": " << e.start_us
+            << ", \"dur\": " << e.duration_us << ", \"pid\": " << e.query << ", \"tid\": " << e.thread
+            << ", \"args\": {\"query\": " << e.query << ", \"block\": " << e.block << "}}"
+            << (i + 1 < events.size() ? "," : "") << endl;
+    }
+    out << "], \"displayTimeUnit\": \"ms\", \"otherData\": {\"dropped_events\": " << dropped << "}}" << endl;
+}
+
+void Tracer::WriteChromeTrace(const string& path){
+    ofstream out(path);
+    if (!out){
+        throw invalid_argument("ERROR: cannot write " + path);
+    }
+    WriteChromeTrace(out);
+}
+
+void Tracer::Clear(){
+    lock_guard<mutex> guard(lock);
+    events.clear();
+    dropped = 0;
+}
+
+TraceScope::TraceScope(long query, int block): previous_query(trace_query), previous_block(trace_block){
+    trace_query = query;
+    trace_block = block;
+}
+
+TraceScope::~TraceScope(){
+    trace_query = previous_query;
+    trace_block = previous_block;
+}
+
+long TraceScope::CurrentQuery(){
+    return trace_query;
+}
+
+int TraceScope::CurrentBlock(){
+    return trace_block;
+}
+
+const char* TraceScope::CurrentStage(){
+    return trace_stage;
+}
+
+TraceSpan::TraceSpan(const char* name): name(name), previous_stage(trace_stage), start_us(0), active(Tracer::Global().Enabled()){
+    trace_stage = name;
+    if (active){
+        start_us = Tracer::Global().Now();
+    }
+}
+
+TraceSpan::~TraceSpan(){
+    trace_stage = previous_stage;
+    if (active){
+        Tracer& tracer = Tracer::Global();
+        tracer.Record(TraceEvent{name, trace_query, trace_block, trace_thread_id(), start_us, tracer.Now() - start_us});
+    }
+}
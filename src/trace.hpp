@@ -0,0 +1,91 @@
+/*
+Query tracing: timed spans tagged with the query, block and thread they ran on, exported as Chrome trace-event
+JSON (chrome://tracing, Perfetto). Tracing is off by default and a disabled span costs one atomic load
+*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct TraceEvent{
+    const char* name;
+    long query;
+    int block;
+    int thread;
+    // microseconds since the tracer started
+    double start_us;
+    double duration_us;
+};
+
+class Tracer{
+public:
+    static Tracer& Global();
+
+    void Enable(bool enabled);
+    bool Enabled() const { return enabled.load(memory_order_relaxed); }
+
+    long NewQuery();
+    void Record(const TraceEvent& event);
+    double Now() const;
+
+    // one process per query, one thread per worker thread
+    void WriteChromeTrace(ostream& out);
+    void WriteChromeTrace(const string& path);
+    void Clear();
+
+private:
+    Tracer();
+
+    atomic<bool> enabled;
+    atomic<long> next_query;
+    chrono::steady_clock::time_point epoch;
+
+    vector<TraceEvent> events;
+    // events past the limit are counted, not kept
+    long dropped;
+    mutex lock;
+};
+
+// query and block the calling thread works on; spans pick them up. Restores the previous context on destruction
+class TraceScope{
+public:
+    TraceScope(long query, int block);
+    ~TraceScope();
+
+    static long CurrentQuery();
+    static int CurrentBlock();
+    // name of the innermost open span on this thread (nullptr outside of any span), traced or not
+    static const char* CurrentStage();
+
+private:
+    long previous_query;
+    int previous_block;
+};
+
+// records the time from construction to destruction; name must outlive the tracer (a string literal)
+class TraceSpan{
+public:
+    TraceSpan(const char* name);
+    ~TraceSpan();
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    const char* name;
+    const char* previous_stage;
+    double start_us;
+    bool active;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+// span over the rest of the enclosing scope
+#define TRACE_SPAN(name) TraceSpan TRACE_CONCAT(trace_span_, __LINE__)(name)
@@ -0,0 +1,223 @@
+#include "transport.hpp"
+#include "globals.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static const uint32_t FRAME_MAGIC = 0x46524950; // "PIRF"
+static const size_t FRAME_READ_STEP = 1 << 20;
+
+struct FrameHeader{
+    uint32_t magic;
+    uint32_t type;
+    uint64_t length;
+};
+
+void Connection::Send(const Frame& frame){
+    BeginFrame(frame.type).write(frame.payload.data(), frame.payload.size());
+    EndFrame();
+}
+
+bool Connection::Receive(Frame& frame){
+    istream* in = NextFrame(frame.type);
+    if (!in){
+        return false;
+    }
+    frame.payload.assign(istreambuf_iterator<char>(*in), istreambuf_iterator<char>());
+    ReleaseFrame();
+    return true;
+}
+
+static sockaddr_un socket_address(const string& path){
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)){
+        throw invalid_argument("ERROR: socket path " + path + " is too long");
+    }
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    return address;
+}
+
+unique_ptr<UnixSocketConnection> UnixSocketConnection::Connect(const string& path){
+    sockaddr_un address = socket_address(path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0){
+        throw runtime_error("ERROR: cannot create socket: " + string(strerror(errno)));
+    }
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0){
+        string reason = strerror(errno);
+        close(fd);
+        throw runtime_error("ERROR: cannot connect to " + path + ": " + reason);
+    }
+    return unique_ptr<UnixSocketConnection>(new UnixSocketConnection(fd));
+}
+
+UnixSocketConnection::UnixSocketConnection(int _fd) : fd(_fd){}
+
+UnixSocketConnection::~UnixSocketConnection(){
+    close(fd);
+}
+
+void UnixSocketConnection::WriteAll(const char* data, size_t size){
+    while (size > 0){
+        // MSG_NOSIGNAL: a closed peer is an error here, not a SIGPIPE
+        ssize_t written = send(fd, data, size, MSG_NOSIGNAL);
+        if (written < 0){
+            if (errno == EINTR){
+                continue;
+            }
+            throw runtime_error("ERROR: cannot send frame: " + string(strerror(errno)));
+        }
+        data += written;
+        size -= written;
+    }
+}
+
+bool UnixSocketConnection::ReadAll(char* data, size_t size){
+    size_t done = 0;
+    while (done < size){
+        ssize_t got = recv(fd, data + done, size - done, 0);
+        if (got < 0){
+            if (errno == EINTR){
+                continue;
+            }
+            throw runtime_error("ERROR: cannot receive frame: " + string(strerror(errno)));
+        }
+        if (got == 0){
+            if (done == 0){
+                return false;
+            }
+            throw runtime_error("ERROR: connection closed in the middle of a frame");
+        }
+        done += got;
+    }
+    return true;
+}
+
+ostream& UnixSocketConnection::BeginFrame(uint32_t type){
+    outgoing_type = type;
+    outgoing.str("");
+    outgoing.clear();
+    return outgoing;
+}
+
+void UnixSocketConnection::EndFrame(){
+    string payload = outgoing.str();
+    auto start = chrono::steady_clock::now();
+    FrameHeader header{FRAME_MAGIC, outgoing_type, payload.size()};
+    WriteAll(reinterpret_cast<const char*>(&header), sizeof(header));
+    WriteAll(payload.data(), payload.size());
+    outgoing.str("");
+
+    stats.frames_sent++;
+    stats.bytes_sent += sizeof(header) + payload.size();
+    stats.send_s += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+istream* UnixSocketConnection::NextFrame(uint32_t& type){
+    ReleaseFrame();
+    auto start = chrono::steady_clock::now();
+    FrameHeader header;
+    if (!ReadAll(reinterpret_cast<char*>(&header), sizeof(header))){
+        return nullptr;
+    }
+    if (header.magic != FRAME_MAGIC){
+        throw runtime_error("ERROR: malformed frame header");
+    }
+    if (header.length > max_frame_bytes){
+        throw runtime_error("ERROR: frame of " + to_string(header.length) + " bytes exceeds the limit of " + to_string(max_frame_bytes));
+    }
+
+    type = header.type;
+    // grown as the bytes arrive, so that a header alone cannot make us allocate its whole length
+    incoming.clear();
+    size_t done = 0;
+    while (done < header.length){
+        size_t step = min<size_t>(header.length - done, max<size_t>(done, FRAME_READ_STEP));
+        incoming.resize(done + step);
+        if (!ReadAll(&incoming[done], step)){
+            throw runtime_error("ERROR: connection closed in the middle of a frame");
+        }
+        done += step;
+    }
+
+    stats.frames_received++;
+    stats.bytes_received += sizeof(header) + header.length;
+    stats.receive_s += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    incoming_buffer.reset(new MemoryBuffer(incoming.data(), incoming.size()));
+    incoming_stream.rdbuf(incoming_buffer.get());
+    incoming_stream.clear();
+    return &incoming_stream;
+}
+
+void UnixSocketConnection::ReleaseFrame(){
+    incoming_stream.rdbuf(nullptr);
+    incoming_buffer.reset();
+    incoming.clear();
+}
+
+// a socket file left behind by a previous run would make bind fail; it is removed only if nothing listens on it,
+// and anything else at the path is left alone
+static void remove_stale_socket(const string& path, const sockaddr_un& address){
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0){
+        return;
+    }
+    if (!S_ISSOCK(st.st_mode)){
+        throw runtime_error("ERROR: cannot listen on " + path + ": the path exists and is not a socket");
+    }
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (probe < 0){
+        throw runtime_error("ERROR: cannot create socket: " + string(strerror(errno)));
+    }
+    int connected = connect(probe, reinterpret_cast<const sockaddr*>(&address), sizeof(address));
+    int error = errno;
+    close(probe);
+    if (connected == 0){
+        throw runtime_error("ERROR: cannot listen on " + path + ": another server is listening on it");
+    }
+    if (error != ECONNREFUSED){
+        throw runtime_error("ERROR: cannot listen on " + path + ": " + string(strerror(error)));
+    }
+    unlink(path.c_str());
+}
+
+UnixSocketListener::UnixSocketListener(const string& _path) : path(_path){
+    sockaddr_un address = socket_address(path);
+    remove_stale_socket(path, address);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0){
+        throw runtime_error("ERROR: cannot create socket: " + string(strerror(errno)));
+    }
+    if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(fd, 16) != 0){
+        string reason = strerror(errno);
+        close(fd);
+        throw runtime_error("ERROR: cannot listen on " + path + ": " + reason);
+    }
+}
+
+UnixSocketListener::~UnixSocketListener(){
+    close(fd);
+    unlink(path.c_str());
+}
+
+unique_ptr<UnixSocketConnection> UnixSocketListener::Accept(){
+    int connection;
+    do{
+        connection = accept(fd, nullptr, nullptr);
+    } while (connection < 0 && errno == EINTR);
+    if (connection < 0){
+        throw runtime_error("ERROR: cannot accept on " + path + ": " + string(strerror(errno)));
+    }
+    return unique_ptr<UnixSocketConnection>(new UnixSocketConnection(connection));
+}
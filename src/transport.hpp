@@ -0,0 +1,106 @@
+/*
+Local IPC between a Client and a Server: length-prefixed binary frames over a Unix-domain stream socket.
+A frame is a 16-byte header (magic, message type, payload length) followed by the payload. Connection is the
+interface QueryService and Client use; shared_memory.hpp has the same-host alternative
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include "globals.hpp"
+#include "io.hpp"
+
+using namespace std;
+
+struct Frame{
+    uint32_t type = 0;
+    string payload;
+};
+
+// bytes and time the transport itself spent moving frames or waiting for the peer (the payload's serialization
+// is not included)
+struct TransportStats{
+    size_t frames_sent = 0;
+    size_t frames_received = 0;
+    size_t bytes_sent = 0;
+    size_t bytes_received = 0;
+    double send_s = 0;
+    double receive_s = 0;
+};
+
+// one end of a connection; frames arrive in order and whole
+class Connection{
+public:
+    virtual ~Connection() = default;
+
+    // the payload of a frame is written to the returned stream, and the frame goes out at EndFrame
+    virtual ostream& BeginFrame(uint32_t type) = 0;
+    virtual void EndFrame() = 0;
+    // the payload of the next frame, readable until ReleaseFrame (or the next NextFrame); nullptr when the peer
+    // closed the connection between frames; throws runtime_error on a malformed or cut frame
+    virtual istream* NextFrame(uint32_t& type) = 0;
+    virtual void ReleaseFrame() = 0;
+
+    // whole frames, through the calls above
+    void Send(const Frame& frame);
+    bool Receive(Frame& frame);
+
+    const TransportStats& Stats() const { return stats; }
+    // payload bytes NextFrame accepts before it throws; set it to what the next frames can legitimately hold
+    void SetMaxFrameBytes(size_t bytes) { max_frame_bytes = bytes; }
+
+protected:
+    TransportStats stats;
+    size_t max_frame_bytes = constants::MAX_FRAME_BYTES;
+};
+
+class UnixSocketConnection : public Connection{
+public:
+    // connects to a listening socket
+    static unique_ptr<UnixSocketConnection> Connect(const string& path);
+    explicit UnixSocketConnection(int fd);
+    ~UnixSocketConnection() override;
+
+    UnixSocketConnection(const UnixSocketConnection&) = delete;
+    UnixSocketConnection& operator=(const UnixSocketConnection&) = delete;
+
+    // payloads are buffered whole on both sides: written once more into the socket, and read from it into memory
+    ostream& BeginFrame(uint32_t type) override;
+    void EndFrame() override;
+    istream* NextFrame(uint32_t& type) override;
+    void ReleaseFrame() override;
+
+private:
+    void WriteAll(const char* data, size_t size);
+    // false if the peer closed the connection before the first byte
+    bool ReadAll(char* data, size_t size);
+
+    int fd;
+    uint32_t outgoing_type = 0;
+    ostringstream outgoing;
+    string incoming;
+    unique_ptr<MemoryBuffer> incoming_buffer;
+    istream incoming_stream{nullptr};
+};
+
+// listening socket at a filesystem path, removed again on destruction. A stale socket file at the path is
+// replaced; a live one (another server accepts on it) or any other file makes the constructor throw
+class UnixSocketListener{
+public:
+    UnixSocketListener(const string& path);
+    ~UnixSocketListener();
+
+    UnixSocketListener(const UnixSocketListener&) = delete;
+    UnixSocketListener& operator=(const UnixSocketListener&) = delete;
+
+    unique_ptr<UnixSocketConnection> Accept();
+    const string& Path() const { return path; }
+
+private:
+    string path;
+    int fd;
+};
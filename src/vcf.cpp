@@ -0,0 +1,153 @@
+#include "vcf.hpp"
+
+#include <stdexcept>
+
+// number of fixed columns before the sample columns (CHROM ... FORMAT)
+static const int VCF_FIXED_COLUMNS = 9;
+
+VCFReader::VCFReader(istream& _in): in(_in){
+    string line;
+    while (getline(in, line)){
+        if (line.rfind("##", 0) == 0){
+            continue;
+        }
+        if (line.rfind("#CHROM", 0) != 0){
+            break;
+        }
+
+        size_t start = 0;
+        int column = 0;
+        while (start <= line.size()){
+            size_t end = line.find('\t', start);
+            if (end == string::npos){
+                end = line.size();
+            }
+            if (column >= VCF_FIXED_COLUMNS){
+                sample_names.push_back(line.substr(start, end - start));
+            }
+            column++;
+            start = end + 1;
+        }
+        return;
+    }
+    throw invalid_argument("ERROR: VCF file has no #CHROM header line");
+}
+
+int VCFReader::NumSamples() const{
+    return sample_names.size();
+}
+
+const vector<string>& VCFReader::SampleNames() const{
+    return sample_names;
+}
+
+bool VCFReader::NextRecord(string& line){
+    while (getline(in, line)){
+        if (!line.empty() && line[0] != '#'){
+            return true;
+        }
+    }
+    return false;
+}
+
+// number of non-reference alleles of a GT value such as "0/1", "1|1", "./." or "0/2"
+static unsigned char alt_allele_count(const char* gt, const char* end){
+    int count = 0;
+    bool in_allele = false;
+    bool is_ref = true;
+    for (const char* c = gt; c != end; c++){
+        if (*c == '/' || *c == '|'){
+            if (in_allele && !is_ref){
+                count++;
+            }
+            in_allele = false;
+            is_ref = true;
+        }
+        else if (*c >= '0' && *c <= '9'){
+            if (*c != '0'){
+                is_ref = false;
+            }
+            in_allele = true;
+        }
+        // '.' (missing) counts as reference
+    }
+    if (in_allele && !is_ref){
+        count++;
+    }
+    return count > 2 ? 2 : count;
+}
+
+VCFRecord ParseVCFRecord(const string& line, int num_samples){
+    VCFRecord record;
+    record.genotypes.reserve(num_samples);
+
+    const char* p = line.data();
+    const char* end = p + line.size();
+
+    // fixed columns; only ID and FORMAT are needed
+    int gt_index = -1;
+    for (int column = 0; column < VCF_FIXED_COLUMNS; column++){
+        const char* field_end = p;
+        while (field_end != end && *field_end != '\t'){
+            field_end++;
+        }
+        if (field_end == end && column < VCF_FIXED_COLUMNS - 1){
+            throw invalid_argument("ERROR: truncated VCF record");
+        }
+
+        if (column == 2){
+            record.id.assign(p, field_end);
+        }
+        else if (column == VCF_FIXED_COLUMNS - 1){
+            int index = 0;
+            const char* key = p;
+            for (const char* c = p; c <= field_end; c++){
+                if (c == field_end || *c == ':'){
+                    if (c - key == 2 && key[0] == 'G' && key[1] == 'T'){
+                        gt_index = index;
+                        break;
+                    }
+                    index++;
+                    key = c + 1;
+                }
+            }
+        }
+        p = field_end == end ? end : field_end + 1;
+    }
+    if (gt_index < 0){
+        throw invalid_argument("ERROR: VCF record " + record.id + " has no GT field");
+    }
+
+    while (num_samples > 0){
+        const char* field_end = p;
+        while (field_end != end && *field_end != '\t'){
+            field_end++;
+        }
+
+        // select the gt_index-th ':'-separated subfield
+        const char* gt = p;
+        for (int i = 0; i < gt_index && gt != field_end; i++){
+            while (gt != field_end && *gt != ':'){
+                gt++;
+            }
+            if (gt != field_end){
+                gt++;
+            }
+        }
+        const char* gt_end = gt;
+        while (gt_end != field_end && *gt_end != ':'){
+            gt_end++;
+        }
+
+        record.genotypes.push_back(alt_allele_count(gt, gt_end));
+        if (field_end == end){
+            break;
+        }
+        p = field_end + 1;
+    }
+
+    if ((int)record.genotypes.size() != num_samples){
+        throw invalid_argument("ERROR: VCF record " + record.id + " has " + to_string(record.genotypes.size()) + " samples, expected " + to_string(num_samples));
+    }
+    return record;
+}
@@ -0,0 +1,37 @@
+/*
+VCF parsing: genotype (GT) fields are mapped to the number of alternate alleles (0, 1 or 2)
+*/
+
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// One variant of a VCF file; genotypes[k] is the alternate allele count of sample k
+struct VCFRecord{
+    string id;
+    vector<unsigned char> genotypes;
+};
+
+// Sequential reader: consumes the meta-information and header lines on construction
+// and then hands out raw record lines, leaving the (expensive) parsing to the caller
+class VCFReader{
+public:
+    VCFReader(istream& in);
+
+    int NumSamples() const;
+    const vector<string>& SampleNames() const;
+
+    // returns false at the end of the file
+    bool NextRecord(string& line);
+
+private:
+    istream& in;
+    vector<string> sample_names;
+};
+
+// Parses a record line; missing genotypes ("./.") are mapped to 0
+VCFRecord ParseVCFRecord(const string& line, int num_samples);
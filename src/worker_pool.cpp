@@ -0,0 +1,157 @@
+#include "worker_pool.hpp"
+
+// the pool the calling thread works for, nullptr outside any pool
+static thread_local const WorkerPool* current_pool = nullptr;
+
+WorkerPool::WorkerPool(int num_threads, size_t _max_queued){
+    if (num_threads <= 0){
+        num_threads = max(1u, thread::hardware_concurrency());
+    }
+    max_queued = _max_queued == 0 ? 2 * num_threads : _max_queued;
+    active = 0;
+    stopping = false;
+
+    for (int i = 0; i < num_threads; i++){
+        threads.emplace_back(&WorkerPool::Run, this);
+    }
+}
+
+WorkerPool::~WorkerPool(){
+    {
+        unique_lock<mutex> guard(lock);
+        all_done.wait(guard, [this](){ return tasks.empty() && active == 0; });
+        stopping = true;
+    }
+    task_available.notify_all();
+    for (thread& t : threads){
+        t.join();
+    }
+}
+
+void WorkerPool::Submit(function<void()> task){
+    {
+        unique_lock<mutex> guard(lock);
+        slot_available.wait(guard, [this](){ return tasks.size() < max_queued; });
+        tasks.push_back(move(task));
+    }
+    task_available.notify_one();
+}
+
+bool WorkerPool::TrySubmit(function<void()> task){
+    {
+        lock_guard<mutex> guard(lock);
+        if (tasks.size() >= max_queued){
+            return false;
+        }
+        tasks.push_back(move(task));
+    }
+    task_available.notify_one();
+    return true;
+}
+
+void WorkerPool::Wait(){
+    unique_lock<mutex> guard(lock);
+    all_done.wait(guard, [this](){ return tasks.empty() && active == 0; });
+    if (error){
+        exception_ptr e = error;
+        error = nullptr;
+        rethrow_exception(e);
+    }
+}
+
+int WorkerPool::Size() const{
+    return threads.size();
+}
+
+bool WorkerPool::OnPoolThread() const{
+    return current_pool == this;
+}
+
+size_t WorkerPool::Pending(){
+    lock_guard<mutex> guard(lock);
+    return tasks.size() + active;
+}
+
+void WorkerPool::Run(){
+    current_pool = this;
+    while (true){
+        function<void()> task;
+        {
+            unique_lock<mutex> guard(lock);
+            task_available.wait(guard, [this](){ return stopping || !tasks.empty(); });
+            if (tasks.empty()){
+                return;
+            }
+            task = move(tasks.front());
+            tasks.pop_front();
+            active++;
+        }
+        slot_available.notify_one();
+
+        try{
+            task();
+        }
+        catch (...){
+            lock_guard<mutex> guard(lock);
+            if (!error){
+                error = current_exception();
+            }
+        }
+
+        {
+            lock_guard<mutex> guard(lock);
+            active--;
+            if (tasks.empty() && active == 0){
+                all_done.notify_all();
+            }
+        }
+    }
+}
+
+TaskGroup::TaskGroup(WorkerPool& pool, size_t window): pool(pool), window(max<size_t>(1, window)), in_flight(0){
+}
+
+TaskGroup::~TaskGroup(){
+    unique_lock<mutex> guard(lock);
+    finished.wait(guard, [this](){ return in_flight == 0; });
+}
+
+void TaskGroup::Submit(function<void()> task){
+    {
+        unique_lock<mutex> guard(lock);
+        finished.wait(guard, [this](){ return in_flight < window; });
+        if (error){
+            return;
+        }
+        in_flight++;
+    }
+
+    pool.Submit([this, task]() mutable {
+        exception_ptr task_error;
+        try{
+            task();
+        }
+        catch (...){
+            task_error = current_exception();
+        }
+        // whatever the task captured goes before the group may be destroyed
+        task = nullptr;
+
+        lock_guard<mutex> guard(lock);
+        if (task_error && !error){
+            error = task_error;
+        }
+        in_flight--;
+        finished.notify_all();
+    });
+}
+
+void TaskGroup::Wait(){
+    unique_lock<mutex> guard(lock);
+    finished.wait(guard, [this](){ return in_flight == 0; });
+    if (error){
+        exception_ptr e = error;
+        error = nullptr;
+        rethrow_exception(e);
+    }
+}
@@ -0,0 +1,80 @@
+/*
+Fixed-size thread pool with a bounded task queue
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+class WorkerPool{
+public:
+    // num_threads = 0 uses all hardware threads, max_queued = 0 allows two queued tasks per thread
+    WorkerPool(int num_threads = 0, size_t max_queued = 0);
+    // waits for the queued tasks before joining the threads
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    // blocks while the queue is full, which gives producers backpressure
+    void Submit(function<void()> task);
+    // returns false instead of blocking when the queue is full
+    bool TrySubmit(function<void()> task);
+
+    // blocks until every submitted task has finished and rethrows the first exception a task threw
+    void Wait();
+
+    int Size() const;
+    size_t Pending();
+    // true on one of this pool's threads, where Submit on a full queue or Wait would wait for the caller itself
+    bool OnPoolThread() const;
+
+private:
+    void Run();
+
+    vector<thread> threads;
+    deque<function<void()>> tasks;
+    size_t max_queued;
+    size_t active;
+    bool stopping;
+    exception_ptr error;
+
+    mutex lock;
+    condition_variable task_available;
+    condition_variable slot_available;
+    condition_variable all_done;
+};
+
+// tasks of one caller on a shared pool: at most `window` of them are queued or running at a time, so several
+// callers (e.g. queries) can share the pool with bounded memory each. The caller must not be a pool thread
+class TaskGroup{
+public:
+    TaskGroup(WorkerPool& pool, size_t window);
+    // waits for the group's tasks
+    ~TaskGroup();
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    // blocks while the window is full; tasks submitted after one failed are skipped
+    void Submit(function<void()> task);
+    // blocks until the group's tasks have finished and rethrows the first exception one of them threw
+    void Wait();
+
+private:
+    WorkerPool& pool;
+    size_t window;
+    size_t in_flight;
+    exception_ptr error;
+
+    mutex lock;
+    condition_variable finished;
+};